@@ -0,0 +1,351 @@
+#pragma once
+// Provider memory erasure coded over k data and m parity providers: any m
+// of them can go away at a cost of (k + m) / k times the region size,
+// 1.5x for 4+2, against 3x for three replicas.
+//
+// A region is cut into k equal shards, data shard i holding bytes
+// [i * shard size, (i + 1) * shard size), and parity shard j holding the
+// Reed-Solomon parity of the same positions. A write reads the old bytes and
+// the matching parity, folds old ^ new into every parity, and writes the new
+// bytes and parity back. Writes run one at a time so parity never mixes
+// two of them. Reads go to the data shard; if its provider is gone, the
+// bytes are rebuilt from any k survivors, never in the middle of a write.
+// Meant for large, cold regions: every write costs a round trip of reads
+// first.
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <utility>
+#include "reedsolomon.h"
+#include "remotememory.h"
+#include "replicatedmemory.h"
+
+#define ERASURE_ALIGN 64 // Shard sizes are a multiple of this, keeping the kernel on whole vectors
+
+class ErasureMemory
+{
+public:
+    using Address = std::pair<std::string, int>;
+
+    ErasureMemory(int k, int m) : k_(k), m_(m) {}
+    ~ErasureMemory() { disconnect(); }
+
+    // Connects to the k + m providers in `addresses`, data shards first.
+    // Returns how many answered; below quorum() nothing can be read.
+    size_t connect(const std::vector<Address> &addresses)
+    {
+        size_t connected = 0;
+        for (const Address &address : addresses)
+        {
+            auto shard = std::make_unique<Shard>();
+            shard->address = address;
+            shard->live = shard->memory.connect(address.first, address.second);
+            if (!shard->live)
+                std::cerr << "[Erasure] Cannot reach " << name(*shard) << std::endl;
+            connected += shard->live;
+            shards_.push_back(std::move(shard));
+        }
+        return connected;
+    }
+
+    void disconnect()
+    {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            closing_ = true;
+        }
+        for (auto &shard : shards_)
+            shard->memory.disconnect();
+    }
+
+    size_t replicas() const { return k_ + m_; }
+    size_t quorum() const { return k_; }
+
+    size_t live()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return std::count_if(shards_.begin(), shards_.end(), [](const auto &shard) { return shard->live; });
+    }
+
+    // One shard on each of the k + m providers; all of them must take it
+    uint16_t alloc(uint64_t size, uint32_t &region)
+    {
+        if (shards_.size() != size_t(k_ + m_) || live() != shards_.size())
+            return REPLICA_NO_QUORUM;
+        Stripe stripe;
+        stripe.size = size;
+        stripe.shard_size = ((size + k_ - 1) / k_ + ERASURE_ALIGN - 1) / ERASURE_ALIGN * ERASURE_ALIGN;
+        stripe.ids.assign(shards_.size(), 0);
+
+        std::vector<std::promise<std::pair<uint16_t, uint32_t>>> replies(shards_.size());
+        for (size_t s = 0; s < shards_.size(); s++)
+        {
+            shards_[s]->memory.alloc(stripe.shard_size, [&replies, s](uint16_t status, uint32_t id) {
+                replies[s].set_value({status, id});
+            });
+        }
+        uint16_t status = WIRE_OK;
+        for (size_t s = 0; s < shards_.size(); s++)
+        {
+            auto [result, id] = replies[s].get_future().get();
+            if (result == WIRE_OK)
+                stripe.ids[s] = id;
+            else if (status == WIRE_OK)
+                status = result == REMOTE_CONNECTION_LOST ? REPLICA_NO_QUORUM : result;
+            if (result == REMOTE_CONNECTION_LOST)
+                lost(s);
+        }
+        if (status != WIRE_OK)
+        {
+            release(stripe);
+            return status;
+        }
+
+        std::lock_guard<std::mutex> lock(lock_);
+        region = next_region_++;
+        stripes_[region] = std::move(stripe);
+        return WIRE_OK;
+    }
+
+    uint16_t free(uint32_t region)
+    {
+        Stripe stripe;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            auto it = stripes_.find(region);
+            if (it == stripes_.end())
+                return WIRE_OUT_OF_RANGE;
+            stripe = std::move(it->second);
+            stripes_.erase(it);
+        }
+        release(stripe);
+        return WIRE_OK;
+    }
+
+    uint16_t write(uint32_t region, uint64_t offset, const char *data, size_t length)
+    {
+        std::lock_guard<std::mutex> order(write_lock_);
+        Stripe stripe;
+        uint16_t status = find(region, offset, length, stripe);
+        if (status != WIRE_OK)
+            return status;
+
+        return pieces(stripe, offset, length, [&](int shard, uint64_t pos, size_t done, size_t piece) {
+            const uint8_t *fresh = reinterpret_cast<const uint8_t *>(data) + done;
+            std::vector<uint8_t> delta(piece);
+            std::vector<std::vector<uint8_t>> parity(m_);
+            while (true)
+            {
+                // Old bytes (rebuilt if their provider is gone) and the
+                // parity of every live parity shard
+                uint16_t status = read_piece(stripe, shard, pos, delta.data(), piece, true);
+                if (status != WIRE_OK)
+                    return status;
+                std::vector<int> targets;
+                std::vector<uint8_t *> buffers, parity_of(m_, nullptr);
+                for (int j = 0; j < m_; j++)
+                {
+                    if (!alive(k_ + j))
+                        continue;
+                    parity[j].resize(piece);
+                    parity_of[j] = parity[j].data();
+                    targets.push_back(k_ + j);
+                    buffers.push_back(parity_of[j]);
+                }
+                status = transfer(false, stripe, targets, pos, piece, buffers);
+                if (status == REMOTE_CONNECTION_LOST)
+                    continue; // Nothing written yet: start over with who is left
+                if (status != WIRE_OK)
+                    return status;
+
+                for (size_t i = 0; i < piece; i++)
+                    delta[i] ^= fresh[i];
+                rs_update(k_, m_, shard, delta.data(), parity_of.data(), piece);
+
+                // New bytes and parity together. A shard lost now is simply
+                // out; every shard that took its write is consistent.
+                if (alive(shard))
+                {
+                    targets.insert(targets.begin(), shard);
+                    buffers.insert(buffers.begin(), const_cast<uint8_t *>(fresh));
+                }
+                status = transfer(true, stripe, targets, pos, piece, buffers);
+                if (status != WIRE_OK && status != REMOTE_CONNECTION_LOST)
+                    return status;
+                return live() >= size_t(k_) ? uint16_t(WIRE_OK) : uint16_t(REPLICA_NO_QUORUM);
+            }
+        });
+    }
+
+    uint16_t read(uint32_t region, uint64_t offset, char *out, size_t length)
+    {
+        Stripe stripe;
+        uint16_t status = find(region, offset, length, stripe);
+        if (status != WIRE_OK)
+            return status;
+        return pieces(stripe, offset, length, [&](int shard, uint64_t pos, size_t done, size_t piece) {
+            return read_piece(stripe, shard, pos, reinterpret_cast<uint8_t *>(out) + done, piece);
+        });
+    }
+
+private:
+    struct Shard
+    {
+        Address address;
+        RemoteMemory memory;
+        bool live = false;
+    };
+
+    struct Stripe
+    {
+        uint64_t size = 0;
+        uint64_t shard_size = 0;
+        std::vector<uint32_t> ids; // Region id on each provider, 0 for none
+    };
+
+    static std::string name(const Shard &shard)
+    {
+        return shard.address.first + ":" + std::to_string(shard.address.second);
+    }
+
+    uint16_t find(uint32_t region, uint64_t offset, size_t length, Stripe &stripe)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        auto it = stripes_.find(region);
+        if (it == stripes_.end() || offset > it->second.size || length > it->second.size - offset)
+            return WIRE_OUT_OF_RANGE;
+        stripe = it->second;
+        return WIRE_OK;
+    }
+
+    bool alive(int shard)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return shards_[shard]->live;
+    }
+
+    void lost(size_t shard)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (!shards_[shard]->live)
+            return;
+        shards_[shard]->live = false;
+        if (!closing_)
+            std::cerr << "[Erasure] Lost " << name(*shards_[shard]) << std::endl;
+    }
+
+    void release(const Stripe &stripe)
+    {
+        for (size_t s = 0; s < stripe.ids.size(); s++)
+        {
+            if (stripe.ids[s] && alive(s))
+                shards_[s]->memory.free(stripe.ids[s], [](uint16_t) {});
+        }
+    }
+
+    // Split [offset, offset + length) of the region into the slices that
+    // fall in each data shard, calling piece(shard, position in it, bytes
+    // before it, slice length) until one fails
+    template <typename Piece>
+    uint16_t pieces(const Stripe &stripe, uint64_t offset, size_t length, Piece piece)
+    {
+        for (size_t done = 0; done < length;)
+        {
+            int shard = (offset + done) / stripe.shard_size;
+            uint64_t pos = (offset + done) % stripe.shard_size;
+            size_t slice = std::min<uint64_t>(length - done, stripe.shard_size - pos);
+            uint16_t status = piece(shard, pos, done, slice);
+            if (status != WIRE_OK)
+                return status;
+            done += slice;
+        }
+        return WIRE_OK;
+    }
+
+    // Read or write [pos, pos + length) of every listed shard from or into
+    // its buffer, all in flight at once. REMOTE_CONNECTION_LOST means some
+    // shard went away and is now marked lost.
+    uint16_t transfer(bool write, const Stripe &stripe, const std::vector<int> &targets, uint64_t pos, size_t length,
+                      const std::vector<uint8_t *> &buffers)
+    {
+        std::vector<std::pair<int, std::future<uint16_t>>> frames;
+        for (size_t t = 0; t < targets.size(); t++)
+        {
+            RemoteMemory &memory = shards_[targets[t]]->memory;
+            uint32_t id = stripe.ids[targets[t]];
+            for (size_t done = 0; done < length;)
+            {
+                uint32_t chunk = std::min<size_t>(length - done, WIRE_MAX_PAYLOAD);
+                char *at = reinterpret_cast<char *>(buffers[t]) + done;
+                frames.push_back({targets[t], write ? memory.write(id, pos + done, at, chunk)
+                                                    : memory.read(id, pos + done, at, chunk)});
+                done += chunk;
+            }
+        }
+        uint16_t status = WIRE_OK;
+        for (auto &[shard, frame] : frames)
+        {
+            uint16_t result = frame.get();
+            if (result == REMOTE_CONNECTION_LOST)
+                lost(shard);
+            if (status == WIRE_OK || result == REMOTE_CONNECTION_LOST)
+                status = result;
+        }
+        return status;
+    }
+
+    // Bytes of one data shard, rebuilt from k survivors if it is gone.
+    // `writing` says the caller is a write and already holds write_lock_.
+    uint16_t read_piece(const Stripe &stripe, int shard, uint64_t pos, uint8_t *out, size_t length,
+                        bool writing = false)
+    {
+        while (true)
+        {
+            if (alive(shard))
+            {
+                uint16_t status = transfer(false, stripe, {shard}, pos, length, {out});
+                if (status != REMOTE_CONNECTION_LOST)
+                    return status;
+                continue;
+            }
+
+            // Rebuilding mixes shards, so it must not see half of a write.
+            // Taken here rather than up front: the shard may be lost after
+            // the read started.
+            std::unique_lock<std::mutex> order(write_lock_, std::defer_lock);
+            if (!writing)
+                order.lock();
+
+            // Data shards first: they need no inversion work to speak of
+            std::vector<int> survivors;
+            for (int s = 0; s < k_ + m_ && int(survivors.size()) < k_; s++)
+            {
+                if (alive(s))
+                    survivors.push_back(s);
+            }
+            if (int(survivors.size()) < k_)
+                return REPLICA_NO_QUORUM;
+            std::vector<std::vector<uint8_t>> pieces(k_, std::vector<uint8_t>(length));
+            std::vector<uint8_t *> buffers;
+            for (auto &piece : pieces)
+                buffers.push_back(piece.data());
+            uint16_t status = transfer(false, stripe, survivors, pos, length, buffers);
+            if (status == REMOTE_CONNECTION_LOST)
+                continue;
+            if (status != WIRE_OK)
+                return status;
+            if (!rs_decode(k_, survivors, buffers.data(), shard, out, length))
+                return REPLICA_NO_QUORUM;
+            return WIRE_OK;
+        }
+    }
+
+    int k_, m_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::mutex write_lock_; // One read-modify-write at a time
+    std::mutex lock_;       // Guards stripes_ and the shards' live flags
+    std::map<uint32_t, Stripe> stripes_;
+    uint32_t next_region_ = 1;
+    bool closing_ = false;
+};
@@ -0,0 +1,360 @@
+#pragma once
+// Append-only journal of registry mutations with periodic snapshots.
+//
+// Every change to a persisted table (id -> value) is appended to the
+// current journal file as one small record instead of rewriting the whole
+// registry. A background writer thread batches whatever records arrived
+// while the previous fdatasync was running into one write + fdatasync
+// (group commit); callers that need durability wait for their sequence
+// number after dropping their own locks.
+//
+// Files, all in `dir`:
+//   registry.snapshot     full copy of the tables, covers journals < its generation
+//   registry.<gen>.journal records appended since that generation started
+//
+// Record: uint32 length | uint32 crc32 | uint8 op | int32 id | value bytes,
+// with length and crc covering op, id and value. A torn record at the end of
+// a journal (crash mid-write) fails its crc and ends replay there.
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define JOURNAL_SNAPSHOT_MAGIC 0x524e5350 // "RSNP"
+#define JOURNAL_RECORD_HEADER 8
+#define JOURNAL_COMPACT_BYTES (1 << 20) // Journal size that triggers a snapshot
+
+enum JournalOp : uint8_t
+{
+    JOURNAL_PUT = 1,   // id -> value
+    JOURNAL_ERASE = 2, // drop id
+};
+
+struct JournalRecord
+{
+    uint8_t op;
+    int32_t id;
+    std::string value;
+};
+
+inline uint32_t journal_crc32(const char *data, size_t length)
+{
+    static uint32_t table[256];
+    static bool ready = [] {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)ready;
+
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < length; i++)
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffff;
+}
+
+inline void journal_encode(std::string &out, uint8_t op, int32_t id, const std::string &value)
+{
+    size_t start = out.size();
+    uint32_t length = 1 + 4 + value.size();
+    out.resize(start + JOURNAL_RECORD_HEADER);
+    out.push_back(static_cast<char>(op));
+    out.append(reinterpret_cast<const char *>(&id), 4);
+    out += value;
+
+    uint32_t crc = journal_crc32(out.data() + start + JOURNAL_RECORD_HEADER, length);
+    memcpy(&out[start], &length, 4);
+    memcpy(&out[start + 4], &crc, 4);
+}
+
+// Decode the record at `data`, returning its size or 0 if it is torn or corrupt
+inline size_t journal_decode(const char *data, size_t available, JournalRecord &record)
+{
+    if (available < JOURNAL_RECORD_HEADER)
+        return 0;
+    uint32_t length, crc;
+    memcpy(&length, data, 4);
+    memcpy(&crc, data + 4, 4);
+    if (length < 5 || available - JOURNAL_RECORD_HEADER < length ||
+        journal_crc32(data + JOURNAL_RECORD_HEADER, length) != crc)
+        return 0;
+
+    const char *body = data + JOURNAL_RECORD_HEADER;
+    record.op = static_cast<uint8_t>(body[0]);
+    memcpy(&record.id, body + 1, 4);
+    record.value.assign(body + 5, length - 5);
+    return JOURNAL_RECORD_HEADER + length;
+}
+
+inline bool journal_read_file(const std::string &path, std::string &contents)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    char buffer[65536];
+    ssize_t n;
+    while ((n = ::read(fd, buffer, sizeof(buffer))) > 0)
+        contents.append(buffer, n);
+    ::close(fd);
+    return n == 0;
+}
+
+inline bool journal_write_all(int fd, const std::string &data)
+{
+    for (size_t done = 0; done < data.size();)
+    {
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+class RegistryJournal
+{
+public:
+    using Apply = std::function<void(const JournalRecord &record)>;
+
+    // Replay the snapshot and every journal after it through `apply`, then
+    // start a fresh journal for new records. Returns false if nothing was
+    // recovered (first start).
+    bool open(const std::string &dir, const Apply &apply)
+    {
+        dir_ = dir;
+        bool recovered = false;
+        uint64_t first = 0;
+
+        std::string snapshot;
+        if (journal_read_file(path_snapshot(), snapshot) && snapshot.size() >= 16)
+        {
+            uint32_t magic;
+            memcpy(&magic, snapshot.data(), 4);
+            if (magic == JOURNAL_SNAPSHOT_MAGIC)
+            {
+                memcpy(&first, snapshot.data() + 8, 8);
+                replay(snapshot.data() + 16, snapshot.size() - 16, apply);
+                recovered = true;
+            }
+            else
+            {
+                std::cerr << "[Journal] Ignoring snapshot with bad magic" << std::endl;
+            }
+        }
+
+        std::vector<uint64_t> generations = list_journals();
+        for (uint64_t generation : generations)
+        {
+            if (generation < first)
+                continue;
+            std::string contents;
+            if (journal_read_file(path_journal(generation), contents))
+            {
+                replay(contents.data(), contents.size(), apply);
+                recovered = true;
+            }
+        }
+
+        // Never append to a journal that may end in a torn record
+        generation_ = generations.empty() ? first : std::max(first, generations.back() + 1);
+        fd_ = open_journal(generation_);
+        std::thread(&RegistryJournal::writer, this).detach();
+        return recovered;
+    }
+
+    // Queue a record; O(1), meant to be called under the caller's registry
+    // lock so the journal order matches the order of the in-memory changes.
+    uint64_t append(uint8_t op, int32_t id, const std::string &value = "")
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        journal_encode(batch_, op, id, value);
+        bytes_ += JOURNAL_RECORD_HEADER + 5 + value.size();
+        wake_.notify_one();
+        return ++appended_;
+    }
+
+    // Block until record `sequence` (from append) has reached the disk
+    void wait(uint64_t sequence)
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        durable_cv_.wait(lock, [&] { return durable_ >= sequence; });
+    }
+
+    uint64_t bytes_since_snapshot()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return bytes_;
+    }
+
+    // Close the current journal and start the next generation. Call under
+    // the registry lock while copying the tables for a snapshot: the copy
+    // then holds exactly the records of the journals before the returned
+    // generation.
+    uint64_t rotate()
+    {
+        std::lock_guard<std::mutex> io(io_lock_);
+        std::lock_guard<std::mutex> lock(lock_);
+        flush_locked();
+        ::close(fd_);
+        fd_ = open_journal(++generation_);
+        bytes_ = 0;
+        return generation_;
+    }
+
+    // Write `records` as the snapshot covering journals before `generation`
+    // and delete those journals. Runs outside any registry lock.
+    bool write_snapshot(uint64_t generation, const std::vector<JournalRecord> &records)
+    {
+        std::string data(16, '\0');
+        uint32_t magic = JOURNAL_SNAPSHOT_MAGIC;
+        memcpy(&data[0], &magic, 4);
+        memcpy(&data[8], &generation, 8);
+        for (const JournalRecord &record : records)
+            journal_encode(data, record.op, record.id, record.value);
+
+        std::string tmp = path_snapshot() + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || !journal_write_all(fd, data) || fdatasync(fd) != 0)
+        {
+            std::cerr << "[Journal] Failed to write snapshot" << std::endl;
+            if (fd >= 0)
+                ::close(fd);
+            return false;
+        }
+        ::close(fd);
+        if (rename(tmp.c_str(), path_snapshot().c_str()) != 0)
+            return false;
+        sync_dir();
+
+        for (uint64_t old : list_journals())
+        {
+            if (old < generation)
+                unlink(path_journal(old).c_str());
+        }
+        return true;
+    }
+
+private:
+    // Group commit: everything queued while the last fdatasync ran goes out together
+    void writer()
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(lock_);
+                wake_.wait(lock, [this] { return !batch_.empty(); });
+            }
+            std::lock_guard<std::mutex> io(io_lock_);
+            std::unique_lock<std::mutex> lock(lock_);
+            flush_locked();
+        }
+    }
+
+    // Called with io_lock_ and lock_ held; drops lock_ around the disk I/O
+    // so appends keep queueing into the next batch meanwhile.
+    void flush_locked()
+    {
+        if (batch_.empty())
+            return;
+        std::string batch;
+        batch.swap(batch_);
+        uint64_t sequence = appended_;
+
+        lock_.unlock();
+        if (!journal_write_all(fd_, batch) || fdatasync(fd_) != 0)
+            std::cerr << "[Journal] Write to journal " << generation_ << " failed" << std::endl;
+        lock_.lock();
+
+        durable_ = sequence;
+        durable_cv_.notify_all();
+    }
+
+    void replay(const char *data, size_t length, const Apply &apply)
+    {
+        JournalRecord record;
+        size_t used;
+        while (length > 0 && (used = journal_decode(data, length, record)) > 0)
+        {
+            apply(record);
+            data += used;
+            length -= used;
+        }
+        if (length > 0)
+            std::cerr << "[Journal] Dropped " << length << " bytes of torn journal tail" << std::endl;
+    }
+
+    std::vector<uint64_t> list_journals()
+    {
+        std::vector<uint64_t> generations;
+        DIR *dir = opendir(dir_.c_str());
+        if (dir == nullptr)
+            return generations;
+        while (struct dirent *entry = readdir(dir))
+        {
+            unsigned long long generation;
+            char suffix[16];
+            if (sscanf(entry->d_name, "registry.%llu.%15s", &generation, suffix) == 2 && strcmp(suffix, "journal") == 0)
+                generations.push_back(generation);
+        }
+        closedir(dir);
+        std::sort(generations.begin(), generations.end());
+        return generations;
+    }
+
+    int open_journal(uint64_t generation)
+    {
+        int fd = ::open(path_journal(generation).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+            std::cerr << "[Journal] Cannot open " << path_journal(generation) << std::endl;
+        sync_dir();
+        return fd;
+    }
+
+    void sync_dir()
+    {
+        int fd = ::open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            fsync(fd);
+            ::close(fd);
+        }
+    }
+
+    std::string path_snapshot() const { return dir_ + "/registry.snapshot"; }
+    std::string path_journal(uint64_t generation) const
+    {
+        return dir_ + "/registry." + std::to_string(generation) + ".journal";
+    }
+
+    std::string dir_;
+    int fd_ = -1;
+    uint64_t generation_ = 0;
+
+    std::mutex io_lock_; // Serialises journal writes with rotation, taken before lock_
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::condition_variable durable_cv_;
+    std::string batch_;     // Encoded records not yet written
+    uint64_t appended_ = 0; // Sequence of the last queued record
+    uint64_t durable_ = 0;  // Sequence of the last record on disk
+    uint64_t bytes_ = 0;    // Journal bytes since the last rotation
+};
@@ -0,0 +1,321 @@
+#pragma once
+// Per-page packing of data-plane payloads: zero pages, LZ-compressed pages
+// and raw pages.
+//
+// A transfer of [offset, offset + length) is cut into pieces at region
+// page boundaries (PACK_PAGE), so the first and last pieces may be short.
+// Each piece goes as a kind byte followed by:
+//   PAGE_RAW:  its bytes
+//   PAGE_ZERO: nothing
+//   PAGE_LZ:   uint16 size, then an LZ block that expands to the piece
+// The LZ block format follows LZ4's: a token whose high nibble counts
+// literals and low nibble the match length past 4, longer counts in
+// 255-runs, the literals, then a little-endian uint16 match offset. The
+// block ends after a literal run. The zero check is SIMD. Compression is a
+// single greedy pass with a 4K-entry hash table, cheap enough to try on
+// every page of a write: data with no repeats in its first LZ_PROBE bytes
+// is given up on there.
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PACK_X86 1
+#endif
+
+#define PACK_PAGE 4096
+#define PACK_WORTHWHILE (PACK_PAGE * 7 / 8) // Compressed pages larger than this are sent raw
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_PROBE 1024 // Data with no match this far in is taken as incompressible
+
+enum PageKind : uint8_t
+{
+    PAGE_RAW = 0,
+    PAGE_ZERO = 1,
+    PAGE_LZ = 2,
+};
+
+// Length of the piece starting at `offset`, `remaining` bytes left
+inline size_t pack_piece(uint64_t offset, size_t remaining)
+{
+    return std::min<uint64_t>(remaining, PACK_PAGE - offset % PACK_PAGE);
+}
+
+inline bool is_zero_scalar(const uint8_t *data, size_t length)
+{
+    uint8_t any = 0;
+    for (size_t i = 0; i < length; i++)
+        any |= data[i];
+    return any == 0;
+}
+
+#ifdef PACK_X86
+__attribute__((target("sse2"))) inline bool is_zero_sse2(const uint8_t *data, size_t length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64)
+    {
+        __m128i any = _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i *)(data + i)),
+                                                _mm_loadu_si128((const __m128i *)(data + i + 16))),
+                                   _mm_or_si128(_mm_loadu_si128((const __m128i *)(data + i + 32)),
+                                                _mm_loadu_si128((const __m128i *)(data + i + 48))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xffff)
+            return false;
+    }
+    return is_zero_scalar(data + i, length - i);
+}
+
+__attribute__((target("avx2"))) inline bool is_zero_avx2(const uint8_t *data, size_t length)
+{
+    size_t i = 0;
+    for (; i + 128 <= length; i += 128)
+    {
+        __m256i any = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256((const __m256i *)(data + i)),
+                                                      _mm256_loadu_si256((const __m256i *)(data + i + 32))),
+                                      _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(data + i + 64)),
+                                                      _mm256_loadu_si256((const __m256i *)(data + i + 96))));
+        if (!_mm256_testz_si256(any, any))
+            return false;
+    }
+    return is_zero_scalar(data + i, length - i);
+}
+#endif
+
+// True if every byte is 0, with the widest scan this CPU runs
+inline bool is_zero(const void *data, size_t length)
+{
+    using Scan = bool (*)(const uint8_t *, size_t);
+#ifdef PACK_X86
+    static const Scan scan = __builtin_cpu_supports("avx2") ? is_zero_avx2
+                             : __builtin_cpu_supports("sse2") ? is_zero_sse2
+                                                              : is_zero_scalar;
+#else
+    static const Scan scan = is_zero_scalar;
+#endif
+    return scan(static_cast<const uint8_t *>(data), length);
+}
+
+inline uint32_t lz_load32(const uint8_t *at)
+{
+    uint32_t value;
+    memcpy(&value, at, 4);
+    return value;
+}
+
+// Appends a 255-run count for `value`, the part of a length past its nibble
+inline bool lz_put_count(uint8_t *out, size_t &op, size_t capacity, size_t value)
+{
+    for (; value >= 255; value -= 255)
+    {
+        if (op >= capacity)
+            return false;
+        out[op++] = 255;
+    }
+    if (op >= capacity)
+        return false;
+    out[op++] = value;
+    return true;
+}
+
+// One sequence: `literals` bytes from `from`, then a match of `match`
+// bytes `distance` back, or no match when `match` is 0 (the last sequence)
+inline bool lz_put_sequence(uint8_t *out, size_t &op, size_t capacity, const uint8_t *from, size_t literals,
+                            size_t distance, size_t match)
+{
+    size_t extra = match ? match - LZ_MIN_MATCH : 0;
+    if (op >= capacity)
+        return false;
+    out[op++] = uint8_t(std::min<size_t>(literals, 15) << 4 | std::min<size_t>(extra, 15));
+    if (literals >= 15 && !lz_put_count(out, op, capacity, literals - 15))
+        return false;
+    if (op + literals > capacity)
+        return false;
+    memcpy(out + op, from, literals);
+    op += literals;
+    if (!match)
+        return true;
+    if (op + 2 > capacity)
+        return false;
+    out[op++] = distance & 0xff;
+    out[op++] = distance >> 8;
+    return extra < 15 || lz_put_count(out, op, capacity, extra - 15);
+}
+
+// Compress `length` (at most 65535) bytes into at most `capacity` bytes.
+// Returns the compressed size, or 0 if it does not fit or looks incompressible.
+inline size_t lz_compress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity)
+{
+    uint16_t table[1 << LZ_HASH_BITS] = {};
+    size_t ip = 0, anchor = 0, op = 0;
+    // Matches stop short of the end so a 4-byte load never runs over
+    while (length >= LZ_MIN_MATCH && ip + LZ_MIN_MATCH <= length)
+    {
+        uint32_t sequence = lz_load32(in + ip);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = ip;
+        if (candidate < ip && lz_load32(in + candidate) == sequence)
+        {
+            size_t match = LZ_MIN_MATCH;
+            while (ip + match < length && in[candidate + match] == in[ip + match])
+                match++;
+            if (!lz_put_sequence(out, op, capacity, in + anchor, ip - anchor, ip - candidate, match))
+                return 0;
+            ip += match;
+            anchor = ip;
+            continue;
+        }
+        if (op == 0 && ip >= LZ_PROBE)
+            return 0;
+        // Skip ahead faster the longer nothing has matched
+        ip += 1 + ((ip - anchor) >> 6);
+    }
+    if (!lz_put_sequence(out, op, capacity, in + anchor, length - anchor, 0, 0))
+        return 0;
+    return op;
+}
+
+// Expand a block into exactly `length` bytes; false if it is malformed
+inline bool lz_decompress(const uint8_t *in, size_t size, uint8_t *out, size_t length)
+{
+    size_t ip = 0, op = 0;
+    auto count = [&](size_t &value) {
+        uint8_t byte;
+        do
+        {
+            if (ip >= size)
+                return false;
+            byte = in[ip++];
+            value += byte;
+        } while (byte == 255);
+        return true;
+    };
+    while (ip < size)
+    {
+        uint8_t token = in[ip++];
+        size_t literals = token >> 4;
+        if (literals == 15 && !count(literals))
+            return false;
+        if (literals > size - ip || literals > length - op)
+            return false;
+        memcpy(out + op, in + ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == size)
+            break;
+
+        if (size - ip < 2)
+            return false;
+        size_t distance = in[ip] | size_t(in[ip + 1]) << 8;
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15 && !count(match))
+            return false;
+        match += LZ_MIN_MATCH;
+        if (distance == 0 || distance > op || match > length - op)
+            return false;
+        // Overlapping copies repeat the last `distance` bytes, so go bytewise
+        const uint8_t *from = out + op - distance;
+        if (distance >= match)
+            memcpy(out + op, from, match);
+        else
+            for (size_t i = 0; i < match; i++)
+                out[op + i] = from[i];
+        op += match;
+    }
+    return op == length;
+}
+
+// Append one piece, picking the smallest of zero, LZ and raw; with
+// `compress` off only zero pieces are packed
+inline void pack_append(std::string &out, const char *data, size_t length, bool compress = true)
+{
+    if (is_zero(data, length))
+    {
+        out += char(PAGE_ZERO);
+        return;
+    }
+    if (compress && length > LZ_MIN_MATCH * 4)
+    {
+        uint8_t block[PACK_PAGE];
+        size_t size = lz_compress(reinterpret_cast<const uint8_t *>(data), length, block,
+                                  std::min<size_t>(length * 7 / 8, PACK_WORTHWHILE));
+        if (size)
+        {
+            out += char(PAGE_LZ);
+            out += char(size >> 8);
+            out += char(size & 0xff);
+            out.append(reinterpret_cast<char *>(block), size);
+            return;
+        }
+    }
+    out += char(PAGE_RAW);
+    out.append(data, length);
+}
+
+// Pack [offset, offset + length) of `data`; `data` points at offset
+inline std::string pack_pieces(const char *data, uint64_t offset, size_t length, bool compress = true)
+{
+    std::string out;
+    out.reserve(length + length / PACK_PAGE + 2);
+    for (size_t done = 0; done < length;)
+    {
+        size_t piece = pack_piece(offset + done, length - done);
+        pack_append(out, data + done, piece, compress);
+        done += piece;
+    }
+    return out;
+}
+
+// Walk packed pieces of [offset, offset + length), calling
+// piece(position, length, kind, bytes, size) for each; false if malformed
+template <typename Piece>
+bool unpack_pieces(const char *in, size_t size, uint64_t offset, size_t length, Piece piece)
+{
+    size_t ip = 0;
+    for (size_t done = 0; done < length;)
+    {
+        size_t piece_length = pack_piece(offset + done, length - done);
+        if (ip >= size)
+            return false;
+        uint8_t kind = in[ip++];
+        size_t bytes = 0;
+        if (kind == PAGE_RAW)
+        {
+            bytes = piece_length;
+        }
+        else if (kind == PAGE_LZ)
+        {
+            if (size - ip < 2)
+                return false;
+            bytes = uint8_t(in[ip]) << 8 | uint8_t(in[ip + 1]);
+            ip += 2;
+        }
+        else if (kind != PAGE_ZERO)
+        {
+            return false;
+        }
+        if (bytes > size - ip || !piece(offset + done, piece_length, kind, in + ip, bytes))
+            return false;
+        ip += bytes;
+        done += piece_length;
+    }
+    return ip == size;
+}
+
+// Expand one piece into `out`
+inline bool unpack_piece(uint8_t kind, const char *bytes, size_t size, char *out, size_t length)
+{
+    if (kind == PAGE_ZERO)
+        memset(out, 0, length);
+    else if (kind == PAGE_RAW)
+        memcpy(out, bytes, length);
+    else
+        return lz_decompress(reinterpret_cast<const uint8_t *>(bytes), size, reinterpret_cast<uint8_t *>(out),
+                             length);
+    return true;
+}
@@ -0,0 +1,129 @@
+#pragma once
+// Content-addressed store of whole pages, shared by every region of a
+// provider, so identical pages written by different gainers are held once.
+//
+// Pages are looked up by a 64-bit hash of their expanded bytes, and a hit
+// is compared in full before it is shared, so a hash collision never mixes
+// two pages. Each page is kept in the form it arrived in (raw or an LZ
+// block from pagecodec.h) with a count of the region pages that refer to
+// it. Stored pages never change: a region that writes into one of its
+// pages expands it into its own memory and drops its reference, which is
+// the copy in copy-on-write.
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "pagecodec.h"
+
+struct StoredPage
+{
+    uint64_t hash;
+    uint8_t kind;      // PAGE_RAW or PAGE_LZ
+    std::string bytes; // The page in that form
+    uint32_t refs = 0;
+
+    // The PACK_PAGE bytes of the page
+    void expand(char *out) const { unpack_piece(kind, bytes.data(), bytes.size(), out, PACK_PAGE); }
+};
+
+// Four independent multiply-xor lanes over 8-byte words, so the multiplies
+// overlap; several GB/s, which keeps it well under the cost of the copy
+inline uint64_t page_hash(const char *data, size_t length)
+{
+    const uint64_t prime = 0x9e3779b97f4a7c15ull;
+    uint64_t lane[4] = {prime, prime ^ 1, prime ^ 2, prime ^ 3};
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        for (int l = 0; l < 4; l++)
+        {
+            uint64_t word;
+            memcpy(&word, data + i + l * 8, 8);
+            lane[l] = (lane[l] ^ word) * 0xff51afd7ed558ccdull;
+            lane[l] ^= lane[l] >> 29;
+        }
+    }
+    uint64_t hash = length;
+    for (int l = 0; l < 4; l++)
+        hash = (hash ^ lane[l]) * prime;
+    for (; i < length; i++)
+        hash = (hash ^ uint8_t(data[i])) * prime;
+    return hash ^ hash >> 32;
+}
+
+class PageStore
+{
+public:
+    // A reference to the stored page equal to `page` (PACK_PAGE expanded
+    // bytes), storing `bytes`, its `kind` form, if there is none yet
+    StoredPage *intern(const char *page, uint8_t kind, const char *bytes, size_t size)
+    {
+        uint64_t hash = page_hash(page, PACK_PAGE);
+        std::lock_guard<std::mutex> lock(lock_);
+        auto range = pages_.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            StoredPage &stored = *it->second;
+            if (!same(stored, page, kind, bytes, size))
+                continue;
+            stored.refs++;
+            references_++;
+            return &stored;
+        }
+        auto stored = std::make_unique<StoredPage>();
+        stored->hash = hash;
+        stored->kind = kind;
+        stored->bytes.assign(bytes, size);
+        stored->refs = 1;
+        held_ += size;
+        references_++;
+        return pages_.emplace(hash, std::move(stored))->second.get();
+    }
+
+    void release(StoredPage *page)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        references_--;
+        if (--page->refs)
+            return;
+        auto range = pages_.equal_range(page->hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second.get() == page)
+            {
+                held_ -= page->bytes.size();
+                pages_.erase(it);
+                return;
+            }
+        }
+    }
+
+    // Region pages that refer to a stored page, distinct stored pages, and
+    // the bytes those take
+    void stats(uint64_t &references, uint64_t &pages, uint64_t &held)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        references = references_;
+        pages = pages_.size();
+        held = held_;
+    }
+
+private:
+    // The same form compares directly; the compressor is deterministic, so
+    // equal pages packed the same way give equal blocks
+    static bool same(const StoredPage &stored, const char *page, uint8_t kind, const char *bytes, size_t size)
+    {
+        if (stored.kind == kind)
+            return stored.bytes.size() == size && memcmp(stored.bytes.data(), bytes, size) == 0;
+        char expanded[PACK_PAGE];
+        stored.expand(expanded);
+        return memcmp(expanded, page, PACK_PAGE) == 0;
+    }
+
+    std::mutex lock_;
+    std::unordered_multimap<uint64_t, std::unique_ptr<StoredPage>> pages_;
+    uint64_t references_ = 0;
+    uint64_t held_ = 0;
+};
@@ -0,0 +1,196 @@
+#pragma once
+// Versioned peer list with a change log, so polling costs track churn.
+//
+// Every add or remove bumps the version and is logged as (id, added). A
+// client that already holds version V asks for the changes since V and gets
+// just those. New clients, and clients that fell further behind than the log
+// reaches, page through a pre-serialised snapshot instead. The snapshot is
+// rebuilt lazily off the registration path by merging the log into the
+// previous snapshot, so registrations only ever pay for a log append.
+//
+// Versions start from the boot time in microseconds. That keeps them
+// increasing across restarts, so a version from an earlier run is simply
+// too old and falls back to a full listing.
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define PEERLIST_LOG_SIZE 65536 // Changes kept for delta replies
+
+struct PeerListSnapshot
+{
+    uint64_t version;
+    std::vector<int32_t> ids; // Sorted
+    std::string encoded;      // ids as big-endian int32s, ready to copy into replies
+};
+
+class PeerListCache
+{
+public:
+    PeerListCache()
+    {
+        version_ = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count();
+        log_start_ = version_ + 1;
+        publish(std::make_shared<PeerListSnapshot>(PeerListSnapshot{version_, {}, ""}));
+    }
+
+    // Start from a recovered id set (not logged)
+    void reset(std::vector<int32_t> ids)
+    {
+        std::sort(ids.begin(), ids.end());
+        std::lock_guard<std::mutex> rebuild(rebuild_lock_);
+        std::lock_guard<std::mutex> lock(lock_);
+        log_.clear();
+        log_start_ = ++version_ + 1;
+        auto snapshot = std::make_shared<PeerListSnapshot>();
+        snapshot->version = version_;
+        snapshot->ids = std::move(ids);
+        encode(*snapshot);
+        publish(std::move(snapshot));
+    }
+
+    void add(int32_t id) { record(id, true); }
+    void remove(int32_t id) { record(id, false); }
+
+    // Changes after `since`. False if `since` is older than the log reaches
+    // or the delta would be longer than `limit`; the caller then pages the
+    // snapshot instead.
+    bool delta(uint64_t since, size_t limit, std::vector<int32_t> &added, std::vector<int32_t> &removed,
+               uint64_t &version)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        version = version_;
+        if (since > version_ || since + 1 < log_start_ || version_ - since > limit)
+            return false;
+
+        // Net effect per id, an id added and removed again within the window cancels out
+        std::unordered_map<int32_t, bool> net;
+        for (size_t i = since + 1 - log_start_; i < log_.size(); i++)
+        {
+            auto [it, fresh] = net.emplace(log_[i].id, log_[i].added);
+            if (!fresh && it->second != log_[i].added)
+                net.erase(it);
+        }
+        for (const auto &[id, was_added] : net)
+            (was_added ? added : removed).push_back(id);
+        return true;
+    }
+
+    // Current snapshot, rebuilt first if the log has moved past it
+    std::shared_ptr<const PeerListSnapshot> snapshot()
+    {
+        std::shared_ptr<const PeerListSnapshot> current = std::atomic_load(&snapshot_);
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            if (current->version == version_)
+                return current;
+        }
+
+        std::lock_guard<std::mutex> rebuild(rebuild_lock_);
+        current = std::atomic_load(&snapshot_); // Someone may have rebuilt it meanwhile
+
+        std::unordered_map<int32_t, bool> net;
+        uint64_t version;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            version = version_;
+            for (size_t i = current->version + 1 - log_start_; i < log_.size(); i++)
+                net[log_[i].id] = log_[i].added;
+        }
+        if (version == current->version)
+            return current;
+
+        // Merge outside the log lock so registrations keep appending meanwhile
+        auto next = std::make_shared<PeerListSnapshot>();
+        next->version = version;
+        next->ids.reserve(current->ids.size() + net.size());
+        for (int32_t id : current->ids)
+        {
+            auto it = net.find(id);
+            if (it == net.end())
+                next->ids.push_back(id);
+            else if (it->second)
+            {
+                // Removed and added back since the last snapshot: still listed, once
+                next->ids.push_back(id);
+                net.erase(it);
+            }
+        }
+        size_t merged = next->ids.size();
+        for (const auto &[id, listed] : net)
+        {
+            if (listed)
+                next->ids.push_back(id);
+        }
+        std::sort(next->ids.begin() + merged, next->ids.end());
+        std::inplace_merge(next->ids.begin(), next->ids.begin() + merged, next->ids.end());
+        encode(*next);
+        publish(next);
+        trim(version);
+        return next;
+    }
+
+private:
+    struct Change
+    {
+        int32_t id;
+        bool added;
+    };
+
+    void record(int32_t id, bool added)
+    {
+        bool long_log;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            log_.push_back({id, added});
+            version_++;
+            long_log = log_.size() > 2 * PEERLIST_LOG_SIZE;
+        }
+        // Clients that only ever ask for deltas never rebuild the snapshot,
+        // and the log is only trimmed behind it; fold it in once it runs long
+        if (long_log)
+            snapshot();
+    }
+
+    // Keep at most PEERLIST_LOG_SIZE changes, but never ones the snapshot
+    // has not absorbed yet
+    void trim(uint64_t snapshot_version)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        while (log_.size() > PEERLIST_LOG_SIZE && log_start_ <= snapshot_version)
+        {
+            log_.pop_front();
+            log_start_++;
+        }
+    }
+
+    static void encode(PeerListSnapshot &snapshot)
+    {
+        snapshot.encoded.resize(snapshot.ids.size() * 4);
+        for (size_t i = 0; i < snapshot.ids.size(); i++)
+        {
+            uint32_t value = htonl(static_cast<uint32_t>(snapshot.ids[i]));
+            memcpy(&snapshot.encoded[i * 4], &value, 4);
+        }
+    }
+
+    void publish(std::shared_ptr<const PeerListSnapshot> snapshot) { std::atomic_store(&snapshot_, std::move(snapshot)); }
+
+    std::mutex lock_;         // Guards version_ and the log
+    std::mutex rebuild_lock_; // One snapshot rebuild at a time
+    uint64_t version_;
+    uint64_t log_start_;      // Version produced by log_.front()
+    std::deque<Change> log_;
+    std::shared_ptr<const PeerListSnapshot> snapshot_;
+};
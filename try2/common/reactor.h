@@ -0,0 +1,527 @@
+#pragma once
+// Event-driven TCP front end shared by the registry servers.
+//
+// One event loop per core. Each loop owns a SO_REUSEPORT listening socket,
+// so the kernel spreads new connections across loops, and an edge-triggered
+// epoll set for the connections it accepted. Loops only move bytes: a framer
+// cuts complete commands out of the input stream and the loop queues them on
+// a fixed pool of worker threads, which run the command handler and post the
+// reply back through an eventfd. A session has at most one command in flight,
+// so replies leave in request order without locking the session. A client
+// that sends faster than its commands are answered, or stops reading its
+// replies, is no longer read from until its backlog drains.
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define REACTOR_BACKLOG SOMAXCONN
+#define REACTOR_MAX_EVENTS 256
+#define REACTOR_READ_CHUNK 4096
+#define REACTOR_QUEUE_DEPTH 1024        // Commands waiting for a worker before submit() blocks the loop
+#define REACTOR_SESSION_COMMANDS 64     // Framed commands a session may queue before its loop stops reading it
+#define REACTOR_SESSION_BYTES (4 << 20) // Bytes of queued commands and unsent replies, likewise
+#ifndef FRAME_ERROR
+#define FRAME_ERROR SIZE_MAX // Framer verdict: the stream is corrupt, drop the connection
+#endif
+
+class EventLoop;
+
+// One client connection. `ip` and the handler fields are what command
+// handlers see; the rest belongs to the owning event loop.
+struct Session
+{
+    int fd = -1;
+    std::string ip;
+    int client_id = -1;             // Set by the handler once the client registers
+    bool close_after_reply = false; // Handler asks for the connection to be closed
+
+    EventLoop *loop = nullptr;
+    std::string input;
+    std::string output;
+    std::deque<std::string> pending; // Framed commands not yet handed to a worker
+    size_t pending_bytes = 0;        // Their total size
+    bool unread = false;             // Reading stopped at the cap; the socket may still hold data
+    bool busy = false;               // A worker is running one of our commands
+    bool eof = false;                // Client sent FIN; close once its commands are answered
+    bool closed = false;
+};
+
+// Cut one command off the front of `data`. Returns the bytes consumed, 0 if
+// no complete command has arrived yet, or FRAME_ERROR.
+using Framer = std::function<size_t(const char *data, size_t length, std::string &command)>;
+using CommandHandler = std::function<void(Session &session, const std::string &command, std::string &reply)>;
+using CloseHandler = std::function<void(Session &session)>;
+
+// Fixed set of threads fed through a bounded queue; submit() blocks while
+// the queue is full. That stalls the submitting loop as a whole and bounds
+// work across sessions; a single session's backlog is capped by its loop.
+class WorkerPool
+{
+public:
+    explicit WorkerPool(size_t depth = REACTOR_QUEUE_DEPTH) : depth_(depth) {}
+
+    void start(int workers)
+    {
+        for (int i = 0; i < workers; i++)
+            std::thread(&WorkerPool::run, this).detach();
+    }
+
+    void submit(std::function<void()> job)
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        not_full_.wait(lock, [this] { return jobs_.size() < depth_; });
+        jobs_.push_back(std::move(job));
+        not_empty_.notify_one();
+    }
+
+private:
+    void run()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(lock_);
+                not_empty_.wait(lock, [this] { return !jobs_.empty(); });
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+                not_full_.notify_one();
+            }
+            job();
+        }
+    }
+
+    size_t depth_;
+    std::mutex lock_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::deque<std::function<void()>> jobs_;
+};
+
+struct ReactorHandlers
+{
+    Framer framer;
+    CommandHandler on_command;
+    CloseHandler on_close;
+};
+
+// Listening socket for `port`; several may be bound at once with SO_REUSEPORT
+inline int reactor_listen(int port, bool reuse_port, bool nonblocking)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | (nonblocking ? SOCK_NONBLOCK : 0), 0);
+    if (fd < 0)
+        return -1;
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuse_port)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, REACTOR_BACKLOG) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Blocking send of the whole buffer, for the thread-per-client path
+inline bool send_all(int fd, const std::string &data)
+{
+    for (size_t sent = 0; sent < data.size();)
+    {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+class EventLoop
+{
+public:
+    EventLoop(const ReactorHandlers &handlers, WorkerPool &workers) : handlers_(handlers), workers_(workers) {}
+
+    bool open(int port)
+    {
+        listen_fd_ = reactor_listen(port, true, true);
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (listen_fd_ < 0 || epoll_fd_ < 0 || wake_fd_ < 0)
+            return false;
+        watch(listen_fd_, EPOLLIN | EPOLLET);
+        watch(wake_fd_, EPOLLIN | EPOLLET);
+        return true;
+    }
+
+    void run()
+    {
+        struct epoll_event events[REACTOR_MAX_EVENTS];
+        while (true)
+        {
+            int ready = epoll_wait(epoll_fd_, events, REACTOR_MAX_EVENTS, -1);
+            for (int i = 0; i < ready; i++)
+            {
+                int fd = events[i].data.fd;
+                if (fd == listen_fd_)
+                {
+                    accept_all();
+                    continue;
+                }
+                if (fd == wake_fd_)
+                {
+                    drain_completions();
+                    continue;
+                }
+
+                auto it = sessions_.find(fd);
+                if (it == sessions_.end())
+                    continue;
+                std::shared_ptr<Session> session = it->second;
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    read_session(session);
+                if (!session->closed && (events[i].events & EPOLLOUT))
+                {
+                    flush(session);
+                    resume(session);
+                }
+                if (drained(session))
+                    close_session(session);
+            }
+        }
+    }
+
+    // Called from a worker once a command has been handled
+    void complete(std::shared_ptr<Session> session, std::string reply)
+    {
+        {
+            std::lock_guard<std::mutex> lock(completion_lock_);
+            completions_.emplace_back(std::move(session), std::move(reply));
+        }
+        uint64_t one = 1;
+        if (write(wake_fd_, &one, sizeof(one)) != sizeof(one))
+            std::cerr << "[Server] Failed to wake event loop" << std::endl;
+    }
+
+private:
+    void watch(int fd, uint32_t events)
+    {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    void accept_all()
+    {
+        while (true)
+        {
+            struct sockaddr_in addr;
+            socklen_t addr_size = sizeof(addr);
+            int fd = accept4(listen_fd_, (struct sockaddr *)&addr, &addr_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+                return; // EAGAIN once the backlog is empty, or out of descriptors
+
+            int opt = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            auto session = std::make_shared<Session>();
+            session->fd = fd;
+            session->ip = inet_ntoa(addr.sin_addr);
+            session->loop = this;
+            sessions_[fd] = session;
+            watch(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+        }
+    }
+
+    // Edge triggered: keep reading until the socket runs dry, or until the
+    // session has as much queued as it may. No new edge will announce what
+    // is left in the socket then, so resume() comes back for it.
+    void read_session(const std::shared_ptr<Session> &session)
+    {
+        char buffer[REACTOR_READ_CHUNK];
+        while (true)
+        {
+            if (backlogged(*session))
+            {
+                session->unread = true;
+                break;
+            }
+            ssize_t n = recv(session->fd, buffer, sizeof(buffer), 0);
+            if (n > 0)
+            {
+                // Framing as we go leaves at most one partial command in
+                // `input`, and the framer bounds its size
+                session->input.append(buffer, n);
+                if (!frame(session))
+                    return;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            session->unread = false;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (n < 0)
+            {
+                close_session(session);
+                return;
+            }
+            // FIN: what came before it has been framed already
+            session->eof = true;
+            break;
+        }
+        dispatch(session);
+        if (drained(session))
+            close_session(session);
+    }
+
+    // Move the complete commands at the front of `input` to `pending`.
+    // Returns false if the stream was corrupt and the session closed.
+    bool frame(const std::shared_ptr<Session> &session)
+    {
+        size_t used = 0;
+        std::string command;
+        while (used < session->input.size())
+        {
+            size_t n = handlers_.framer(session->input.data() + used, session->input.size() - used, command);
+            if (n == 0)
+                break;
+            if (n == FRAME_ERROR)
+            {
+                close_session(session);
+                return false;
+            }
+            used += n;
+            session->pending_bytes += command.size();
+            session->pending.push_back(std::move(command));
+        }
+        session->input.erase(0, used);
+        return true;
+    }
+
+    bool backlogged(const Session &session) const
+    {
+        return session.pending.size() >= REACTOR_SESSION_COMMANDS ||
+               session.pending_bytes + session.output.size() >= REACTOR_SESSION_BYTES;
+    }
+
+    // Go back to a session that stopped reading at the cap, once it has room
+    void resume(const std::shared_ptr<Session> &session)
+    {
+        if (session->unread && !session->closed && !backlogged(*session))
+            read_session(session);
+    }
+
+    void dispatch(const std::shared_ptr<Session> &session)
+    {
+        if (session->busy || session->closed || session->pending.empty())
+            return;
+
+        session->busy = true;
+        std::string command = std::move(session->pending.front());
+        session->pending.pop_front();
+        session->pending_bytes -= command.size();
+        workers_.submit([this, session, command] {
+            std::string reply;
+            handlers_.on_command(*session, command, reply);
+            complete(session, std::move(reply));
+        });
+    }
+
+    void drain_completions()
+    {
+        uint64_t count;
+        while (read(wake_fd_, &count, sizeof(count)) > 0)
+            ;
+
+        std::vector<std::pair<std::shared_ptr<Session>, std::string>> done;
+        {
+            std::lock_guard<std::mutex> lock(completion_lock_);
+            done.swap(completions_);
+        }
+        for (auto &[session, reply] : done)
+        {
+            session->busy = false;
+            if (session->closed)
+            {
+                finish(session);
+                continue;
+            }
+            session->output += reply;
+            flush(session);
+            if (!session->closed)
+                dispatch(session);
+            resume(session);
+            if (drained(session))
+                close_session(session);
+        }
+    }
+
+    void flush(const std::shared_ptr<Session> &session)
+    {
+        size_t sent = 0;
+        while (sent < session->output.size())
+        {
+            ssize_t n = send(session->fd, session->output.data() + sent, session->output.size() - sent, MSG_NOSIGNAL);
+            if (n > 0)
+            {
+                sent += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break; // EPOLLOUT will fire once the socket drains
+            close_session(session);
+            return;
+        }
+        session->output.erase(0, sent);
+        if (session->output.empty() && session->close_after_reply && !session->busy)
+            close_session(session);
+    }
+
+    // A half-closed session is done once every command it sent is answered
+    bool drained(const std::shared_ptr<Session> &session)
+    {
+        return session->eof && !session->closed && !session->busy && session->pending.empty() &&
+               session->output.empty();
+    }
+
+    void close_session(const std::shared_ptr<Session> &session)
+    {
+        if (session->closed)
+            return;
+        session->closed = true;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, session->fd, nullptr);
+        sessions_.erase(session->fd);
+        close(session->fd);
+        if (!session->busy)
+            finish(session);
+    }
+
+    // The close handler goes through the workers too, loops never take registry locks
+    void finish(const std::shared_ptr<Session> &session)
+    {
+        if (handlers_.on_close)
+            workers_.submit([this, session] { handlers_.on_close(*session); });
+    }
+
+    const ReactorHandlers &handlers_;
+    WorkerPool &workers_;
+    int listen_fd_ = -1;
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    std::unordered_map<int, std::shared_ptr<Session>> sessions_;
+    std::mutex completion_lock_;
+    std::vector<std::pair<std::shared_ptr<Session>, std::string>> completions_;
+};
+
+class Reactor
+{
+public:
+    explicit Reactor(ReactorHandlers handlers) : handlers_(std::move(handlers)) {}
+
+    // Open `loops` listeners on `port` and serve forever on the calling thread
+    // plus loops - 1 more. Returns false if the port could not be bound.
+    bool run(int port, int loops, int workers)
+    {
+        for (int i = 0; i < loops; i++)
+        {
+            loops_.push_back(std::make_unique<EventLoop>(handlers_, workers_));
+            if (!loops_.back()->open(port))
+            {
+                std::cerr << "[Server] Could not listen on port " << port << std::endl;
+                return false;
+            }
+        }
+        workers_.start(workers);
+        for (int i = 1; i < loops; i++)
+            std::thread(&EventLoop::run, loops_[i].get()).detach();
+        loops_[0]->run();
+        return true;
+    }
+
+private:
+    ReactorHandlers handlers_;
+    WorkerPool workers_;
+    std::vector<std::unique_ptr<EventLoop>> loops_;
+};
+
+// The old model, kept for comparison: one blocking thread per connection
+inline void serve_thread_per_client(int port, const ReactorHandlers &handlers)
+{
+    int server_fd = reactor_listen(port, false, false);
+    if (server_fd < 0)
+    {
+        std::cerr << "[Server] Could not listen on port " << port << std::endl;
+        return;
+    }
+
+    while (true)
+    {
+        struct sockaddr_in addr;
+        socklen_t addr_size = sizeof(addr);
+        int client_sock = accept(server_fd, (struct sockaddr *)&addr, &addr_size);
+        if (client_sock < 0)
+            continue;
+
+        std::string ip = inet_ntoa(addr.sin_addr);
+        std::thread([client_sock, ip, &handlers] {
+            Session session;
+            session.fd = client_sock;
+            session.ip = ip;
+            char buffer[REACTOR_READ_CHUNK];
+            while (!session.close_after_reply)
+            {
+                ssize_t n = recv(client_sock, buffer, sizeof(buffer), 0);
+                if (n <= 0)
+                    break;
+                session.input.append(buffer, n);
+
+                std::string command, reply;
+                size_t used;
+                while (!session.close_after_reply &&
+                       (used = handlers.framer(session.input.data(), session.input.size(), command)) > 0)
+                {
+                    if (used == FRAME_ERROR)
+                    {
+                        session.close_after_reply = true;
+                        break;
+                    }
+                    session.input.erase(0, used);
+                    handlers.on_command(session, command, reply);
+                    if (!send_all(client_sock, reply))
+                        break;
+                    reply.clear();
+                }
+            }
+            close(client_sock);
+            if (handlers.on_close)
+                handlers.on_close(session);
+        }).detach();
+    }
+}
@@ -0,0 +1,247 @@
+#pragma once
+// Systematic Reed-Solomon over GF(2^8) for k data shards and m parity shards.
+//
+// Parity row j is a Cauchy row, coefficient 1 / ((k + j) ^ i) for data
+// shard i. Any k of the k + m shards therefore form an invertible matrix,
+// so any k survivors recover the rest. The hot loop is dst ^= c * src over a
+// buffer. It splits every byte into nibbles and looks up c times each nibble
+// in two 16-entry tables. SSSE3 and AVX2 versions do 16 or 32 of those
+// lookups per PSHUFB. The kernel is picked once from what the CPU supports,
+// so the header needs no special compiler flags.
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RS_X86 1
+#endif
+
+#define RS_POLY 0x11d     // x^8 + x^4 + x^3 + x^2 + 1
+#define RS_MAX_SHARDS 255 // k + m; the Cauchy points must be distinct field elements
+#define RS_BLOCK 16384    // Bytes per shard encoded at a time, so parity stays in L1/L2
+
+struct GfTables
+{
+    uint8_t exp[512];
+    uint8_t log[256];
+    uint8_t low[256][16];  // c * x for the low nibble x
+    uint8_t high[256][16]; // c * (x << 4) for the high nibble x
+
+    GfTables()
+    {
+        unsigned x = 1;
+        for (int i = 0; i < 255; i++)
+        {
+            exp[i] = exp[i + 255] = x;
+            log[x] = i;
+            x <<= 1;
+            if (x & 0x100)
+                x ^= RS_POLY;
+        }
+        exp[510] = exp[511] = exp[0];
+        log[0] = 0;
+        for (int c = 0; c < 256; c++)
+        {
+            for (int n = 0; n < 16; n++)
+            {
+                low[c][n] = mul(c, n);
+                high[c][n] = mul(c, n << 4);
+            }
+        }
+    }
+
+    uint8_t mul(uint8_t a, uint8_t b) const { return a && b ? exp[log[a] + log[b]] : 0; }
+    uint8_t inv(uint8_t a) const { return exp[255 - log[a]]; }
+};
+
+inline const GfTables &gf()
+{
+    static const GfTables tables;
+    return tables;
+}
+
+// dst ^= c * src, one byte at a time through the nibble tables
+inline void rs_mul_xor_scalar(uint8_t c, const uint8_t *src, uint8_t *dst, size_t length)
+{
+    const uint8_t *low = gf().low[c], *high = gf().high[c];
+    for (size_t i = 0; i < length; i++)
+        dst[i] ^= low[src[i] & 0x0f] ^ high[src[i] >> 4];
+}
+
+#ifdef RS_X86
+__attribute__((target("ssse3"))) inline void rs_mul_xor_ssse3(uint8_t c, const uint8_t *src, uint8_t *dst,
+                                                              size_t length)
+{
+    const __m128i low = _mm_loadu_si128((const __m128i *)gf().low[c]);
+    const __m128i high = _mm_loadu_si128((const __m128i *)gf().high[c]);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i product = _mm_xor_si128(_mm_shuffle_epi8(low, _mm_and_si128(in, mask)),
+                                        _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(in, 4), mask)));
+        __m128i out = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(out, product));
+    }
+    rs_mul_xor_scalar(c, src + i, dst + i, length - i);
+}
+
+__attribute__((target("avx2"))) inline void rs_mul_xor_avx2(uint8_t c, const uint8_t *src, uint8_t *dst,
+                                                            size_t length)
+{
+    // VPSHUFB looks up within each 128-bit lane, so both lanes get the tables
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)gf().low[c]));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)gf().high[c]));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64)
+    {
+        __m256i in0 = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i in1 = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+        __m256i p0 = _mm256_xor_si256(_mm256_shuffle_epi8(low, _mm256_and_si256(in0, mask)),
+                                      _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(in0, 4), mask)));
+        __m256i p1 = _mm256_xor_si256(_mm256_shuffle_epi8(low, _mm256_and_si256(in1, mask)),
+                                      _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(in1, 4), mask)));
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(dst + i)), p0));
+        _mm256_storeu_si256((__m256i *)(dst + i + 32),
+                            _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(dst + i + 32)), p1));
+    }
+    rs_mul_xor_ssse3(c, src + i, dst + i, length - i);
+}
+#endif
+
+using RsKernel = void (*)(uint8_t c, const uint8_t *src, uint8_t *dst, size_t length);
+
+// The widest kernel this CPU runs, with its name
+inline RsKernel rs_best_kernel(const char **name = nullptr)
+{
+#ifdef RS_X86
+    if (__builtin_cpu_supports("avx2"))
+    {
+        if (name)
+            *name = "avx2";
+        return rs_mul_xor_avx2;
+    }
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        if (name)
+            *name = "ssse3";
+        return rs_mul_xor_ssse3;
+    }
+#endif
+    if (name)
+        *name = "scalar";
+    return rs_mul_xor_scalar;
+}
+
+// dst ^= c * src with the best kernel; c of 0 and 1 skip the tables
+inline void rs_mul_xor(uint8_t c, const uint8_t *src, uint8_t *dst, size_t length)
+{
+    static const RsKernel kernel = rs_best_kernel();
+    if (c == 0)
+        return;
+    if (c == 1)
+    {
+        for (size_t i = 0; i < length; i++)
+            dst[i] ^= src[i];
+        return;
+    }
+    kernel(c, src, dst, length);
+}
+
+// Coefficient of data shard `i` in parity shard `j`
+inline uint8_t rs_coefficient(int k, int j, int i)
+{
+    return gf().inv(uint8_t((k + j) ^ i));
+}
+
+// Parity from scratch: parity[j] = sum over i of coefficient(j, i) * data[i].
+// Works RS_BLOCK bytes of every shard at a time to keep the parity cached.
+inline void rs_encode(int k, int m, const uint8_t *const *data, uint8_t *const *parity, size_t length,
+                      RsKernel kernel = nullptr)
+{
+    for (size_t start = 0; start < length; start += RS_BLOCK)
+    {
+        size_t block = std::min<size_t>(RS_BLOCK, length - start);
+        for (int j = 0; j < m; j++)
+        {
+            memset(parity[j] + start, 0, block);
+            for (int i = 0; i < k; i++)
+            {
+                if (kernel)
+                    kernel(rs_coefficient(k, j, i), data[i] + start, parity[j] + start, block);
+                else
+                    rs_mul_xor(rs_coefficient(k, j, i), data[i] + start, parity[j] + start, block);
+            }
+        }
+    }
+}
+
+// Data shard `i` changed by `delta` (old ^ new): fold it into every parity
+// shard that is present (non-null)
+inline void rs_update(int k, int m, int i, const uint8_t *delta, uint8_t *const *parity, size_t length)
+{
+    for (int j = 0; j < m; j++)
+    {
+        if (parity[j])
+            rs_mul_xor(rs_coefficient(k, j, i), delta, parity[j], length);
+    }
+}
+
+// Recover data shard `want` from k surviving shards. `shards` lists their
+// indices (data 0..k-1, parity k..k+m-1); `pieces` holds their bytes in
+// the same order. Returns false if the shards do not form an invertible set.
+inline bool rs_decode(int k, const std::vector<int> &shards, const uint8_t *const *pieces, int want, uint8_t *out,
+                      size_t length)
+{
+    // Rows of the generator matrix for the survivors, next to the identity
+    std::vector<uint8_t> a(k * k), inverse(k * k, 0);
+    for (int r = 0; r < k; r++)
+    {
+        for (int c = 0; c < k; c++)
+            a[r * k + c] = shards[r] < k ? (shards[r] == c) : rs_coefficient(k, shards[r] - k, c);
+        inverse[r * k + r] = 1;
+    }
+
+    // Gauss-Jordan elimination
+    const GfTables &field = gf();
+    for (int col = 0; col < k; col++)
+    {
+        int pivot = col;
+        while (pivot < k && !a[pivot * k + col])
+            pivot++;
+        if (pivot == k)
+            return false;
+        for (int c = 0; c < k; c++)
+        {
+            std::swap(a[col * k + c], a[pivot * k + c]);
+            std::swap(inverse[col * k + c], inverse[pivot * k + c]);
+        }
+        uint8_t scale = field.inv(a[col * k + col]);
+        for (int c = 0; c < k; c++)
+        {
+            a[col * k + c] = field.mul(a[col * k + c], scale);
+            inverse[col * k + c] = field.mul(inverse[col * k + c], scale);
+        }
+        for (int r = 0; r < k; r++)
+        {
+            uint8_t factor = a[r * k + col];
+            if (r == col || !factor)
+                continue;
+            for (int c = 0; c < k; c++)
+            {
+                a[r * k + c] ^= field.mul(factor, a[col * k + c]);
+                inverse[r * k + c] ^= field.mul(factor, inverse[col * k + c]);
+            }
+        }
+    }
+
+    memset(out, 0, length);
+    for (int t = 0; t < k; t++)
+        rs_mul_xor(inverse[want * k + t], pieces[t], out, length);
+    return true;
+}
@@ -0,0 +1,188 @@
+#pragma once
+// Sharded id -> value table for the registry with RCU-style reads.
+//
+// Ids hash onto REGISTRY_SHARDS shards. Each shard publishes an immutable
+// sorted vector of its entries through an atomic shared_ptr. Readers load
+// the pointer and search or walk it without taking any lock a writer holds
+// for longer than that pointer swap. Writers serialise per shard, copy the
+// shard's vector, apply the change and publish the copy. Old versions are
+// freed when the last reader drops them. Shards are small enough that the
+// copy is a few KiB even with 100k peers.
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#define REGISTRY_SHARDS 256
+
+template <typename Value>
+class ShardedRegistry
+{
+public:
+    using Entries = std::vector<std::pair<int, Value>>; // Sorted by id
+    using Snapshot = std::shared_ptr<const Entries>;
+
+    ShardedRegistry()
+    {
+        for (Shard &shard : shards_)
+            shard.entries = std::make_shared<const Entries>();
+    }
+
+    bool find(int id, Value &value) const
+    {
+        Snapshot entries = snapshot(id);
+        auto it = lower_bound(*entries, id);
+        if (it == entries->end() || it->first != id)
+            return false;
+        value = it->second;
+        return true;
+    }
+
+    bool contains(int id) const
+    {
+        Snapshot entries = snapshot(id);
+        auto it = lower_bound(*entries, id);
+        return it != entries->end() && it->first == id;
+    }
+
+    size_t size() const { return count_.load(std::memory_order_relaxed); }
+
+    // Visit every entry, shard by shard. Each shard is seen as of one
+    // version; changes racing with the walk may or may not be included.
+    template <typename Visit>
+    void for_each(Visit visit) const
+    {
+        for (const Shard &shard : shards_)
+        {
+            Snapshot entries = std::atomic_load(&shard.entries);
+            for (const auto &[id, value] : *entries)
+                visit(id, value);
+        }
+    }
+
+    // Insert or replace. `under_lock` runs while the shard is held, so a
+    // journal append made there is ordered with other changes to this id.
+    // Returns true if the id was new.
+    template <typename Hook>
+    bool put(int id, const Value &value, Hook under_lock)
+    {
+        Shard &shard = shard_for(id);
+        std::lock_guard<std::mutex> lock(shard.write_lock);
+        auto entries = std::make_shared<Entries>(*shard.entries);
+        auto it = lower_bound(*entries, id);
+        bool added = it == entries->end() || it->first != id;
+        if (added)
+            entries->insert(it, {id, value});
+        else
+            it->second = value;
+        under_lock();
+        std::atomic_store(&shard.entries, Snapshot(std::move(entries)));
+        if (added)
+            count_.fetch_add(1, std::memory_order_relaxed);
+        observe_id(id);
+        return added;
+    }
+
+    bool put(int id, const Value &value)
+    {
+        return put(id, value, [] {});
+    }
+
+    // Remove `id`; `under_lock` only runs if it was present
+    template <typename Hook>
+    bool erase(int id, Hook under_lock)
+    {
+        Shard &shard = shard_for(id);
+        std::lock_guard<std::mutex> lock(shard.write_lock);
+        auto it = lower_bound(*shard.entries, id);
+        if (it == shard.entries->end() || it->first != id)
+            return false;
+
+        auto entries = std::make_shared<Entries>(*shard.entries);
+        entries->erase(entries->begin() + (it - shard.entries->begin()));
+        under_lock();
+        std::atomic_store(&shard.entries, Snapshot(std::move(entries)));
+        count_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool erase(int id)
+    {
+        return erase(id, [] {});
+    }
+
+    // Fresh id above every id seen so far
+    int next_id() { return next_id_.fetch_add(1, std::memory_order_relaxed); }
+
+    // Replace the whole table in one go, for recovery
+    void assign(const std::map<int, Value> &all)
+    {
+        std::vector<Entries> staged(REGISTRY_SHARDS);
+        for (const auto &[id, value] : all)
+        {
+            staged[shard_index(id)].emplace_back(id, value); // std::map order keeps each shard sorted
+            observe_id(id);
+        }
+        for (size_t i = 0; i < REGISTRY_SHARDS; i++)
+        {
+            std::lock_guard<std::mutex> lock(shards_[i].write_lock);
+            std::atomic_store(&shards_[i].entries, Snapshot(std::make_shared<const Entries>(std::move(staged[i]))));
+        }
+        count_.store(all.size(), std::memory_order_relaxed);
+    }
+
+    // Run `f` with every shard's writer lock held: a consistent cut of the
+    // table, e.g. to rotate the journal and copy the table for a snapshot.
+    // Readers carry on meanwhile.
+    template <typename F>
+    void with_writes_stopped(F f)
+    {
+        for (Shard &shard : shards_)
+            shard.write_lock.lock();
+        f();
+        for (Shard &shard : shards_)
+            shard.write_lock.unlock();
+    }
+
+private:
+    struct Shard
+    {
+        std::mutex write_lock;
+        Snapshot entries; // Accessed only through std::atomic_load/std::atomic_store
+    };
+
+    static size_t shard_index(int id)
+    {
+        return ((static_cast<uint32_t>(id) * 2654435761u) >> 24) & (REGISTRY_SHARDS - 1);
+    }
+
+    Shard &shard_for(int id) { return shards_[shard_index(id)]; }
+
+    Snapshot snapshot(int id) const { return std::atomic_load(&shards_[shard_index(id)].entries); }
+
+    static typename Entries::const_iterator lower_bound(const Entries &entries, int id)
+    {
+        return std::lower_bound(entries.begin(), entries.end(), id,
+                                [](const std::pair<int, Value> &entry, int key) { return entry.first < key; });
+    }
+
+    static typename Entries::iterator lower_bound(Entries &entries, int id)
+    {
+        return std::lower_bound(entries.begin(), entries.end(), id,
+                                [](const std::pair<int, Value> &entry, int key) { return entry.first < key; });
+    }
+
+    void observe_id(int id)
+    {
+        int next = next_id_.load(std::memory_order_relaxed);
+        while (id >= next && !next_id_.compare_exchange_weak(next, id + 1, std::memory_order_relaxed))
+            ;
+    }
+
+    Shard shards_[REGISTRY_SHARDS];
+    std::atomic<size_t> count_{0};
+    std::atomic<int> next_id_{1};
+};
@@ -0,0 +1,174 @@
+#pragma once
+// Gainer-side page cache of provider memory, kept coherent with leases.
+//
+// Pages come from the provider with a read lease. A cached page is used
+// until its lease runs out or the provider invalidates it because someone
+// else wrote to it. The gainer's own writes drop its copies as they are
+// issued. Every invalidation bumps an epoch. A fill that was requested
+// before the latest invalidation is thrown away, because it may carry
+// bytes from before the write. Eviction is CLOCK over a fixed set of
+// REMOTE_CACHE_PAGES slots.
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#define REMOTE_CACHE_PAGE 4096
+#define REMOTE_CACHE_PAGES 1024 // 4 MiB per connection
+
+// A cached page: the whole region id and page number, nothing folded away
+struct CacheKey
+{
+    uint32_t region = 0;
+    uint64_t page = 0;
+
+    bool operator==(const CacheKey &other) const { return region == other.region && page == other.page; }
+};
+
+struct CacheKeyHash
+{
+    size_t operator()(const CacheKey &key) const
+    {
+        return std::hash<uint64_t>()(key.page * 0x9e3779b97f4a7c15ull ^ key.region);
+    }
+};
+
+class RemoteCache
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit RemoteCache(size_t pages = REMOTE_CACHE_PAGES) : slots_(pages), data_(pages * REMOTE_CACHE_PAGE) {}
+
+    // Copy `length` bytes at `in_page` of the cached page, false on a miss
+    bool lookup(uint32_t region, uint64_t page, uint32_t in_page, char *out, uint32_t length)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        auto it = index_.find({region, page});
+        if (it == index_.end())
+        {
+            misses_++;
+            return false;
+        }
+        Slot &slot = slots_[it->second];
+        if (Clock::now() >= slot.expires || in_page + length > slot.valid)
+        {
+            drop(it);
+            misses_++;
+            return false;
+        }
+        slot.referenced = true;
+        memcpy(out, &data_[it->second * REMOTE_CACHE_PAGE] + in_page, length);
+        hits_++;
+        return true;
+    }
+
+    uint64_t epoch()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return epoch_;
+    }
+
+    // Install `valid` bytes of a page read under a lease ending at
+    // `expires`, unless something was invalidated since `epoch`
+    void fill(uint32_t region, uint64_t page, const char *data, uint32_t valid, Clock::time_point expires,
+              uint64_t epoch)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (epoch != epoch_)
+            return;
+        CacheKey id{region, page};
+        auto it = index_.find(id);
+        size_t index = it != index_.end() ? it->second : victim();
+        Slot &slot = slots_[index];
+        slot.key = id;
+        slot.used = true;
+        slot.referenced = true;
+        slot.valid = valid;
+        slot.expires = expires;
+        memcpy(&data_[index * REMOTE_CACHE_PAGE], data, valid);
+        index_[id] = index;
+    }
+
+    // Forget cached bytes in [offset, offset + length) of `region`
+    void invalidate(uint32_t region, uint64_t offset, uint64_t length)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        epoch_++;
+        if (length == 0)
+            return;
+        uint64_t first = offset / REMOTE_CACHE_PAGE;
+        uint64_t last = length > UINT64_MAX - offset ? UINT64_MAX / REMOTE_CACHE_PAGE
+                                                     : (offset + length - 1) / REMOTE_CACHE_PAGE;
+        if (last - first >= slots_.size())
+        {
+            // Wider than the whole cache: walk the slots instead of the range
+            for (size_t i = 0; i < slots_.size(); i++)
+            {
+                const CacheKey &id = slots_[i].key;
+                if (slots_[i].used && id.region == region && id.page >= first && id.page <= last)
+                    drop(index_.find(id));
+            }
+            return;
+        }
+        for (uint64_t page = first; page <= last; page++)
+        {
+            auto it = index_.find({region, page});
+            if (it != index_.end())
+                drop(it);
+        }
+    }
+
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+
+private:
+    struct Slot
+    {
+        CacheKey key;
+        bool used = false;
+        bool referenced = false;
+        uint32_t valid = 0;
+        Clock::time_point expires;
+    };
+
+    using Index = std::unordered_map<CacheKey, size_t, CacheKeyHash>;
+
+    void drop(Index::iterator it)
+    {
+        slots_[it->second].used = false;
+        index_.erase(it);
+    }
+
+    // CLOCK: sweep past recently used slots, clearing their bit, and take
+    // the first one that is free or was not used since the last sweep
+    size_t victim()
+    {
+        while (true)
+        {
+            size_t index = hand_;
+            hand_ = (hand_ + 1) % slots_.size();
+            Slot &slot = slots_[index];
+            if (!slot.used)
+                return index;
+            if (!slot.referenced)
+            {
+                index_.erase(slot.key);
+                slot.used = false;
+                return index;
+            }
+            slot.referenced = false;
+        }
+    }
+
+    std::mutex lock_;
+    std::vector<Slot> slots_;
+    std::vector<char> data_; // REMOTE_CACHE_PAGE bytes per slot
+    Index index_;
+    size_t hand_ = 0;
+    uint64_t epoch_ = 0;
+    uint64_t hits_ = 0, misses_ = 0;
+};
@@ -0,0 +1,593 @@
+#pragma once
+// Gainer side of the provider data plane, with many requests in flight.
+//
+// Requests go out as soon as they are issued, tagged with a request id.
+// A receiver thread matches each reply to its request by id and completes
+// it through the callback or future given at issue time, in whatever order
+// the replies arrive. Read payloads land directly in the caller's buffer,
+// so buffers passed to read() and write() must stay valid until completion.
+// At most REMOTE_MAX_INFLIGHT requests are outstanding; issuing more blocks.
+// Batches carry up to WIRE_BATCH_MAX small accesses in one request, each
+// with its own status, as long as descriptors and payloads fit one frame.
+// Callbacks run on the receiver thread and must not wait on this connection.
+// read_cached() goes through a RemoteCache of leased pages; the provider's
+// OP_INVALIDATE frames and this connection's own writes keep it coherent.
+// Invalidations are acknowledged, and the provider holds back a write's
+// reply until every other holder has, so an acknowledged write is seen.
+// Transfers of REMOTE_PACK_MIN bytes or more travel packed (pagecodec.h):
+// zero pages as a flag and compressible pages LZ-compressed, page by page,
+// whenever that is smaller than the raw bytes. Compressing writes costs
+// gainer CPU; compress(false) keeps only the zero pages, for fast links.
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "pagecodec.h"
+#include "remotecache.h"
+#include "wire.h"
+
+#define REMOTE_MAX_INFLIGHT 256
+#define REMOTE_CONNECTION_LOST 0xffff // Completion status when the provider went away first
+#define REMOTE_PACK_MIN 512 // Smaller transfers are not worth a pass over the bytes
+
+// One access of a batch. `data` is the destination of a read or the source
+// of a write; `status` is filled in on completion.
+struct RemoteIo
+{
+    uint32_t region;
+    uint64_t offset;
+    uint32_t length;
+    char *data;
+    uint16_t status = WIRE_OK;
+};
+
+class RemoteMemory
+{
+public:
+    using Done = std::function<void(uint16_t status)>;
+    using Allocated = std::function<void(uint16_t status, uint32_t region)>;
+
+    ~RemoteMemory() { disconnect(); }
+
+    bool connect(const std::string &ip, int port)
+    {
+        fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd_ < 0)
+            return false;
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+        if (::connect(fd_, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        int opt = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)); // Small requests must not wait on Nagle
+        connected_ = true;
+        receiver_ = std::thread([this] { receive(); });
+        return true;
+    }
+
+    // Close the connection; outstanding requests complete with REMOTE_CONNECTION_LOST
+    void disconnect()
+    {
+        if (fd_ < 0)
+            return;
+        shutdown(fd_, SHUT_RDWR);
+        if (receiver_.joinable())
+            receiver_.join();
+        close(fd_);
+        fd_ = -1;
+    }
+
+    void alloc(uint64_t size, Allocated done)
+    {
+        Pending pending;
+        pending.allocated = std::move(done);
+        issue(OP_ALLOC, std::move(pending), [&](WireWriter &frame) { frame.u64(size); });
+    }
+
+    void free(uint32_t region, Done done)
+    {
+        cache_.invalidate(region, 0, UINT64_MAX);
+        Pending pending;
+        pending.done = std::move(done);
+        issue(OP_FREE, std::move(pending), [&](WireWriter &frame) { frame.u32(region); });
+    }
+
+    // One frame each, so at most WIRE_MAX_PAYLOAD bytes
+    void read(uint32_t region, uint64_t offset, char *out, uint32_t length, Done done)
+    {
+        Pending pending;
+        pending.done = std::move(done);
+        pending.out = out;
+        pending.offset = offset;
+        pending.length = length;
+        issue(length >= REMOTE_PACK_MIN ? OP_READ_PACKED : OP_READ, std::move(pending),
+              [&](WireWriter &frame) { frame.u32(region).u64(offset).u32(length); });
+    }
+
+    void write(uint32_t region, uint64_t offset, const char *data, uint32_t length, Done done)
+    {
+        cache_.invalidate(region, offset, length);
+        Pending pending;
+        pending.done = std::move(done);
+        if (length >= REMOTE_PACK_MIN)
+        {
+            std::string pieces = pack_pieces(data, offset, length, compress_);
+            if (pieces.size() + 4 < length)
+            {
+                issue(OP_WRITE_PACKED, std::move(pending),
+                      [&](WireWriter &frame) { frame.u32(region).u64(offset).u32(length); }, pieces.data(),
+                      pieces.size());
+                return;
+            }
+        }
+        issue(OP_WRITE, std::move(pending), [&](WireWriter &frame) { frame.u32(region).u64(offset); }, data, length);
+    }
+
+    // `done` gets WIRE_OK once every entry has its own status filled in
+    void read_batch(RemoteIo *ios, size_t count, Done done) { batch(OP_READ_BATCH, ios, count, std::move(done)); }
+    void write_batch(RemoteIo *ios, size_t count, Done done) { batch(OP_WRITE_BATCH, ios, count, std::move(done)); }
+
+    std::future<uint16_t> read_batch(RemoteIo *ios, size_t count)
+    {
+        auto promise = std::make_shared<std::promise<uint16_t>>();
+        read_batch(ios, count, [promise](uint16_t status) { promise->set_value(status); });
+        return promise->get_future();
+    }
+
+    std::future<uint16_t> write_batch(RemoteIo *ios, size_t count)
+    {
+        auto promise = std::make_shared<std::promise<uint16_t>>();
+        write_batch(ios, count, [promise](uint16_t status) { promise->set_value(status); });
+        return promise->get_future();
+    }
+
+    std::future<uint16_t> read(uint32_t region, uint64_t offset, char *out, uint32_t length)
+    {
+        auto promise = std::make_shared<std::promise<uint16_t>>();
+        read(region, offset, out, length, [promise](uint16_t status) { promise->set_value(status); });
+        return promise->get_future();
+    }
+
+    std::future<uint16_t> write(uint32_t region, uint64_t offset, const char *data, uint32_t length)
+    {
+        auto promise = std::make_shared<std::promise<uint16_t>>();
+        write(region, offset, data, length, [promise](uint16_t status) { promise->set_value(status); });
+        return promise->get_future();
+    }
+
+    // Blocking calls for any size: large transfers are split into frames
+    // that are all in flight at once
+    uint16_t alloc(uint64_t size, uint32_t &region)
+    {
+        std::promise<uint16_t> promise;
+        alloc(size, [&](uint16_t status, uint32_t id) {
+            region = id;
+            promise.set_value(status);
+        });
+        return promise.get_future().get();
+    }
+
+    uint16_t free(uint32_t region)
+    {
+        std::promise<uint16_t> promise;
+        free(region, [&](uint16_t status) { promise.set_value(status); });
+        return promise.get_future().get();
+    }
+
+    uint16_t read_all(uint32_t region, uint64_t offset, char *out, size_t length)
+    {
+        return transfer(length, [&](size_t done, uint32_t chunk) {
+            return read(region, offset + done, out + done, chunk);
+        });
+    }
+
+    uint16_t write_all(uint32_t region, uint64_t offset, const char *data, size_t length)
+    {
+        return transfer(length, [&](size_t done, uint32_t chunk) {
+            return write(region, offset + done, data + done, chunk);
+        });
+    }
+
+    // Blocking read through the page cache. Cached pages are copied out
+    // locally; the missing ones are fetched whole under a lease, all in
+    // flight at once, and kept for the next read.
+    uint16_t read_cached(uint32_t region, uint64_t offset, char *out, size_t length)
+    {
+        struct Miss
+        {
+            uint64_t page;
+            std::vector<char> data;
+            uint32_t got = 0, lease_ms = 0;
+        };
+        uint64_t epoch = cache_.epoch();
+        std::vector<Miss> misses;
+        for (uint64_t page = offset / REMOTE_CACHE_PAGE; page * REMOTE_CACHE_PAGE < offset + length; page++)
+        {
+            uint64_t start = std::max(offset, page * REMOTE_CACHE_PAGE);
+            uint64_t end = std::min(offset + length, (page + 1) * REMOTE_CACHE_PAGE);
+            if (!cache_.lookup(region, page, start - page * REMOTE_CACHE_PAGE, out + (start - offset), end - start))
+                misses.push_back(Miss{page, std::vector<char>(REMOTE_CACHE_PAGE)});
+        }
+
+        // Lease time counts from before the request left, so the copy
+        // expires here no later than the provider forgets the lease
+        auto requested = RemoteCache::Clock::now();
+        std::vector<std::future<uint16_t>> replies;
+        for (Miss &miss : misses)
+            replies.push_back(read_lease(region, miss.page * REMOTE_CACHE_PAGE, miss.data.data(), REMOTE_CACHE_PAGE,
+                                         miss.got, miss.lease_ms));
+
+        uint16_t status = WIRE_OK;
+        for (size_t i = 0; i < misses.size(); i++)
+        {
+            Miss &miss = misses[i];
+            uint16_t result = replies[i].get();
+            uint64_t base = miss.page * REMOTE_CACHE_PAGE;
+            uint64_t start = std::max(offset, base);
+            uint64_t end = std::min(offset + length, base + REMOTE_CACHE_PAGE);
+            if (result == WIRE_OK && end - base > miss.got)
+                result = WIRE_OUT_OF_RANGE;
+            if (result == WIRE_OK)
+            {
+                cache_.fill(region, miss.page, miss.data.data(), miss.got,
+                            requested + std::chrono::milliseconds(miss.lease_ms), epoch);
+                memcpy(out + (start - offset), miss.data.data() + (start - base), end - start);
+            }
+            if (status == WIRE_OK)
+                status = result;
+        }
+        return status;
+    }
+
+    const RemoteCache &cache() const { return cache_; }
+
+    // LZ-compress written pages (the default), or only send zero pages as flags
+    void compress(bool on) { compress_ = on; }
+
+    // Block until nothing is in flight
+    void drain()
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        window_.wait(lock, [this] { return outstanding_ == 0; });
+    }
+
+private:
+    struct Pending
+    {
+        Done done;
+        Allocated allocated;
+        char *out = nullptr;
+        uint64_t offset = 0; // Reads, to line packed pieces up with pages
+        uint32_t length = 0;
+        RemoteIo *ios = nullptr; // Batches only
+        size_t count = 0;
+        uint32_t *got = nullptr; // Leased reads only
+        uint32_t *lease_ms = nullptr;
+    };
+
+    // OP_READ_LEASE of up to `length` bytes; `got` and `lease_ms` are set
+    // before the future is ready
+    std::future<uint16_t> read_lease(uint32_t region, uint64_t offset, char *out, uint32_t length, uint32_t &got,
+                                     uint32_t &lease_ms)
+    {
+        auto promise = std::make_shared<std::promise<uint16_t>>();
+        Pending pending;
+        pending.done = [promise](uint16_t status) { promise->set_value(status); };
+        pending.out = out;
+        pending.offset = offset;
+        pending.length = length;
+        pending.got = &got;
+        pending.lease_ms = &lease_ms;
+        issue(OP_READ_LEASE, std::move(pending), [&](WireWriter &frame) { frame.u32(region).u64(offset).u32(length); });
+        return promise->get_future();
+    }
+
+    // Register `pending` under a fresh request id, waiting for room in the
+    // window. Returns 0, with `pending` already failed, once disconnected.
+    uint32_t enqueue(Pending pending)
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        window_.wait(lock, [this] { return outstanding_ < REMOTE_MAX_INFLIGHT || !connected_; });
+        if (!connected_)
+        {
+            lock.unlock();
+            complete(pending, REMOTE_CONNECTION_LOST, 0);
+            return 0;
+        }
+        uint32_t request_id = next_request_id_++;
+        if (request_id == 0)
+            request_id = next_request_id_++;
+        pending_.emplace(request_id, std::move(pending));
+        outstanding_++;
+        return request_id;
+    }
+
+    template <typename Fields>
+    void issue(uint16_t opcode, Pending pending, Fields fields, const char *payload = nullptr, size_t length = 0)
+    {
+        uint32_t request_id = enqueue(std::move(pending));
+        if (request_id == 0)
+            return;
+
+        WireWriter frame(opcode, request_id);
+        fields(frame);
+        // Registered before sending, so the reply always finds it. A failed
+        // send shows up to the receiver as a closed connection.
+        std::lock_guard<std::mutex> lock(send_lock_);
+        wire_sendv(fd_, frame.finish(length), payload, length);
+    }
+
+    void batch(uint16_t opcode, RemoteIo *ios, size_t count, Done done)
+    {
+        uint64_t payload = 0;
+        for (size_t i = 0; i < count; i++)
+            payload += ios[i].length;
+        if (count > WIRE_BATCH_MAX || wire_batch_body(count, payload) > WIRE_MAX_BODY)
+        {
+            done(WIRE_BAD_REQUEST);
+            return;
+        }
+        if (opcode == OP_WRITE_BATCH)
+        {
+            for (size_t i = 0; i < count; i++)
+                cache_.invalidate(ios[i].region, ios[i].offset, ios[i].length);
+        }
+
+        Pending pending;
+        pending.done = std::move(done);
+        pending.ios = ios;
+        pending.count = count;
+        uint32_t request_id = enqueue(std::move(pending));
+        if (request_id == 0)
+            return;
+
+        WireWriter frame(opcode, request_id);
+        frame.u32(count);
+        for (size_t i = 0; i < count; i++)
+            frame.u32(ios[i].region).u64(ios[i].offset).u32(ios[i].length);
+
+        // Descriptors, then every write payload straight from its buffer
+        std::vector<struct iovec> parts;
+        parts.reserve(opcode == OP_WRITE_BATCH ? count + 1 : 1);
+        parts.push_back({});
+        if (opcode == OP_WRITE_BATCH)
+        {
+            for (size_t i = 0; i < count; i++)
+                parts.push_back({ios[i].data, ios[i].length});
+        }
+        const std::string &head = frame.finish(opcode == OP_WRITE_BATCH ? payload : 0);
+        parts[0] = {const_cast<char *>(head.data()), head.size()};
+        std::lock_guard<std::mutex> lock(send_lock_);
+        wire_send_iov(fd_, parts.data(), parts.size());
+    }
+
+    // Status table of a batch reply, then for reads the payloads of the OK
+    // entries scattered straight into their buffers
+    bool receive_batch(const WireHeader &reply, Pending &pending, std::string &body)
+    {
+        size_t table = 4 + 2 * pending.count;
+        if (reply.length < table)
+            return false;
+        body.resize(table);
+        if (!wire_read_full(fd_, &body[0], table))
+            return false;
+        WireReader reader(body.data(), body.size());
+        if (reader.u32() != pending.count)
+            return false;
+
+        std::vector<struct iovec> parts;
+        uint64_t payload = 0;
+        for (size_t i = 0; i < pending.count; i++)
+        {
+            RemoteIo &io = pending.ios[i];
+            io.status = reader.u16();
+            if (reply.opcode == OP_READ_BATCH && io.status == WIRE_OK && io.length)
+            {
+                parts.push_back({io.data, io.length});
+                payload += io.length;
+            }
+        }
+        return reply.length == table + payload && wire_read_iov(fd_, parts.data(), parts.size());
+    }
+
+    // A packed payload of `size` bytes into the `length` bytes at
+    // pending.out. False if the stream is out of step; pieces that do not
+    // decode set `status` to WIRE_BAD_REQUEST.
+    bool receive_packed(Pending &pending, uint32_t length, size_t size, std::string &body, uint16_t &status)
+    {
+        char format;
+        if (size < 1 || !wire_read_full(fd_, &format, 1))
+            return false;
+        size--;
+        if (format == PAYLOAD_RAW)
+            return size == length && wire_read_full(fd_, pending.out, length);
+        if (format != PAYLOAD_PIECES)
+            return false;
+        body.resize(size);
+        if (!wire_read_full(fd_, &body[0], size))
+            return false;
+        bool valid = unpack_pieces(body.data(), size, pending.offset, length,
+                                   [&](uint64_t pos, size_t piece, uint8_t kind, const char *bytes, size_t n) {
+                                       return unpack_piece(kind, bytes, n, pending.out + (pos - pending.offset),
+                                                           piece);
+                                   });
+        if (!valid)
+            status = WIRE_BAD_REQUEST;
+        return true;
+    }
+
+    template <typename Issue>
+    uint16_t transfer(size_t length, Issue issue_chunk)
+    {
+        std::vector<std::future<uint16_t>> chunks;
+        for (size_t done = 0; done < length;)
+        {
+            uint32_t chunk = std::min<size_t>(length - done, WIRE_MAX_PAYLOAD);
+            chunks.push_back(issue_chunk(done, chunk));
+            done += chunk;
+        }
+        uint16_t status = WIRE_OK;
+        for (auto &chunk : chunks)
+        {
+            uint16_t result = chunk.get();
+            if (status == WIRE_OK)
+                status = result;
+        }
+        return status;
+    }
+
+    static void complete(Pending &pending, uint16_t status, uint32_t region)
+    {
+        if (pending.allocated)
+            pending.allocated(status, region);
+        else if (pending.done)
+            pending.done(status);
+    }
+
+    void receive()
+    {
+        char head[WIRE_HEADER_SIZE];
+        std::string body;
+        while (wire_read_full(fd_, head, WIRE_HEADER_SIZE))
+        {
+            WireHeader reply;
+            wire_decode_header(head, reply);
+            if (reply.opcode == OP_INVALIDATE)
+            {
+                // Unsolicited: another gainer wrote where we hold leases. Its
+                // write is acknowledged once we confirm the copies are gone.
+                char fields[20];
+                if (reply.length != sizeof(fields) || !wire_read_full(fd_, fields, sizeof(fields)))
+                    break;
+                WireReader reader(fields, sizeof(fields));
+                uint32_t region = reader.u32();
+                uint64_t offset = reader.u64();
+                cache_.invalidate(region, offset, reader.u64());
+                if (reply.request_id != 0)
+                {
+                    std::lock_guard<std::mutex> lock(send_lock_);
+                    wire_send(fd_, WireWriter(OP_INVALIDATE, reply.request_id).finish());
+                }
+                continue;
+            }
+            Pending pending;
+            {
+                std::lock_guard<std::mutex> lock(lock_);
+                auto it = pending_.find(reply.request_id);
+                if (it == pending_.end())
+                    break; // Not ours: the stream is out of step
+                pending = std::move(it->second);
+                pending_.erase(it);
+            }
+
+            uint32_t region = 0;
+            uint16_t status = reply.status;
+            if (pending.ios && reply.status == WIRE_OK)
+            {
+                if (!receive_batch(reply, pending, body))
+                {
+                    complete(pending, REMOTE_CONNECTION_LOST, 0);
+                    finished(1);
+                    break;
+                }
+            }
+            else if (reply.opcode == OP_READ_LEASE && reply.status == WIRE_OK)
+            {
+                // Lease and length, then up to the requested length into
+                // the caller's buffer
+                char fields[8];
+                uint32_t got = 0;
+                if (reply.length < sizeof(fields) || !wire_read_full(fd_, fields, sizeof(fields)) ||
+                    (got = WireReader(fields + 4, 4).u32()) > pending.length ||
+                    !receive_packed(pending, got, reply.length - sizeof(fields), body, status))
+                {
+                    complete(pending, REMOTE_CONNECTION_LOST, 0);
+                    finished(1);
+                    break;
+                }
+                *pending.lease_ms = WireReader(fields, 4).u32();
+                *pending.got = got;
+            }
+            else if (reply.opcode == OP_READ_PACKED && reply.status == WIRE_OK)
+            {
+                if (!receive_packed(pending, pending.length, reply.length, body, status))
+                {
+                    complete(pending, REMOTE_CONNECTION_LOST, 0);
+                    finished(1);
+                    break;
+                }
+            }
+            else if (reply.opcode == OP_READ && reply.status == WIRE_OK)
+            {
+                // Payload straight into the caller's buffer
+                if (reply.length != pending.length || !wire_read_full(fd_, pending.out, pending.length))
+                {
+                    complete(pending, REMOTE_CONNECTION_LOST, 0);
+                    finished(1);
+                    break;
+                }
+            }
+            else
+            {
+                body.resize(reply.length);
+                if (reply.length > WIRE_MAX_BODY || !wire_read_full(fd_, &body[0], reply.length))
+                {
+                    complete(pending, REMOTE_CONNECTION_LOST, 0);
+                    finished(1);
+                    break;
+                }
+                WireReader reader(body.data(), body.size());
+                if (reply.opcode == OP_ALLOC && reply.status == WIRE_OK)
+                    region = reader.u32();
+            }
+
+            complete(pending, status, region);
+            finished(1);
+        }
+
+        // Fail whatever is left so no caller waits forever
+        std::unordered_map<uint32_t, Pending> orphans;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            connected_ = false;
+            orphans.swap(pending_);
+        }
+        for (auto &entry : orphans)
+            complete(entry.second, REMOTE_CONNECTION_LOST, 0);
+        finished(orphans.size());
+    }
+
+    // Count requests whose callbacks have run, waking drain() and issuers
+    void finished(size_t count)
+    {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            outstanding_ -= count;
+        }
+        window_.notify_all();
+    }
+
+    int fd_ = -1;
+    std::thread receiver_;
+    RemoteCache cache_;
+    bool compress_ = true;
+    std::mutex send_lock_;  // One frame on the wire at a time
+    std::mutex lock_;       // Guards the members below
+    std::condition_variable window_;
+    std::unordered_map<uint32_t, Pending> pending_;
+    size_t outstanding_ = 0; // Issued and not yet completed, callbacks included
+    uint32_t next_request_id_ = 1;
+    bool connected_ = false;
+};
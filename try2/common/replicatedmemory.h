@@ -0,0 +1,345 @@
+#pragma once
+// Provider memory kept on several providers at once, so a gainer's data
+// outlives any one of them.
+//
+// alloc() places a copy of the region on every replica. A write fans out
+// to all copies in parallel. It completes once a majority of the
+// replication factor has acknowledged it. The remaining copies finish in
+// the background from a private copy of the data. Writes are issued under
+// one lock, so every replica applies them in the same order. A replica
+// whose connection drops is out for good. A copy that fails a write the
+// others accepted is dropped, because it is now missing data. Reads go to
+// the live copy with the lowest measured round trip and fall back to the
+// next one if that replica is gone. Small reads go through that copy's
+// page cache; large ones stream past it rather than flushing it.
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <utility>
+#include "remotememory.h"
+
+#define REPLICA_NO_QUORUM 0xfffe // Completion status when fewer than a majority of copies are left or agree
+#define REPLICA_CACHED_READ_MAX (16 * REMOTE_CACHE_PAGE) // Larger reads bypass the page cache
+
+class ReplicatedMemory
+{
+public:
+    using Address = std::pair<std::string, int>;
+
+    ~ReplicatedMemory() { disconnect(); }
+
+    // Connects to every provider in `addresses`, the replication factor.
+    // Returns how many answered; with fewer than quorum() nothing can be written.
+    size_t connect(const std::vector<Address> &addresses)
+    {
+        quorum_ = addresses.size() / 2 + 1;
+        size_t connected = 0;
+        for (const Address &address : addresses)
+        {
+            auto replica = std::make_unique<Replica>();
+            replica->address = address;
+            replica->live = replica->memory.connect(address.first, address.second);
+            if (!replica->live)
+                std::cerr << "[Replica] Cannot reach " << name(*replica) << std::endl;
+            connected += replica->live;
+            replicas_.push_back(std::move(replica));
+        }
+        return connected;
+    }
+
+    // Close every connection; providers free the copies they hold
+    void disconnect()
+    {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            closing_ = true;
+        }
+        for (auto &replica : replicas_)
+            replica->memory.disconnect();
+    }
+
+    size_t replicas() const { return replicas_.size(); }
+    size_t quorum() const { return quorum_; }
+
+    size_t live()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return std::count_if(replicas_.begin(), replicas_.end(), [](const auto &replica) { return replica->live; });
+    }
+
+    // A copy on every live replica; fails unless a quorum could allocate
+    uint16_t alloc(uint64_t size, uint32_t &region)
+    {
+        std::vector<size_t> targets;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            for (size_t i = 0; i < replicas_.size(); i++)
+            {
+                if (replicas_[i]->live)
+                    targets.push_back(i);
+            }
+        }
+
+        std::vector<std::promise<std::pair<uint16_t, uint32_t>>> replies(targets.size());
+        for (size_t t = 0; t < targets.size(); t++)
+        {
+            auto started = std::chrono::steady_clock::now();
+            size_t i = targets[t];
+            replicas_[i]->memory.alloc(size, [this, i, started, &replies, t](uint16_t status, uint32_t id) {
+                sample(i, started, status);
+                replies[t].set_value({status, id});
+            });
+        }
+
+        std::vector<uint32_t> copies(replicas_.size(), 0);
+        size_t placed = 0;
+        uint16_t status = REPLICA_NO_QUORUM;
+        for (size_t t = 0; t < targets.size(); t++)
+        {
+            auto [result, id] = replies[t].get_future().get();
+            if (result == WIRE_OK)
+            {
+                copies[targets[t]] = id;
+                placed++;
+            }
+            else if (status == REPLICA_NO_QUORUM && result != REMOTE_CONNECTION_LOST)
+            {
+                status = result;
+            }
+        }
+        if (placed < quorum_)
+        {
+            for (size_t i = 0; i < copies.size(); i++)
+            {
+                if (copies[i])
+                    replicas_[i]->memory.free(copies[i], [](uint16_t) {});
+            }
+            return status;
+        }
+
+        std::lock_guard<std::mutex> lock(lock_);
+        region = next_region_++;
+        regions_[region] = std::move(copies);
+        return WIRE_OK;
+    }
+
+    uint16_t free(uint32_t region)
+    {
+        std::vector<uint32_t> copies;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            auto it = regions_.find(region);
+            if (it == regions_.end())
+                return WIRE_OUT_OF_RANGE;
+            copies = std::move(it->second);
+            regions_.erase(it);
+        }
+        for (size_t i = 0; i < copies.size(); i++)
+        {
+            if (copies[i])
+                replicas_[i]->memory.free(copies[i], [](uint16_t) {});
+        }
+        return WIRE_OK;
+    }
+
+    // Blocks until a quorum of copies has the data, any size
+    uint16_t write(uint32_t region, uint64_t offset, const char *data, size_t length)
+    {
+        auto write = std::make_shared<Write>();
+        write->data.assign(data, length);
+        write->region = region;
+
+        std::unique_lock<std::mutex> order(issue_lock_);
+        std::vector<std::pair<size_t, uint32_t>> targets = copies(region);
+        if (targets.size() < quorum_)
+            return targets.empty() && !known(region) ? WIRE_OUT_OF_RANGE : REPLICA_NO_QUORUM;
+        write->unfinished = targets.size();
+
+        for (auto [i, id] : targets)
+        {
+            size_t chunks = std::max<size_t>(1, (length + WIRE_MAX_PAYLOAD - 1) / WIRE_MAX_PAYLOAD);
+            auto remaining = std::make_shared<std::pair<size_t, uint16_t>>(chunks, WIRE_OK);
+            auto started = std::chrono::steady_clock::now();
+            for (size_t done = 0, chunk = 0; chunk < chunks; chunk++)
+            {
+                uint32_t size = std::min<size_t>(length - done, WIRE_MAX_PAYLOAD);
+                // Runs on replica i's receiver thread
+                replicas_[i]->memory.write(id, offset + done, write->data.data() + done, size,
+                                           [this, write, remaining, i, started](uint16_t status) {
+                                               std::unique_lock<std::mutex> lock(write->lock);
+                                               if (remaining->second == WIRE_OK)
+                                                   remaining->second = status;
+                                               if (--remaining->first == 0)
+                                                   replica_done(*write, i, remaining->second, started, lock);
+                                           });
+                done += size;
+            }
+        }
+        order.unlock();
+
+        std::unique_lock<std::mutex> lock(write->lock);
+        write->settled.wait(lock, [&] {
+            return write->acked >= quorum_ || write->acked + write->unfinished < quorum_;
+        });
+        if (write->acked >= quorum_)
+            return WIRE_OK;
+        return write->failure != WIRE_OK ? write->failure : REPLICA_NO_QUORUM;
+    }
+
+    // From the nearest live copy; another copy is tried if that replica is gone
+    uint16_t read(uint32_t region, uint64_t offset, char *out, size_t length)
+    {
+        std::vector<size_t> tried;
+        while (true)
+        {
+            size_t best = SIZE_MAX;
+            uint32_t id = 0;
+            {
+                std::lock_guard<std::mutex> lock(lock_);
+                auto it = regions_.find(region);
+                if (it == regions_.end())
+                    return WIRE_OUT_OF_RANGE;
+                for (size_t i = 0; i < replicas_.size(); i++)
+                {
+                    if (!it->second[i] || !replicas_[i]->live ||
+                        std::find(tried.begin(), tried.end(), i) != tried.end())
+                        continue;
+                    if (best == SIZE_MAX || replicas_[i]->rtt_us < replicas_[best]->rtt_us)
+                        best = i;
+                }
+                if (best == SIZE_MAX)
+                    return REPLICA_NO_QUORUM;
+                id = it->second[best];
+            }
+
+            RemoteMemory &memory = replicas_[best]->memory;
+            uint16_t status = length <= REPLICA_CACHED_READ_MAX ? memory.read_cached(id, offset, out, length)
+                                                                 : memory.read_all(id, offset, out, length);
+            if (status != REMOTE_CONNECTION_LOST)
+                return status;
+            lost(best);
+            tried.push_back(best);
+        }
+    }
+
+private:
+    struct Replica
+    {
+        Address address;
+        RemoteMemory memory;
+        bool live = false;
+        double rtt_us = 0; // Moving average over allocations and writes
+    };
+
+    // One fanned-out write, shared with the completions that outlive write()
+    struct Write
+    {
+        std::string data;
+        uint32_t region;
+        std::mutex lock;
+        std::condition_variable settled;
+        size_t acked = 0, unfinished = 0;
+        uint16_t failure = WIRE_OK;
+        std::vector<size_t> failed;
+    };
+
+    static std::string name(const Replica &replica)
+    {
+        return replica.address.first + ":" + std::to_string(replica.address.second);
+    }
+
+    bool known(uint32_t region)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return regions_.count(region);
+    }
+
+    // (replica, region id on it) for every live copy
+    std::vector<std::pair<size_t, uint32_t>> copies(uint32_t region)
+    {
+        std::vector<std::pair<size_t, uint32_t>> targets;
+        std::lock_guard<std::mutex> lock(lock_);
+        auto it = regions_.find(region);
+        if (it == regions_.end())
+            return targets;
+        for (size_t i = 0; i < replicas_.size(); i++)
+        {
+            if (it->second[i] && replicas_[i]->live)
+                targets.push_back({i, it->second[i]});
+        }
+        return targets;
+    }
+
+    // Every chunk of the write has completed on replica i. Once all replicas
+    // are in, copies that failed while another one succeeded are dropped.
+    void replica_done(Write &write, size_t i, uint16_t status, std::chrono::steady_clock::time_point started,
+                      std::unique_lock<std::mutex> &lock)
+    {
+        write.unfinished--;
+        if (status == WIRE_OK)
+        {
+            write.acked++;
+        }
+        else if (status != REMOTE_CONNECTION_LOST)
+        {
+            // A lost replica is already out; one that refused needs its copy dropped
+            write.failed.push_back(i);
+            if (write.failure == WIRE_OK)
+                write.failure = status;
+        }
+        bool last = write.unfinished == 0;
+        bool applied = write.acked > 0;
+        std::vector<size_t> failed = write.failed;
+        lock.unlock();
+        write.settled.notify_all();
+
+        sample(i, started, status);
+        if (status == REMOTE_CONNECTION_LOST)
+            lost(i);
+        if (last && applied)
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            auto it = regions_.find(write.region);
+            for (size_t stale : failed)
+            {
+                if (it != regions_.end() && it->second[stale])
+                {
+                    std::cerr << "[Replica] Dropping stale copy of region " << write.region << " on "
+                              << name(*replicas_[stale]) << std::endl;
+                    it->second[stale] = 0;
+                }
+            }
+        }
+    }
+
+    void lost(size_t i)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (!replicas_[i]->live)
+            return;
+        replicas_[i]->live = false;
+        if (!closing_)
+            std::cerr << "[Replica] Lost " << name(*replicas_[i]) << std::endl;
+    }
+
+    // 1/8 weight per round trip, as the providers do for their own latency
+    void sample(size_t i, std::chrono::steady_clock::time_point started, uint16_t status)
+    {
+        if (status == REMOTE_CONNECTION_LOST)
+            return;
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - started).count();
+        std::lock_guard<std::mutex> lock(lock_);
+        double &rtt = replicas_[i]->rtt_us;
+        rtt = rtt == 0 ? us : (rtt * 7 + us) / 8;
+    }
+
+    std::vector<std::unique_ptr<Replica>> replicas_;
+    size_t quorum_ = 1;
+    std::mutex issue_lock_; // Writes reach every replica in the same order
+    std::mutex lock_;       // Guards regions_ and the replicas' live and rtt_us
+    std::map<uint32_t, std::vector<uint32_t>> regions_; // Region -> its id on each replica, 0 for no copy
+    uint32_t next_region_ = 1;
+    bool closing_ = false;
+};
@@ -0,0 +1,229 @@
+#pragma once
+// Provider memory striped over several providers for bandwidth: a region
+// is cut into STRIPE_SIZE stripes dealt round-robin to the providers, so
+// stripe s lives on provider s % n at (s / n) * STRIPE_SIZE in its part of
+// the region. A large read or write becomes one frame per stripe it
+// touches, all in flight at once on every connection, so the transfer
+// moves at the providers' combined bandwidth rather than one peer's NIC
+// and CPU. There is no redundancy: every provider holds part of every
+// large region, and losing one loses those parts.
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <utility>
+#include "remotememory.h"
+#include "replicatedmemory.h"
+
+#define STRIPE_SIZE (256 << 10) // Bytes per stripe; one frame, and enough to keep a provider streaming
+
+class StripedMemory
+{
+public:
+    using Address = std::pair<std::string, int>;
+
+    ~StripedMemory() { disconnect(); }
+
+    // Connects to every provider in `addresses`, the stripe width. Returns
+    // how many answered; regions need all of them.
+    size_t connect(const std::vector<Address> &addresses)
+    {
+        size_t connected = 0;
+        for (const Address &address : addresses)
+        {
+            auto member = std::make_unique<Member>();
+            member->address = address;
+            member->live = member->memory.connect(address.first, address.second);
+            if (!member->live)
+                std::cerr << "[Stripe] Cannot reach " << name(*member) << std::endl;
+            connected += member->live;
+            members_.push_back(std::move(member));
+        }
+        return connected;
+    }
+
+    void disconnect()
+    {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            closing_ = true;
+        }
+        for (auto &member : members_)
+            member->memory.disconnect();
+    }
+
+    size_t replicas() const { return members_.size(); }
+    size_t quorum() const { return members_.size(); }
+
+    size_t live()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return std::count_if(members_.begin(), members_.end(), [](const auto &member) { return member->live; });
+    }
+
+    // Each provider's share of the stripes; providers that get none are skipped
+    uint16_t alloc(uint64_t size, uint32_t &region)
+    {
+        size_t n = members_.size();
+        if (n == 0 || live() != n)
+            return REPLICA_NO_QUORUM;
+        uint64_t stripes = (size + STRIPE_SIZE - 1) / STRIPE_SIZE;
+        Layout layout;
+        layout.size = size;
+        layout.ids.assign(n, 0);
+
+        std::vector<std::promise<std::pair<uint16_t, uint32_t>>> replies(n);
+        for (size_t p = 0; p < n; p++)
+        {
+            uint64_t share = stripes / n + (p < stripes % n);
+            if (share == 0)
+            {
+                replies[p].set_value({WIRE_OK, 0});
+                continue;
+            }
+            members_[p]->memory.alloc(share * STRIPE_SIZE, [&replies, p](uint16_t status, uint32_t id) {
+                replies[p].set_value({status, id});
+            });
+        }
+        uint16_t status = WIRE_OK;
+        for (size_t p = 0; p < n; p++)
+        {
+            auto [result, id] = replies[p].get_future().get();
+            if (result == WIRE_OK)
+                layout.ids[p] = id;
+            else if (status == WIRE_OK)
+                status = result == REMOTE_CONNECTION_LOST ? REPLICA_NO_QUORUM : result;
+            if (result == REMOTE_CONNECTION_LOST)
+                lost(p);
+        }
+        if (status != WIRE_OK)
+        {
+            release(layout);
+            return status;
+        }
+
+        std::lock_guard<std::mutex> lock(lock_);
+        region = next_region_++;
+        layouts_[region] = std::move(layout);
+        return WIRE_OK;
+    }
+
+    uint16_t free(uint32_t region)
+    {
+        Layout layout;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            auto it = layouts_.find(region);
+            if (it == layouts_.end())
+                return WIRE_OUT_OF_RANGE;
+            layout = std::move(it->second);
+            layouts_.erase(it);
+        }
+        release(layout);
+        return WIRE_OK;
+    }
+
+    uint16_t write(uint32_t region, uint64_t offset, const char *data, size_t length)
+    {
+        return transfer(true, region, offset, const_cast<char *>(data), length);
+    }
+
+    uint16_t read(uint32_t region, uint64_t offset, char *out, size_t length)
+    {
+        return transfer(false, region, offset, out, length);
+    }
+
+private:
+    struct Member
+    {
+        Address address;
+        RemoteMemory memory;
+        bool live = false;
+    };
+
+    struct Layout
+    {
+        uint64_t size = 0;
+        std::vector<uint32_t> ids; // Region id on each provider, 0 for none
+    };
+
+    static std::string name(const Member &member)
+    {
+        return member.address.first + ":" + std::to_string(member.address.second);
+    }
+
+    void lost(size_t p)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (!members_[p]->live)
+            return;
+        members_[p]->live = false;
+        if (!closing_)
+            std::cerr << "[Stripe] Lost " << name(*members_[p]) << std::endl;
+    }
+
+    bool alive(size_t p)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return members_[p]->live;
+    }
+
+    void release(const Layout &layout)
+    {
+        for (size_t p = 0; p < layout.ids.size(); p++)
+        {
+            if (layout.ids[p] && alive(p))
+                members_[p]->memory.free(layout.ids[p], [](uint16_t) {});
+        }
+    }
+
+    // One frame per stripe piece of [offset, offset + length), issued to
+    // every provider before waiting on any
+    uint16_t transfer(bool write, uint32_t region, uint64_t offset, char *buffer, size_t length)
+    {
+        Layout layout;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            auto it = layouts_.find(region);
+            if (it == layouts_.end() || offset > it->second.size || length > it->second.size - offset)
+                return WIRE_OUT_OF_RANGE;
+            layout = it->second;
+        }
+
+        size_t n = members_.size();
+        std::vector<std::pair<size_t, std::future<uint16_t>>> frames;
+        for (size_t done = 0; done < length;)
+        {
+            uint64_t stripe = (offset + done) / STRIPE_SIZE;
+            uint64_t pos = (offset + done) % STRIPE_SIZE;
+            uint32_t piece = std::min<uint64_t>(length - done, STRIPE_SIZE - pos);
+            size_t p = stripe % n;
+            uint64_t at = (stripe / n) * STRIPE_SIZE + pos;
+            RemoteMemory &memory = members_[p]->memory;
+            frames.push_back({p, write ? memory.write(layout.ids[p], at, buffer + done, piece)
+                                       : memory.read(layout.ids[p], at, buffer + done, piece)});
+            done += piece;
+        }
+
+        uint16_t status = WIRE_OK;
+        for (auto &[p, frame] : frames)
+        {
+            uint16_t result = frame.get();
+            if (result == REMOTE_CONNECTION_LOST)
+            {
+                // Stripes on other providers are still there
+                lost(p);
+                result = REPLICA_NO_QUORUM;
+            }
+            if (status == WIRE_OK)
+                status = result;
+        }
+        return status;
+    }
+
+    std::vector<std::unique_ptr<Member>> members_;
+    std::mutex lock_; // Guards layouts_ and the members' live flags
+    std::map<uint32_t, Layout> layouts_;
+    uint32_t next_region_ = 1;
+    bool closing_ = false;
+};
@@ -0,0 +1,110 @@
+#pragma once
+// Hashed timing wheel for peer liveness.
+//
+// Time is cut into ticks; a timer due at tick T lives in slot T % WHEEL_SLOTS.
+// Arming, re-arming and cancelling are O(1), and each tick only visits the
+// timers hashed into one slot. Re-arming is lazy: a heartbeat just moves the
+// timer's deadline, and the timer is re-filed under its new slot when the
+// wheel reaches the old one. Heartbeats therefore never touch the lists.
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#define WHEEL_SLOTS 512
+#define WHEEL_TICK_MS 100 // One lap covers 51.2 s; longer timers just go round again
+
+class TimingWheel
+{
+public:
+    TimingWheel() : slots_(WHEEL_SLOTS), start_(std::chrono::steady_clock::now()) {}
+
+    // Arm `id` to expire `timeout_ms` from now, or push back its deadline
+    void touch(int id, uint32_t timeout_ms)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        uint64_t deadline = now_tick() + (timeout_ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+        auto it = timers_.find(id);
+        if (it != timers_.end())
+        {
+            it->second.deadline = deadline;
+            return;
+        }
+
+        size_t slot = deadline % WHEEL_SLOTS;
+        slots_[slot].push_back(id);
+        timers_[id] = Timer{deadline, slot, std::prev(slots_[slot].end())};
+    }
+
+    void cancel(int id)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        auto it = timers_.find(id);
+        if (it == timers_.end())
+            return;
+        slots_[it->second.slot].erase(it->second.position);
+        timers_.erase(it);
+    }
+
+    // Move the wheel up to the current time, appending expired ids to `expired`
+    void advance(std::vector<int> &expired)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        uint64_t now = now_tick();
+        if (now - current_ > WHEEL_SLOTS)
+            current_ = now - WHEEL_SLOTS; // Fell a lap behind, one pass over every slot will do
+
+        for (; current_ < now; current_++)
+        {
+            size_t slot = (current_ + 1) % WHEEL_SLOTS;
+            std::list<int> &timers = slots_[slot];
+            for (auto it = timers.begin(); it != timers.end();)
+            {
+                auto next = std::next(it);
+                Timer &timer = timers_[*it];
+                if (timer.deadline <= now)
+                {
+                    expired.push_back(*it);
+                    timers_.erase(*it);
+                    timers.erase(it);
+                }
+                else if (timer.deadline % WHEEL_SLOTS != slot)
+                {
+                    // Re-armed since it was filed here
+                    size_t target = timer.deadline % WHEEL_SLOTS;
+                    slots_[target].splice(slots_[target].end(), timers, it);
+                    timer.slot = target;
+                }
+                it = next;
+            }
+        }
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return timers_.size();
+    }
+
+private:
+    struct Timer
+    {
+        uint64_t deadline; // Tick the timer fires on
+        size_t slot;       // Slot whose list holds it
+        std::list<int>::iterator position;
+    };
+
+    uint64_t now_tick() const
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / WHEEL_TICK_MS;
+    }
+
+    std::mutex lock_;
+    std::vector<std::list<int>> slots_;
+    std::unordered_map<int, Timer> timers_;
+    std::chrono::steady_clock::time_point start_;
+    uint64_t current_ = 0; // Last tick processed
+};
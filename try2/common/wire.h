@@ -0,0 +1,432 @@
+#pragma once
+// Framed binary protocol spoken between peers and the registry.
+//
+// Every message is a fixed header followed by `length` body bytes:
+//
+//   uint16 opcode | uint16 status | uint32 request_id | uint32 length
+//
+// all in network byte order. A response repeats the opcode and request_id
+// of the request it answers, so a client may send several requests before
+// reading the replies. Bodies are fixed layouts of big-endian integers,
+// listed next to each opcode below as request -> response.
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define WIRE_HEADER_SIZE 12
+#define WIRE_MAX_BODY (1 << 20) // Larger frames are a protocol error
+#define WIRE_MAX_PAYLOAD (WIRE_MAX_BODY - 16) // Data bytes per OP_READ/OP_WRITE frame
+#define WIRE_BATCH_MAX 4096 // Entries per OP_READ_BATCH/OP_WRITE_BATCH
+#define WIRE_BATCH_ENTRY 16 // Bytes per batch descriptor
+// A batch must also fit one frame: wire_batch_body() of its entry count
+// and payload bytes is at most WIRE_MAX_BODY. That is the OP_WRITE_BATCH
+// request, and bounds the OP_READ_BATCH reply, whose table is smaller.
+#define WIRE_HEARTBEAT_INTERVAL_MS 2000 // How often registered clients send OP_HEARTBEAT
+#define WIRE_PEERLIST_PAGE 1024 // Ids per OP_PEERLIST page, and the longest delta sent instead of a page
+#define WIRE_LEASE_MS 2000 // How long an OP_READ_LEASE copy may be used without hearing from the provider
+#ifndef FRAME_ERROR
+#define FRAME_ERROR SIZE_MAX // Framer verdict: the stream is corrupt, drop the connection
+#endif
+
+enum WireOpcode : uint16_t
+{
+    OP_REGISTER = 1,          // int32 id, -1 for a new one       -> int32 id
+    OP_REGISTER_PROVIDER = 2, // uint16 port, uint64 capacity     -> empty
+    OP_PEERLIST = 3,          // int32 id, uint64 known version, int32 after
+                              //   -> uint8 kind, uint64 version, then for
+                              //      PEERLIST_DELTA: uint32 n, n x int32 added, uint32 m, m x int32 removed
+                              //      PEERLIST_PAGE:  uint32 total, uint32 remaining, uint32 n, n x int32 id
+                              //   (phase1.3: int32 id, uint64 bytes wanted, 0 for any, uint8 replicas,
+                              //    1 if absent -> replicas x (uint32 ipv4, uint16 port) of distinct
+                              //    providers, fewer when not enough are registered)
+    OP_CONNECT = 4,           // int32 target id                  -> uint32 ipv4, uint16 port
+    OP_DISCONNECT = 5,        // int32 id                         -> empty
+    OP_HEARTBEAT = 6,         // int32 id                         -> no response
+    OP_PROVIDER_LOAD = 7,     // int32 id, uint64 free bytes, uint32 active gainers,
+                              // uint32 recent latency us         -> no response, counts as a heartbeat
+
+    // Data plane between a gainer and a provider, on the provider's port.
+    // Payloads follow the fixed fields and are sent and received with
+    // writev/readv straight from and into region memory. Transfers above
+    // WIRE_MAX_PAYLOAD are split into several requests.
+    OP_ALLOC = 16,            // uint64 size                      -> uint32 region
+    OP_FREE = 17,             // uint32 region, allocated on this connection -> empty
+    OP_READ = 18,             // uint32 region, uint64 offset, uint32 length -> length bytes
+    OP_WRITE = 19,            // uint32 region, uint64 offset, payload       -> empty
+    OP_READ_BATCH = 20,       // uint32 n, n x (uint32 region, uint64 offset, uint32 length)
+                              //   -> uint32 n, n x uint16 status, payloads of the OK entries in order
+    OP_WRITE_BATCH = 21,      // uint32 n, n x (uint32 region, uint64 offset, uint32 length), payloads
+                              //   -> uint32 n, n x uint16 status
+    OP_READ_LEASE = 22,       // uint32 region, uint64 offset, uint32 length
+                              //   -> uint32 lease ms, uint32 n (less than length at the region's end),
+                              //      n bytes as a packed payload
+    OP_INVALIDATE = 23,       // Provider to gainer: uint32 region, uint64 offset, uint64 length; copies
+                              // leased from that range are stale -> unless the request id is 0, the
+                              // gainer echoes an empty OP_INVALIDATE with it once they are dropped,
+                              // and the provider holds the write's reply until then or the lease ends
+    OP_WRITE_PACKED = 24,     // uint32 region, uint64 offset, uint32 length, pieces (pagecodec.h) -> empty
+    OP_READ_PACKED = 25,      // uint32 region, uint64 offset, uint32 length -> length bytes as a packed payload
+};
+
+// Packed payload format byte: the bytes as they are, or pagecodec.h pieces
+enum WirePayloadFormat : uint8_t
+{
+    PAYLOAD_RAW = 0,
+    PAYLOAD_PIECES = 1,
+};
+
+// OP_PEERLIST reply kinds. A known version with `after` 0 gets a delta when
+// the registry still has the changes; anything else gets the sorted ids
+// above `after` from the newest snapshot. Paging by last id rather than by
+// offset means ids never get skipped when the list changes between pages.
+enum PeerListKind : uint8_t
+{
+    PEERLIST_DELTA = 1,
+    PEERLIST_PAGE = 2,
+};
+
+enum WireStatus : uint16_t
+{
+    WIRE_OK = 0,
+    WIRE_INVALID_ID = 1,   // Id unknown, or registered from another address
+    WIRE_NOT_FOUND = 2,    // Connect target is not registered
+    WIRE_UNREGISTERED = 3, // Request needs a registered client
+    WIRE_NO_PROVIDERS = 4,
+    WIRE_BAD_REQUEST = 5, // Unknown opcode or short body
+    WIRE_NO_MEMORY = 6,   // Provider cannot fit the allocation
+    WIRE_OUT_OF_RANGE = 7, // Unknown region, or access past its end
+};
+
+struct WireHeader
+{
+    uint16_t opcode;
+    uint16_t status;
+    uint32_t request_id;
+    uint32_t length;
+};
+
+inline const char *wire_status_text(uint16_t status)
+{
+    switch (status)
+    {
+    case WIRE_OK:
+        return "OK";
+    case WIRE_INVALID_ID:
+        return "Invalid ID!";
+    case WIRE_NOT_FOUND:
+        return "Client ID not found.";
+    case WIRE_UNREGISTERED:
+        return "Seems like you are unregistered";
+    case WIRE_NO_PROVIDERS:
+        return "No providers available";
+    case WIRE_NO_MEMORY:
+        return "Provider is out of memory";
+    case WIRE_OUT_OF_RANGE:
+        return "Region or range out of bounds";
+    default:
+        return "Bad request";
+    }
+}
+
+// Body bytes of a batch request of `count` entries carrying `payload` bytes
+inline uint64_t wire_batch_body(uint64_t count, uint64_t payload)
+{
+    return 4 + count * WIRE_BATCH_ENTRY + payload;
+}
+
+inline void wire_decode_header(const char *data, WireHeader &header)
+{
+    uint16_t u16;
+    uint32_t u32;
+    memcpy(&u16, data, 2);
+    header.opcode = ntohs(u16);
+    memcpy(&u16, data + 2, 2);
+    header.status = ntohs(u16);
+    memcpy(&u32, data + 4, 4);
+    header.request_id = ntohl(u32);
+    memcpy(&u32, data + 8, 4);
+    header.length = ntohl(u32);
+}
+
+// Builds one frame; the header's length is filled in by finish()
+class WireWriter
+{
+public:
+    WireWriter(uint16_t opcode, uint32_t request_id, uint16_t status = WIRE_OK)
+    {
+        frame_.reserve(64);
+        u16(opcode).u16(status).u32(request_id).u32(0);
+    }
+
+    WireWriter &u8(uint8_t value)
+    {
+        frame_.push_back(static_cast<char>(value));
+        return *this;
+    }
+
+    WireWriter &u16(uint16_t value)
+    {
+        value = htons(value);
+        frame_.append(reinterpret_cast<const char *>(&value), 2);
+        return *this;
+    }
+
+    WireWriter &u32(uint32_t value)
+    {
+        value = htonl(value);
+        frame_.append(reinterpret_cast<const char *>(&value), 4);
+        return *this;
+    }
+
+    WireWriter &u64(uint64_t value) { return u32(value >> 32).u32(static_cast<uint32_t>(value)); }
+
+    WireWriter &i32(int32_t value) { return u32(static_cast<uint32_t>(value)); }
+
+    // Bytes already in wire order, e.g. a pre-serialised id array
+    WireWriter &raw(const char *data, size_t length)
+    {
+        frame_.append(data, length);
+        return *this;
+    }
+
+    // IPv4 address given as dotted text, plus port
+    WireWriter &address(const std::string &ip, uint16_t port)
+    {
+        struct in_addr addr;
+        if (inet_pton(AF_INET, ip.c_str(), &addr) != 1)
+            addr.s_addr = 0;
+        frame_.append(reinterpret_cast<const char *>(&addr.s_addr), 4);
+        return u16(port);
+    }
+
+    // `trailing` counts payload bytes sent separately after the frame
+    const std::string &finish(size_t trailing = 0)
+    {
+        uint32_t length = htonl(frame_.size() - WIRE_HEADER_SIZE + trailing);
+        memcpy(&frame_[8], &length, 4);
+        return frame_;
+    }
+
+private:
+    std::string frame_;
+};
+
+// Bounds-checked reads from a body; ok() turns false once a read runs past the end
+class WireReader
+{
+public:
+    WireReader(const char *data, size_t length) : data_(data), length_(length) {}
+
+    uint8_t u8()
+    {
+        uint8_t value = 0;
+        take(&value, 1);
+        return value;
+    }
+
+    uint16_t u16()
+    {
+        uint16_t value = 0;
+        take(&value, 2);
+        return ntohs(value);
+    }
+
+    uint32_t u32()
+    {
+        uint32_t value = 0;
+        take(&value, 4);
+        return ntohl(value);
+    }
+
+    uint64_t u64()
+    {
+        uint64_t high = u32();
+        return high << 32 | u32();
+    }
+
+    int32_t i32() { return static_cast<int32_t>(u32()); }
+
+    std::string address(uint16_t &port)
+    {
+        struct in_addr addr;
+        addr.s_addr = 0;
+        take(&addr.s_addr, 4);
+        port = u16();
+        char text[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr, text, sizeof(text));
+        return text;
+    }
+
+    bool ok() const { return ok_; }
+
+private:
+    void take(void *out, size_t n)
+    {
+        if (pos_ + n > length_)
+        {
+            ok_ = false;
+            return;
+        }
+        memcpy(out, data_ + pos_, n);
+        pos_ += n;
+    }
+
+    const char *data_;
+    size_t length_;
+    size_t pos_ = 0;
+    bool ok_ = true;
+};
+
+// Reactor framer: one whole frame, header included, per command
+inline size_t frame_wire(const char *data, size_t length, std::string &command)
+{
+    if (length < WIRE_HEADER_SIZE)
+        return 0;
+    WireHeader header;
+    wire_decode_header(data, header);
+    if (header.length > WIRE_MAX_BODY)
+        return FRAME_ERROR;
+    size_t total = WIRE_HEADER_SIZE + header.length;
+    if (length < total)
+        return 0;
+    command.assign(data, total);
+    return total;
+}
+
+inline bool wire_send(int fd, const std::string &frame)
+{
+    for (size_t sent = 0; sent < frame.size();)
+    {
+        ssize_t n = send(fd, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+// Gather write of `count` parts, resuming after partial sends. Consumes
+// `parts`. sendmsg rather than writev only for MSG_NOSIGNAL.
+inline bool wire_send_iov(int fd, struct iovec *parts, size_t count)
+{
+    while (count > 0)
+    {
+        struct msghdr message = {};
+        message.msg_iov = parts;
+        message.msg_iovlen = std::min<size_t>(count, IOV_MAX);
+        ssize_t n = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        // Skip whatever the kernel took, resuming mid-part if needed
+        while (count > 0 && size_t(n) >= parts->iov_len)
+        {
+            n -= parts->iov_len;
+            parts++;
+            count--;
+        }
+        if (count > 0)
+        {
+            parts->iov_base = static_cast<char *>(parts->iov_base) + n;
+            parts->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+// Scatter read filling `count` parts exactly. Consumes `parts`.
+inline bool wire_read_iov(int fd, struct iovec *parts, size_t count)
+{
+    while (count > 0)
+    {
+        ssize_t n = readv(fd, parts, std::min<size_t>(count, IOV_MAX));
+        if (n <= 0)
+            return false;
+        while (count > 0 && size_t(n) >= parts->iov_len)
+        {
+            n -= parts->iov_len;
+            parts++;
+            count--;
+        }
+        if (count > 0)
+        {
+            parts->iov_base = static_cast<char *>(parts->iov_base) + n;
+            parts->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+// Send `frame` and then `length` payload bytes as one gather write, so the
+// payload is never copied into the frame
+inline bool wire_sendv(int fd, const std::string &frame, const char *payload, size_t length)
+{
+    struct iovec parts[2] = {{const_cast<char *>(frame.data()), frame.size()},
+                             {const_cast<char *>(payload), length}};
+    return wire_send_iov(fd, parts, length ? 2 : 1);
+}
+
+// Send `frame` and then `length` bytes of `file` from `offset` without
+// bringing them through user space. MSG_MORE lets the header share a
+// segment with the start of the payload.
+inline bool wire_sendfile(int fd, const std::string &frame, int file, uint64_t offset, size_t length)
+{
+    for (size_t sent = 0; sent < frame.size();)
+    {
+        ssize_t n = send(fd, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL | MSG_MORE);
+        if (n <= 0)
+            return false;
+        sent += n;
+    }
+    off_t position = offset;
+    while (length > 0)
+    {
+        ssize_t n = sendfile(fd, file, &position, length);
+        if (n <= 0)
+            return false;
+        length -= n;
+    }
+    return true;
+}
+
+// Blocking read of exactly `length` bytes, however the stream segments them
+inline bool wire_read_full(int fd, void *out, size_t length)
+{
+    char *data = static_cast<char *>(out);
+    for (size_t got = 0; got < length;)
+    {
+        ssize_t n = recv(fd, data + got, length - got, 0);
+        if (n <= 0)
+            return false;
+        got += n;
+    }
+    return true;
+}
+
+// Blocking read of the next frame from `fd`. `pending` carries bytes that
+// arrived past the end of the previous frame, so coalesced replies are kept.
+inline bool wire_receive(int fd, std::string &pending, WireHeader &header, std::string &body)
+{
+    std::string frame;
+    size_t used;
+    while ((used = frame_wire(pending.data(), pending.size(), frame)) == 0)
+    {
+        char buffer[4096];
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+            return false;
+        pending.append(buffer, n);
+    }
+    if (used == FRAME_ERROR)
+        return false;
+    pending.erase(0, used);
+    wire_decode_header(frame.data(), header);
+    body = frame.substr(WIRE_HEADER_SIZE);
+    return true;
+}
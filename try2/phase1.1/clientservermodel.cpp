@@ -1,4 +1,5 @@
 #include <iostream>
+#include <algorithm>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -9,205 +10,374 @@
 #include <thread>
 #include <vector>
 #include <csignal>
+#include <sstream>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "shmpool.h"
+#include "shmclient.h"
 
-#define SHARED_MEMORY_NAME "p2p_shared_memory"
-#define SHARED_MEMORY_SIZE 4096 // Total memory size
-#define PARTITION_SIZE 512      // Each client gets 512 bytes
-#define MAX_CLIENTS (SHARED_MEMORY_SIZE / PARTITION_SIZE)
+#define METRICS_PORT 9400
 
-struct SharedMemoryMetadata
-{
-    int clients_connected;
-    int used_size;
-    int remaining_size;
-    int client_ids[MAX_CLIENTS]; // Array to track connected clients
-};
-
-std::mutex mem_lock;
 void *shared_memory_ptr;
 SharedMemoryMetadata *metadata;
+SharedPoolClient pool_client; // Mapped once, reused by every writer/reader call
+int shm_fd = -1;
+bool on_memfd = false;        // Segment is an unnamed memfd rather than a /dev/shm object
+uint64_t reserved_size = 0;   // Address space kept at shared_memory_ptr for growth
+std::mutex mapping_lock;      // Serialises growth against metrics scrapes
 
 void cleanup(int signum)
 {
     std::cout << "\n[Server] Interrupt received. Cleaning up shared memory..." << std::endl;
-    munmap(shared_memory_ptr, SHARED_MEMORY_SIZE);
-    shm_unlink(SHARED_MEMORY_NAME);
+    munmap(shared_memory_ptr, reserved_size);
+    if (!on_memfd)
+        shm_unlink(SHARED_MEMORY_NAME);
     exit(0);
 }
 
-void monitor_memory()
+// Parse sizes like 4096, 64K, 512M or 4G
+uint64_t parse_size(const std::string &text)
+{
+    size_t pos = 0;
+    uint64_t value = std::stoull(text, &pos);
+    switch (pos < text.size() ? toupper(text[pos]) : 0)
+    {
+    case 'G':
+        return value << 30;
+    case 'M':
+        return value << 20;
+    case 'K':
+        return value << 10;
+    default:
+        return value;
+    }
+}
+
+static const char *const op_names[POOL_OPS] = {"write", "read", "deregister"};
+static const char *const failure_names[POOL_FAILURES] = {"no_slot", "no_memory", "not_found"};
+
+void metric(std::ostringstream &out, const char *name, const char *type, const char *help)
+{
+    out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+}
+
+// Render the pool counters in Prometheus text format. Everything is read
+// with relaxed loads; a scrape never takes the metadata lock.
+std::string render_metrics()
+{
+    std::lock_guard<std::mutex> mapping(mapping_lock);
+    PoolStats &stats = metadata->stats;
+    std::ostringstream out;
+    out.precision(12);
+
+    metric(out, "pool_size_bytes", "gauge", "Mapped pool size");
+    out << "pool_size_bytes " << metadata->pool_size << '\n';
+    metric(out, "pool_max_size_bytes", "gauge", "Size the pool may grow to");
+    out << "pool_max_size_bytes " << metadata->max_size << '\n';
+    metric(out, "pool_used_bytes", "gauge", "Bytes held by allocations");
+    out << "pool_used_bytes " << metadata->used_size << '\n';
+    metric(out, "pool_remaining_bytes", "gauge", "Bytes free in the arena");
+    out << "pool_remaining_bytes " << metadata->remaining_size << '\n';
+    metric(out, "pool_generation", "gauge", "Times the pool was grown");
+    out << "pool_generation " << metadata->generation << '\n';
+    metric(out, "pool_clients_connected", "gauge", "Registered clients");
+    out << "pool_clients_connected " << metadata->clients_connected << '\n';
+
+    metric(out, "pool_ops_total", "counter", "Operations by type");
+    for (int op = 0; op < POOL_OPS; op++)
+        out << "pool_ops_total{op=\"" << op_names[op] << "\"} " << stats.ops[op] << '\n';
+    metric(out, "pool_failures_total", "counter", "Failed operations by reason");
+    for (int reason = 0; reason < POOL_FAILURES; reason++)
+        out << "pool_failures_total{reason=\"" << failure_names[reason] << "\"} " << stats.failures[reason] << '\n';
+    metric(out, "pool_allocated_bytes_total", "counter", "Bytes handed out by the allocator");
+    out << "pool_allocated_bytes_total " << stats.bytes_allocated << '\n';
+    metric(out, "pool_freed_bytes_total", "counter", "Bytes returned to the allocator");
+    out << "pool_freed_bytes_total " << stats.bytes_freed << '\n';
+    metric(out, "pool_written_bytes_total", "counter", "Message bytes written");
+    out << "pool_written_bytes_total " << stats.bytes_written << '\n';
+    metric(out, "pool_read_bytes_total", "counter", "Message bytes read");
+    out << "pool_read_bytes_total " << stats.bytes_read << '\n';
+    metric(out, "pool_read_retries_total", "counter", "Reads retried because a writer got in between");
+    out << "pool_read_retries_total " << stats.read_retries << '\n';
+
+    metric(out, "pool_lock_acquisitions_total", "counter", "Metadata lock acquisitions");
+    out << "pool_lock_acquisitions_total " << metadata->lock.acquisitions << '\n';
+    metric(out, "pool_lock_contended_total", "counter", "Metadata lock acquisitions that had to wait");
+    out << "pool_lock_contended_total " << metadata->lock.contended << '\n';
+    metric(out, "pool_lock_wait_seconds_total", "counter", "Time spent waiting for the metadata lock");
+    out << "pool_lock_wait_seconds_total " << metadata->lock.wait_ns / 1e9 << '\n';
+
+    metric(out, "pool_op_latency_seconds", "histogram", "Sampled operation latency");
+    for (int op = 0; op < POOL_OPS; op++)
+    {
+        LatencyHistogram &histogram = stats.latency[op];
+        uint64_t cumulative = 0;
+        for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+        {
+            cumulative += histogram.buckets[bucket];
+            out << "pool_op_latency_seconds_bucket{op=\"" << op_names[op] << "\",le=\""
+                << (uint64_t(64) << bucket) / 1e9 << "\"} " << cumulative << '\n';
+        }
+        out << "pool_op_latency_seconds_bucket{op=\"" << op_names[op] << "\",le=\"+Inf\"} " << histogram.count << '\n';
+        out << "pool_op_latency_seconds_sum{op=\"" << op_names[op] << "\"} " << histogram.sum_ns / 1e9 << '\n';
+        out << "pool_op_latency_seconds_count{op=\"" << op_names[op] << "\"} " << histogram.count << '\n';
+    }
+
+    // Per-client series, walking only the occupied slots
+    std::ostringstream allocated, writes, reads, failures;
+    ClientEntry *clients = pool_clients(shared_memory_ptr, metadata);
+    ClientStats *client_stats = pool_client_stats(shared_memory_ptr, metadata);
+    std::atomic<uint64_t> *bitmap = pool_slot_bitmap(shared_memory_ptr, metadata);
+    for (uint32_t word = 0; word < metadata->max_clients / 64; word++)
+    {
+        for (uint64_t bits = bitmap[word]; bits != 0; bits &= bits - 1)
+        {
+            uint32_t slot = word * 64 + __builtin_ctzll(bits);
+            int client_id = clients[slot].client_id;
+            if (client_id == -1)
+                continue;
+            ClientStats &client = client_stats[slot];
+            allocated << "pool_client_allocated_bytes{client=\"" << client_id << "\"} " << client.bytes_allocated << '\n';
+            writes << "pool_client_writes_total{client=\"" << client_id << "\"} " << client.writes << '\n';
+            reads << "pool_client_reads_total{client=\"" << client_id << "\"} " << client.reads << '\n';
+            failures << "pool_client_failures_total{client=\"" << client_id << "\"} " << client.failures << '\n';
+        }
+    }
+    metric(out, "pool_client_allocated_bytes", "gauge", "Size of the block a client holds");
+    out << allocated.str();
+    metric(out, "pool_client_writes_total", "counter", "Writes by client");
+    out << writes.str();
+    metric(out, "pool_client_reads_total", "counter", "Reads by client");
+    out << reads.str();
+    metric(out, "pool_client_failures_total", "counter", "Failed writes by client");
+    out << failures.str();
+    return out.str();
+}
+
+// Minimal HTTP endpoint for scrapers: GET /metrics, one request per connection
+void serve_metrics(int port)
 {
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+    if (bind(server_fd, (sockaddr *)&address, sizeof(address)) < 0 || listen(server_fd, 16) < 0)
+    {
+        std::cerr << "[Server] Metrics endpoint could not bind port " << port << std::endl;
+        close(server_fd);
+        return;
+    }
+    std::cout << "[Server] Metrics on http://0.0.0.0:" << port << "/metrics" << std::endl;
+
     while (true)
     {
-        sleep(2);
-        std::lock_guard<std::mutex> lock(mem_lock);
-        std::cout << "[Server] Monitoring Shared Memory:\n";
-        std::cout << "Total Size: " << SHARED_MEMORY_SIZE << " bytes\n";
-        std::cout << "Used Size: " << metadata->used_size << " bytes\n";
-        std::cout << "Remaining Size: " << metadata->remaining_size << " bytes\n";
-        std::cout << "Clients Connected: " << metadata->clients_connected << "\n";
-        std::cout << "Client IDs: ";
-        for (int i = 0; i < metadata->clients_connected; i++)
+        int client_fd = accept(server_fd, nullptr, nullptr);
+        if (client_fd < 0)
+            continue;
+
+        char request[1024];
+        ssize_t n = recv(client_fd, request, sizeof(request) - 1, 0);
+        std::string line = n > 0 ? std::string(request, n) : "";
+        std::string body, status = "200 OK";
+        if (line.rfind("GET /metrics", 0) == 0)
+            body = render_metrics();
+        else
+            status = "404 Not Found";
+
+        std::string response = "HTTP/1.1 " + status +
+                               "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) +
+                               "\r\nConnection: close\r\n\r\n" + body;
+        for (size_t sent = 0; sent < response.size();)
         {
-            std::cout << metadata->client_ids[i] << " ";
+            ssize_t w = send(client_fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (w <= 0)
+                break;
+            sent += w;
         }
-        std::cout << "\n";
+        close(client_fd);
     }
 }
 
-void server()
+// Map a memfd on huge pages. The huge page pool is only charged at mmap
+// time, so failure shows up there rather than at memfd_create.
+bool map_hugepage_segment(uint64_t size, uint64_t max_size)
 {
-    signal(SIGINT, cleanup);
-    int shm_fd = shm_open(SHARED_MEMORY_NAME, O_CREAT | O_RDWR, 0666);
+    shm_fd = memfd_create(SHARED_MEMORY_NAME, MFD_CLOEXEC | MFD_HUGETLB);
+    if (shm_fd == -1)
+        return false;
+
+    if (ftruncate(shm_fd, size) == 0)
+    {
+        shared_memory_ptr = pool_map_reserved(shm_fd, size, max_size, true, MAP_POPULATE);
+        if (shared_memory_ptr != MAP_FAILED)
+            return true;
+    }
+    close(shm_fd);
+    shm_fd = -1;
+    return false;
+}
+
+bool map_shm_segment(uint64_t size, uint64_t max_size)
+{
+    shm_fd = shm_open(SHARED_MEMORY_NAME, O_CREAT | O_RDWR, 0666);
     if (shm_fd == -1)
     {
         std::cerr << "[Server] Error creating shared memory" << std::endl;
-        return;
+        return false;
     }
 
-    if (ftruncate(shm_fd, SHARED_MEMORY_SIZE) == -1)
+    if (ftruncate(shm_fd, size) == -1)
     {
         std::cerr << "[Server] Error setting shared memory size" << std::endl;
-        return;
+        return false;
     }
 
-    shared_memory_ptr = mmap(0, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    shared_memory_ptr = pool_map_reserved(shm_fd, size, max_size, false);
     if (shared_memory_ptr == MAP_FAILED)
     {
         std::cerr << "[Server] Error mapping shared memory" << std::endl;
-        return;
+        return false;
     }
-
-    metadata = static_cast<SharedMemoryMetadata *>(shared_memory_ptr);
-    metadata->clients_connected = 0;
-    metadata->used_size = 0;
-    metadata->remaining_size = SHARED_MEMORY_SIZE - sizeof(SharedMemoryMetadata);
-    memset(metadata->client_ids, -1, sizeof(metadata->client_ids));
-
-    std::cout << "[Server] Initialized and monitoring shared memory..." << std::endl;
-
-    std::thread monitor_thread(monitor_memory);
-    monitor_thread.detach();
-
-    std::cout << "Press Enter to clean up...";
-    std::cin.get();
-
-    munmap(shared_memory_ptr, SHARED_MEMORY_SIZE);
-    shm_unlink(SHARED_MEMORY_NAME);
-    std::cout << "[Server] Shared memory cleaned up." << std::endl;
+    return true;
 }
 
-void writer(int client_id, const std::string &message)
+// Extend the segment while clients stay attached; they remap lazily once
+// they see the generation bump done by pool_grow(). The new tail is mapped
+// into the range reserved at startup, so the pool never moves. mremap would
+// be simpler but fails with EINVAL on hugetlb mappings.
+void grow_pool(uint64_t new_size)
 {
-    std::lock_guard<std::mutex> lock(mem_lock);
-    if (client_id < 0 || client_id >= MAX_CLIENTS)
+    if (on_memfd)
+        new_size = (new_size + POOL_HUGE_PAGE_SIZE - 1) & ~uint64_t(POOL_HUGE_PAGE_SIZE - 1);
+
+    std::lock_guard<std::mutex> mapping(mapping_lock);
+    uint64_t old_size = metadata->pool_size;
+    if (new_size <= old_size || new_size > metadata->max_size)
     {
-        std::cerr << "[Writer] Invalid client ID" << std::endl;
+        std::cerr << "[Server] Pool can grow from " << old_size << " up to " << metadata->max_size << " bytes" << std::endl;
         return;
     }
 
-    int shm_fd = shm_open(SHARED_MEMORY_NAME, O_RDWR, 0666);
-    if (shm_fd == -1)
+    if (ftruncate(shm_fd, new_size) == -1)
     {
-        std::cerr << "[Writer] Error opening shared memory" << std::endl;
+        std::cerr << "[Server] Error extending shared memory" << std::endl;
         return;
     }
-
-    shared_memory_ptr = mmap(0, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (shared_memory_ptr == MAP_FAILED)
+    if (!pool_map_tail(shared_memory_ptr, shm_fd, old_size, new_size))
     {
-        std::cerr << "[Writer] Error mapping shared memory" << std::endl;
+        // pool_size still says old_size; give the extra space back
+        std::cerr << "[Server] Error mapping the grown part of shared memory" << std::endl;
+        if (ftruncate(shm_fd, old_size) == -1)
+            std::cerr << "[Server] Error shrinking shared memory back to " << old_size << " bytes" << std::endl;
         return;
     }
 
-    metadata = static_cast<SharedMemoryMetadata *>(shared_memory_ptr);
+    ShmLockGuard lock(metadata->lock);
+    pool_grow(shared_memory_ptr, metadata, new_size);
+    std::cout << "[Server] Pool grown to " << new_size << " bytes (generation " << metadata->generation << ")" << std::endl;
+}
+
+void server(uint64_t size, uint64_t max_size, uint32_t max_clients, bool hugepages)
+{
+    signal(SIGINT, cleanup);
 
-    bool already_present = false;
-    for (int i = 0; i < metadata->clients_connected; i++)
+    uint32_t flags = 0;
+    reserved_size = std::max(size, max_size);
+    if (hugepages)
     {
-        if (metadata->client_ids[i] == client_id)
-        {
-            already_present = true;
-            break;
-        }
+        size = (size + POOL_HUGE_PAGE_SIZE - 1) & ~uint64_t(POOL_HUGE_PAGE_SIZE - 1);
+        reserved_size = (std::max(size, reserved_size) + POOL_HUGE_PAGE_SIZE - 1) & ~uint64_t(POOL_HUGE_PAGE_SIZE - 1);
+        on_memfd = map_hugepage_segment(size, reserved_size);
+        if (on_memfd)
+            flags |= POOL_HUGEPAGES;
+        else
+            std::cerr << "[Server] Huge pages unavailable (see /proc/sys/vm/nr_hugepages), using regular pages" << std::endl;
     }
+    if (!on_memfd && !map_shm_segment(size, reserved_size))
+        return;
 
-    if (!already_present)
+    metadata = static_cast<SharedMemoryMetadata *>(shared_memory_ptr);
+    if (!pool_init(shared_memory_ptr, size, max_size, max_clients, flags))
     {
-        metadata->client_ids[metadata->clients_connected] = client_id;
-        metadata->clients_connected++;
+        std::cerr << "[Server] " << size << " bytes cannot hold the pool's metadata" << std::endl;
+        munmap(shared_memory_ptr, reserved_size);
+        if (!on_memfd)
+            shm_unlink(SHARED_MEMORY_NAME);
+        close(shm_fd);
+        return;
+    }
 
-        char *partition_ptr = static_cast<char *>(shared_memory_ptr) + sizeof(SharedMemoryMetadata) + (client_id * PARTITION_SIZE);
-        strncpy(partition_ptr, message.c_str(), PARTITION_SIZE - 1);
+    // A memfd has no name clients can shm_open, hand them the descriptor instead
+    if (on_memfd)
+        std::thread(pool_serve_fd, SHARED_MEMORY_NAME, shm_fd).detach();
 
-        metadata->used_size += PARTITION_SIZE;
-        metadata->remaining_size = SHARED_MEMORY_SIZE - metadata->used_size - sizeof(SharedMemoryMetadata);
-    }
+    std::cout << "[Server] Initialized " << size << " byte pool" << (on_memfd ? " on huge pages" : "")
+              << ", growable to " << metadata->max_size << " bytes, " << metadata->max_clients
+              << " client slots" << std::endl;
 
-    std::cout << "[Writer] Client " << client_id << " wrote: " << message << std::endl;
+    std::thread(serve_metrics, METRICS_PORT).detach();
 
-    munmap(shared_memory_ptr, SHARED_MEMORY_SIZE);
+    std::cout << "Type 'grow <size>' to extend the pool, or press Enter to clean up..." << std::endl;
+    std::string line;
+    while (std::getline(std::cin, line) && line.rfind("grow ", 0) == 0)
+    {
+        grow_pool(parse_size(line.substr(5)));
+    }
+
+    std::lock_guard<std::mutex> mapping(mapping_lock);
+    munmap(shared_memory_ptr, reserved_size);
+    if (!on_memfd)
+        shm_unlink(SHARED_MEMORY_NAME);
     close(shm_fd);
+    std::cout << "[Server] Shared memory cleaned up." << std::endl;
 }
-void reader(int client_id)
+
+void writer(int client_id, const std::string &message)
 {
-    std::lock_guard<std::mutex> lock(mem_lock);
-    if (client_id < 0 || client_id >= MAX_CLIENTS)
+    if (client_id < 0)
     {
-        std::cerr << "[Reader] Invalid client ID" << std::endl;
+        std::cerr << "[Writer] Invalid client ID" << std::endl;
         return;
     }
 
-    int shm_fd = shm_open(SHARED_MEMORY_NAME, O_RDONLY, 0666);
-    if (shm_fd == -1)
+    if (!pool_client.write(client_id, message))
     {
-        std::cerr << "[Reader] Error opening shared memory" << std::endl;
+        std::cerr << "[Writer] Client " << client_id << " could not write " << message.size() << " bytes" << std::endl;
         return;
     }
 
-    shared_memory_ptr = mmap(0, SHARED_MEMORY_SIZE, PROT_READ, MAP_SHARED, shm_fd, 0);
-    if (shared_memory_ptr == MAP_FAILED)
+    std::cout << "[Writer] Client " << client_id << " wrote: " << message << std::endl;
+}
+
+void reader(int client_id)
+{
+    if (client_id < 0)
     {
-        std::cerr << "[Reader] Error mapping shared memory" << std::endl;
+        std::cerr << "[Reader] Invalid client ID" << std::endl;
         return;
     }
 
-    metadata = static_cast<SharedMemoryMetadata *>(shared_memory_ptr);
-    char *partition_ptr = static_cast<char *>(shared_memory_ptr) + sizeof(SharedMemoryMetadata) + (client_id * PARTITION_SIZE);
-    std::cout << "[Reader] Client " << client_id << " read: " << partition_ptr << std::endl;
+    std::string message;
+    if (!pool_client.read(client_id, message))
+    {
+        std::cerr << "[Reader] Client " << client_id << " has no data" << std::endl;
+        return;
+    }
 
-    munmap(shared_memory_ptr, SHARED_MEMORY_SIZE);
-    close(shm_fd);
+    std::cout << "[Reader] Client " << client_id << " read: " << message << std::endl;
 }
 
 void deregister_client(int client_id)
 {
-    std::lock_guard<std::mutex> lock(mem_lock);
-
-    bool found = false;
-    for (int i = 0; i < metadata->clients_connected; i++)
+    if (pool_client.deregister(client_id))
     {
-        if (metadata->client_ids[i] == client_id)
-        {
-            found = true;
-            // Shift remaining clients in the array
-            for (int j = i; j < metadata->clients_connected - 1; j++)
-            {
-                metadata->client_ids[j] = metadata->client_ids[j + 1];
-            }
-            metadata->client_ids[metadata->clients_connected - 1] = -1;
-            metadata->clients_connected--;
-
-            // Free up partition space
-            metadata->used_size -= PARTITION_SIZE;
-            metadata->remaining_size += PARTITION_SIZE;
-
-            std::cout << "[Server] Client " << client_id << " deregistered and memory freed.\n";
-            break;
-        }
+        std::cout << "[Server] Client " << client_id << " deregistered and memory freed.\n";
     }
-
-    if (!found)
+    else
     {
         std::cerr << "[Server] Client " << client_id << " not found.\n";
     }
@@ -217,14 +387,29 @@ int main(int argc, char *argv[])
 {
     if (argc < 2)
     {
-        std::cerr << "Usage: " << argv[0] << " <server|writer|reader> [client_id] [message]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <server|writer|reader> [client_id] [message]\n"
+                  << "       " << argv[0] << " server [size] [max_size] [max_clients] [hugepages]" << std::endl;
         return 1;
     }
 
     std::string mode = argv[1];
     if (mode == "server")
     {
-        server();
+        // "hugepages" may follow any of the optional sizes
+        bool hugepages = std::string(argv[argc - 1]) == "hugepages";
+        int sizes = hugepages ? argc - 1 : argc;
+        uint64_t size = (sizes > 2) ? parse_size(argv[2]) : SHARED_MEMORY_SIZE;
+        uint64_t max_size = (sizes > 3) ? parse_size(argv[3]) : size * POOL_GROWTH_FACTOR;
+        uint32_t max_clients = (sizes > 4) ? parse_size(argv[4]) : DEFAULT_MAX_CLIENTS;
+        // The page map covers max_size, so a large max_size needs a larger start
+        uint64_t metadata_size = pool_metadata_size(std::max(size, max_size), max_clients);
+        if (metadata_size >= size)
+        {
+            std::cerr << "[Server] A pool growable to " << max_size << " bytes with " << max_clients
+                      << " client slots needs more than " << metadata_size << " bytes to start with" << std::endl;
+            return 1;
+        }
+        server(size, max_size, max_clients, hugepages);
     }
     else if (mode == "writer" && argc == 4)
     {
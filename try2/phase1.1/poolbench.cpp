@@ -0,0 +1,178 @@
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "shmpool.h"
+#include "shmclient.h"
+
+// Per-op latency of the shared memory pool: the old map-per-call path that
+// writer()/reader() used to take versus the attach-once SharedPoolClient.
+// Then reader throughput with 1..max_readers reader processes running next
+// to a writer process that keeps rewriting the same slot.
+//
+//   g++ -O2 -o poolbench poolbench.cpp -pthread -lrt
+//   ./poolbench [ops] [message_size] [max_readers]
+
+#define BENCH_MEMORY_NAME "p2p_shared_memory_bench"
+
+// One write the way writer() did it before SharedPoolClient
+bool remap_write(int client_id, const std::string &message)
+{
+    int shm_fd = shm_open(BENCH_MEMORY_NAME, O_RDWR, 0666);
+    if (shm_fd == -1)
+        return false;
+
+    void *ptr = mmap(0, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (ptr == MAP_FAILED)
+    {
+        close(shm_fd);
+        return false;
+    }
+
+    auto *metadata = static_cast<SharedMemoryMetadata *>(ptr);
+    ClientEntry &entry = pool_clients(ptr, metadata)[pool_attach_client(ptr, metadata, client_id)];
+    if (entry.offset == POOL_NULL)
+        entry.offset = pool_alloc(ptr, metadata, message.size());
+    memcpy(pool_at(ptr, entry.offset), message.data(), message.size());
+    entry.length = message.size();
+
+    munmap(ptr, SHARED_MEMORY_SIZE);
+    close(shm_fd);
+    return true;
+}
+
+// One read the way reader() did it before SharedPoolClient
+bool remap_read(int client_id, char *buffer)
+{
+    int shm_fd = shm_open(BENCH_MEMORY_NAME, O_RDONLY, 0666);
+    if (shm_fd == -1)
+        return false;
+
+    void *ptr = mmap(0, SHARED_MEMORY_SIZE, PROT_READ, MAP_SHARED, shm_fd, 0);
+    if (ptr == MAP_FAILED)
+    {
+        close(shm_fd);
+        return false;
+    }
+
+    auto *metadata = static_cast<SharedMemoryMetadata *>(ptr);
+    ClientEntry &entry = pool_clients(ptr, metadata)[pool_lookup_client(ptr, metadata, client_id)];
+    memcpy(buffer, pool_at(ptr, entry.offset), entry.length);
+
+    munmap(ptr, SHARED_MEMORY_SIZE);
+    close(shm_fd);
+    return true;
+}
+
+// Aggregate reads per second from `readers` processes over `seconds`
+double reader_throughput(int readers, const std::string &message, double seconds)
+{
+    pid_t writer_pid = fork();
+    if (writer_pid == 0)
+    {
+        SharedPoolClient client(BENCH_MEMORY_NAME);
+        while (true)
+            client.write(3, message);
+    }
+
+    int pipe_fds[2];
+    if (pipe(pipe_fds) == -1)
+        return 0;
+    for (int r = 0; r < readers; r++)
+    {
+        if (fork() == 0)
+        {
+            SharedPoolClient client(BENCH_MEMORY_NAME);
+            std::string out;
+            uint64_t reads = 0;
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+            while (std::chrono::steady_clock::now() < deadline)
+            {
+                for (int i = 0; i < 256; i++)
+                    reads += client.read(3, out);
+            }
+            if (::write(pipe_fds[1], &reads, sizeof(reads)) != sizeof(reads))
+                _exit(1);
+            _exit(0);
+        }
+    }
+
+    uint64_t total = 0;
+    for (int r = 0; r < readers; r++)
+    {
+        uint64_t reads = 0;
+        if (::read(pipe_fds[0], &reads, sizeof(reads)) == sizeof(reads))
+            total += reads;
+        wait(nullptr);
+    }
+    kill(writer_pid, SIGKILL);
+    waitpid(writer_pid, nullptr, 0);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return total / seconds;
+}
+
+template <typename Op>
+double time_ns_per_op(int ops, Op op)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ops; i++)
+        op(i);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / ops;
+}
+
+int main(int argc, char *argv[])
+{
+    int ops = (argc > 1) ? std::stoi(argv[1]) : 100000;
+    size_t message_size = (argc > 2) ? std::stoul(argv[2]) : 64;
+    int max_readers = (argc > 3) ? std::stoi(argv[3]) : 4;
+
+    int shm_fd = shm_open(BENCH_MEMORY_NAME, O_CREAT | O_RDWR, 0666);
+    if (shm_fd == -1 || ftruncate(shm_fd, SHARED_MEMORY_SIZE) == -1)
+    {
+        std::cerr << "[Bench] Error creating shared memory" << std::endl;
+        return 1;
+    }
+    void *ptr = mmap(0, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (ptr == MAP_FAILED)
+    {
+        std::cerr << "[Bench] Error mapping shared memory" << std::endl;
+        return 1;
+    }
+    pool_init(ptr, SHARED_MEMORY_SIZE, SHARED_MEMORY_SIZE);
+
+    std::string message(message_size, 'x');
+    char buffer[SHARED_MEMORY_SIZE];
+
+    double remap_w = time_ns_per_op(ops, [&](int) { remap_write(1, message); });
+    double remap_r = time_ns_per_op(ops, [&](int) { remap_read(1, buffer); });
+
+    SharedPoolClient client(BENCH_MEMORY_NAME);
+    if (!client.attach())
+        return 1;
+    double attached_w = time_ns_per_op(ops, [&](int) { client.write(2, message); });
+    double attached_r = time_ns_per_op(ops, [&](int) { client.read(2, buffer, sizeof(buffer)); });
+
+    std::cout << "[Bench] " << ops << " ops, " << message_size << " byte messages\n";
+    std::cout << "  write  remap per call: " << remap_w << " ns/op   attached: " << attached_w << " ns/op   ("
+              << remap_w / attached_w << "x)\n";
+    std::cout << "  read   remap per call: " << remap_r << " ns/op   attached: " << attached_r << " ns/op   ("
+              << remap_r / attached_r << "x)\n";
+
+    for (int readers = 1; readers <= max_readers; readers *= 2)
+    {
+        std::cout << "  " << readers << " reader process(es) beside a writer: "
+                  << reader_throughput(readers, message, 1.0) << " reads/s\n";
+    }
+
+    client.detach();
+    munmap(ptr, SHARED_MEMORY_SIZE);
+    close(shm_fd);
+    shm_unlink(BENCH_MEMORY_NAME);
+    return 0;
+}
@@ -4,9 +4,13 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <cstring>
+#include <chrono>
+#include "shmring.h"
 // Program for both reader and writer
 #define SHARED_MEMORY_NAME "p2p_shared_memory"
 #define SHARED_MEMORY_SIZE 1024
+#define CHANNEL_SLOTS 4096     // Ring capacity in messages
+#define CHANNEL_SLOT_SIZE 1024 // Largest streamed message
 
 void writer()
 {
@@ -73,11 +77,66 @@ void reader()
     close(shm_fd);
 }
 
+// Stream messages to a reader through a ring channel. A zero length
+// message marks the end of this producer's stream.
+void producer(const std::string &channel_name, long count, size_t message_size)
+{
+    ShmChannel channel;
+    if (!channel.open(channel_name))
+        return;
+
+    std::string message(message_size, 'x');
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < count; i++)
+    {
+        memcpy(&message[0], &i, std::min(sizeof(i), message.size()));
+        channel.send(message);
+    }
+    channel.send("", 0);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Streamed " << count << " messages in " << seconds << " s ("
+              << count / seconds << " msg/s)" << std::endl;
+}
+
+// Create the channel and drain it until every producer has finished
+void consumer(const std::string &channel_name, RingKind kind, int producers)
+{
+    ShmChannel channel;
+    if (!channel.create(channel_name, kind, CHANNEL_SLOTS, CHANNEL_SLOT_SIZE))
+        return;
+    std::cout << "Waiting for " << producers << " producer(s) on channel " << channel_name << "..." << std::endl;
+
+    char buffer[CHANNEL_SLOT_SIZE];
+    long received = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (producers > 0)
+    {
+        int64_t length = channel.receive(buffer, sizeof(buffer));
+        if (length == 0)
+        {
+            producers--;
+            continue;
+        }
+        if (received == 0)
+            start = std::chrono::steady_clock::now();
+        received++;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Received " << received << " messages in " << seconds << " s ("
+              << received / seconds << " msg/s)" << std::endl;
+    channel.close_channel();
+    ShmChannel::unlink(channel_name);
+}
+
 int main(int argc, char *argv[])
 {
     if (argc < 2)
     {
-        std::cerr << "Usage: " << argv[0] << " <writer|reader>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <writer|reader>\n"
+                  << "       " << argv[0] << " consumer <channel> [spsc|mpmc] [producers]\n"
+                  << "       " << argv[0] << " producer <channel> <count> [message_size]" << std::endl;
         return 1;
     }
 
@@ -90,9 +149,20 @@ int main(int argc, char *argv[])
     {
         reader();
     }
+    else if (mode == "consumer" && argc >= 3)
+    {
+        RingKind kind = (argc > 3 && std::string(argv[3]) == "mpmc") ? RING_MPMC : RING_SPSC;
+        int producers = (argc > 4) ? std::stoi(argv[4]) : 1;
+        consumer(argv[2], kind, producers);
+    }
+    else if (mode == "producer" && argc >= 4)
+    {
+        size_t message_size = (argc > 4) ? std::stoul(argv[4]) : 64;
+        producer(argv[2], std::stol(argv[3]), std::min<size_t>(message_size, CHANNEL_SLOT_SIZE));
+    }
     else
     {
-        std::cerr << "Invalid mode. Use 'writer' or 'reader'." << std::endl;
+        std::cerr << "Invalid mode. Use 'writer', 'reader', 'consumer' or 'producer'." << std::endl;
         return 1;
     }
 
@@ -0,0 +1,443 @@
+#pragma once
+// Attach-once client handle for the local shared memory pool.
+//
+// The segment is opened and mapped a single time in attach() and stays
+// mapped until detach(), so write() and read() are plain memory accesses
+// with no syscalls on the way. Synchronisation is in the segment itself
+// (see shmsync.h), so handles in different processes exclude each other.
+//
+// When the server grows the segment the mapping is extended lazily, on the
+// first operation that sees the new generation. Server and clients reserve
+// address space for max_size up front and map the new tail of the segment
+// into it, so the base never moves; mremap cannot extend hugetlb mappings.
+// A handle may remap, so threads that share a pool should each attach
+// their own handle.
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <cstddef>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "shmpool.h"
+
+// A pool backed by a memfd has no name in /dev/shm. The server hands the
+// descriptor out over an abstract unix socket named after the pool instead.
+inline socklen_t pool_fd_address(const std::string &name, sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::string path = name.substr(0, sizeof(addr.sun_path) - 2);
+    memcpy(addr.sun_path + 1, path.data(), path.size()); // Leading NUL: abstract namespace
+    return offsetof(sockaddr_un, sun_path) + 1 + path.size();
+}
+
+// Serve `fd` to every client that connects, runs until the socket fails
+inline void pool_serve_fd(const std::string &name, int fd)
+{
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    socklen_t addr_len = pool_fd_address(name, addr);
+    if (listen_fd == -1 || bind(listen_fd, (struct sockaddr *)&addr, addr_len) == -1 || listen(listen_fd, 64) == -1)
+    {
+        std::cerr << "[Server] Error publishing the pool descriptor" << std::endl;
+        return;
+    }
+
+    while (true)
+    {
+        int client = accept(listen_fd, nullptr, nullptr);
+        if (client == -1)
+            continue;
+
+        char byte = 0;
+        iovec iov = {&byte, 1};
+        char control[CMSG_SPACE(sizeof(int))] = {0};
+        msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        sendmsg(client, &msg, 0);
+        close(client);
+    }
+}
+
+// Reserve `max_size` bytes of address space, huge page aligned when
+// `hugepages`, and map the first `size` bytes of `fd` at its start.
+// Returns MAP_FAILED if either step fails.
+inline void *pool_map_reserved(int fd, uint64_t size, uint64_t max_size, bool hugepages, int flags = 0)
+{
+    uint64_t align = hugepages ? POOL_HUGE_PAGE_SIZE : 1;
+    uint64_t slack = align - 1;
+    void *reserved = mmap(0, max_size + slack, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED)
+        return MAP_FAILED;
+
+    char *start = static_cast<char *>(reserved);
+    char *base = reinterpret_cast<char *>(pool_align(reinterpret_cast<uintptr_t>(start), align));
+    if (base > start)
+        munmap(start, base - start);
+    if (start + max_size + slack > base + max_size)
+        munmap(base + max_size, start + max_size + slack - (base + max_size));
+
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED | flags, fd, 0) == MAP_FAILED)
+    {
+        munmap(base, max_size);
+        return MAP_FAILED;
+    }
+    return base;
+}
+
+// Map bytes [old_size, new_size) of `fd` into the reserved range at `base`
+inline bool pool_map_tail(void *base, int fd, uint64_t old_size, uint64_t new_size)
+{
+    void *tail = pool_at(base, old_size);
+    return mmap(tail, new_size - old_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, old_size) != MAP_FAILED;
+}
+
+// Fetch the pool descriptor from the server, -1 if nobody is serving it
+inline int pool_receive_fd(const std::string &name)
+{
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    socklen_t addr_len = pool_fd_address(name, addr);
+    if (sock == -1 || connect(sock, (struct sockaddr *)&addr, addr_len) == -1)
+    {
+        if (sock != -1)
+            close(sock);
+        return -1;
+    }
+
+    char byte;
+    iovec iov = {&byte, 1};
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int fd = -1;
+    if (recvmsg(sock, &msg, 0) > 0)
+    {
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg != nullptr && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    close(sock);
+    return fd;
+}
+
+class SharedPoolClient
+{
+public:
+    explicit SharedPoolClient(const std::string &name = SHARED_MEMORY_NAME) : name_(name) {}
+    ~SharedPoolClient() { detach(); }
+
+    SharedPoolClient(const SharedPoolClient &) = delete;
+    SharedPoolClient &operator=(const SharedPoolClient &) = delete;
+
+    bool attach()
+    {
+        if (base_ != nullptr)
+            return true;
+
+        shm_fd_ = shm_open(name_.c_str(), O_RDWR, 0666);
+        if (shm_fd_ == -1)
+            shm_fd_ = pool_receive_fd(name_);
+        if (shm_fd_ == -1)
+        {
+            std::cerr << "[Client] Error opening shared memory" << std::endl;
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(shm_fd_, &st) == -1 || st.st_size < (off_t)sizeof(SharedMemoryMetadata))
+        {
+            std::cerr << "[Client] Shared memory is not initialised" << std::endl;
+            close(shm_fd_);
+            shm_fd_ = -1;
+            return false;
+        }
+
+        // A first look at the metadata tells how much room growth needs
+        size_ = st.st_size;
+        void *ptr = mmap(0, size_, PROT_READ, MAP_SHARED, shm_fd_, 0);
+        if (ptr != MAP_FAILED)
+        {
+            auto *metadata = static_cast<SharedMemoryMetadata *>(ptr);
+            reserved_ = std::max<uint64_t>(metadata->max_size, size_);
+            bool hugepages = metadata->flags & POOL_HUGEPAGES;
+            munmap(ptr, size_);
+            ptr = pool_map_reserved(shm_fd_, size_, reserved_, hugepages);
+        }
+        if (ptr == MAP_FAILED)
+        {
+            std::cerr << "[Client] Error mapping shared memory" << std::endl;
+            close(shm_fd_);
+            shm_fd_ = -1;
+            return false;
+        }
+
+        base_ = ptr;
+        metadata_ = static_cast<SharedMemoryMetadata *>(ptr);
+        pid_ = getpid();
+        return remap();
+    }
+
+    void detach()
+    {
+        if (base_ != nullptr)
+            munmap(base_, reserved_);
+        if (shm_fd_ != -1)
+            close(shm_fd_);
+        base_ = nullptr;
+        metadata_ = nullptr;
+        shm_fd_ = -1;
+        size_ = 0;
+        reserved_ = 0;
+    }
+
+    // Cheap check done before every operation: remap if the server grew the
+    // segment since we last looked.
+    bool refresh()
+    {
+        if (base_ == nullptr)
+            return attach();
+        if (metadata_->generation.load(std::memory_order_acquire) == generation_)
+            return true;
+        return remap();
+    }
+
+    bool attached() const { return base_ != nullptr; }
+    void *base() const { return base_; }
+    SharedMemoryMetadata *metadata() const { return metadata_; }
+
+    // Store `length` bytes for client_id, registering the client on first use.
+    // Only the slot's seqlock is held while copying; the metadata lock is
+    // taken just for registration and when the data needs a bigger block.
+    bool write(int client_id, const void *data, size_t length)
+    {
+        if (client_id < 0 || !refresh())
+            return false;
+
+        OpTimer timer(*this, POOL_OP_WRITE);
+        int slot;
+        for (;;)
+        {
+            slot = pool_attach_client(base_, metadata_, client_id);
+            if (slot == -1)
+            {
+                stats_add(metadata_->stats.failures[POOL_FAIL_NO_SLOT]);
+                return false;
+            }
+            ClientEntry &entry = pool_clients(base_, metadata_)[slot];
+            seqlock_write_lock(entry.seq, entry.writer_pid, pid_);
+            if (entry.client_id.load(std::memory_order_relaxed) == client_id)
+                break;
+            // Deregistered between the lookup and taking the slot, register again
+            seqlock_write_unlock(entry.seq, entry.writer_pid);
+        }
+
+        ClientEntry &entry = pool_clients(base_, metadata_)[slot];
+        ClientStats &client_stats = pool_client_stats(base_, metadata_)[slot];
+
+        // Reuse the current allocation when the data still fits in it
+        uint64_t offset = entry.offset.load(std::memory_order_relaxed);
+        if (offset == POOL_NULL || pool_block_size(base_, metadata_, offset) < length)
+        {
+            // The server grows the pool under this lock, so the arena the
+            // allocator sees is only settled once we hold it
+            ShmLockGuard lock(metadata_->lock);
+            uint64_t fresh = refresh() ? pool_alloc(base_, metadata_, length) : POOL_NULL;
+            if (fresh == POOL_NULL)
+            {
+                seqlock_write_unlock(entry.seq, entry.writer_pid);
+                stats_add(metadata_->stats.failures[POOL_FAIL_NO_MEMORY]);
+                stats_add(client_stats.failures);
+                return false;
+            }
+            pool_free(base_, metadata_, offset);
+            offset = fresh;
+            entry.offset.store(offset, std::memory_order_relaxed);
+            client_stats.bytes_allocated.store(pool_block_size(base_, metadata_, offset), std::memory_order_relaxed);
+        }
+        memcpy(pool_at(base_, offset), data, length);
+        entry.length.store(length, std::memory_order_relaxed);
+        seqlock_write_unlock(entry.seq, entry.writer_pid);
+
+        stats_add(metadata_->stats.bytes_written, length);
+        stats_add(client_stats.writes);
+        return true;
+    }
+
+    bool write(int client_id, const std::string &message)
+    {
+        return write(client_id, message.data(), message.size());
+    }
+
+    // Copy up to `capacity` bytes of client_id's data into `buffer`.
+    // Returns the stored length, or -1 if the client has no data.
+    // Never blocks writers: the copy is retried if a writer got in between.
+    ssize_t read(int client_id, void *buffer, size_t capacity)
+    {
+        return read_slot(client_id, [&](const char *data, uint32_t length) {
+            memcpy(buffer, data, length < capacity ? length : capacity);
+        });
+    }
+
+    bool read(int client_id, std::string &message)
+    {
+        return read_slot(client_id, [&](const char *data, uint32_t length) {
+            message.assign(data, length);
+        }) >= 0;
+    }
+
+    // Drop client_id and free its allocation
+    bool deregister(int client_id)
+    {
+        if (!refresh())
+            return false;
+
+        OpTimer timer(*this, POOL_OP_DEREGISTER);
+        int slot = pool_lookup_client(base_, metadata_, client_id);
+        if (slot == -1)
+        {
+            stats_add(metadata_->stats.failures[POOL_FAIL_NOT_FOUND]);
+            return false;
+        }
+
+        ClientEntry &entry = pool_clients(base_, metadata_)[slot];
+        seqlock_write_lock(entry.seq, entry.writer_pid, pid_);
+        bool found = entry.client_id.load(std::memory_order_relaxed) == client_id;
+        if (found)
+        {
+            uint64_t offset = entry.offset.load(std::memory_order_relaxed);
+            if (offset != POOL_NULL)
+            {
+                ShmLockGuard lock(metadata_->lock);
+                if (refresh())
+                    pool_free(base_, metadata_, offset);
+            }
+            pool_client_stats(base_, metadata_)[slot].bytes_allocated.store(0, std::memory_order_relaxed);
+            pool_detach_client(base_, metadata_, client_id, slot);
+        }
+        seqlock_write_unlock(entry.seq, entry.writer_pid);
+        if (!found)
+            stats_add(metadata_->stats.failures[POOL_FAIL_NOT_FOUND]);
+        return found;
+    }
+
+private:
+    // Counts an operation and, for one op in POOL_LATENCY_SAMPLE, times it
+    class OpTimer
+    {
+    public:
+        OpTimer(SharedPoolClient &client, PoolOp op) : client_(client), op_(op)
+        {
+            if (client_.ops_++ % POOL_LATENCY_SAMPLE == 0)
+                start_ = stats_now_ns();
+        }
+
+        ~OpTimer()
+        {
+            PoolStats &stats = client_.metadata_->stats;
+            stats_add(stats.ops[op_]);
+            if (start_ != 0)
+                latency_record(stats.latency[op_], stats_now_ns() - start_);
+        }
+
+    private:
+        SharedPoolClient &client_;
+        PoolOp op_;
+        uint64_t start_ = 0;
+    };
+
+    // Seqlock read of client_id's data, handing a consistent view to `copy`.
+    // Returns the stored length or -1.
+    template <typename Copy>
+    ssize_t read_slot(int client_id, Copy copy)
+    {
+        if (client_id < 0 || !refresh())
+            return -1;
+
+        OpTimer timer(*this, POOL_OP_READ);
+        int slot = pool_lookup_client(base_, metadata_, client_id);
+        if (slot == -1)
+        {
+            stats_add(metadata_->stats.failures[POOL_FAIL_NOT_FOUND]);
+            return -1;
+        }
+
+        ClientEntry &entry = pool_clients(base_, metadata_)[slot];
+        for (;;)
+        {
+            uint32_t start;
+            if (!seqlock_read_begin(entry.seq, entry.writer_pid, start))
+                return -1;
+            uint64_t offset = entry.offset.load(std::memory_order_relaxed);
+            uint32_t length = entry.length.load(std::memory_order_relaxed);
+            if (entry.client_id.load(std::memory_order_relaxed) != client_id || offset == POOL_NULL)
+            {
+                if (seqlock_read_retry(entry.seq, start))
+                    continue;
+                stats_add(metadata_->stats.failures[POOL_FAIL_NOT_FOUND]);
+                return -1;
+            }
+            if (offset + length > size_)
+            {
+                // Torn offset/length pair, or data in memory we have not mapped yet
+                if (!refresh())
+                    return -1;
+                continue;
+            }
+
+            copy(pool_at(base_, offset), length);
+            if (!seqlock_read_retry(entry.seq, start))
+            {
+                stats_add(metadata_->stats.bytes_read, length);
+                stats_add(pool_client_stats(base_, metadata_)[slot].reads);
+                return length;
+            }
+            stats_add(metadata_->stats.read_retries);
+        }
+    }
+
+    // Grow the local mapping to the size the metadata advertises. The new
+    // part goes into the reserved range, so base_ stays where it is.
+    bool remap()
+    {
+        uint64_t generation = metadata_->generation.load(std::memory_order_acquire);
+        uint64_t size = metadata_->pool_size.load(std::memory_order_acquire);
+        if (size > size_)
+        {
+            if (size > reserved_ || !pool_map_tail(base_, shm_fd_, size_, size))
+            {
+                std::cerr << "[Client] Error remapping shared memory to " << size << " bytes" << std::endl;
+                return false;
+            }
+            size_ = size;
+        }
+        generation_ = generation;
+        return true;
+    }
+
+    std::string name_;
+    int shm_fd_ = -1;
+    size_t size_ = 0;
+    uint64_t reserved_ = 0; // Address space kept for growth, from base_
+    void *base_ = nullptr;
+    SharedMemoryMetadata *metadata_ = nullptr;
+    int pid_ = 0;             // Cached at attach; a forked child should attach its own handle
+    uint64_t generation_ = 0; // Segment generation the mapping matches
+    uint64_t ops_ = 0;        // Operations issued through this handle, drives latency sampling
+};
@@ -0,0 +1,545 @@
+#pragma once
+// Allocator that lives inside the p2p shared memory segment.
+//
+// Segment layout:
+//   [SharedMemoryMetadata][page map, one byte per arena page]
+//   [slot bitmap][full-word summary][client id -> slot index][ClientEntry table]
+//   [ClientStats table][arena]
+//
+// The page map is sized for max_size, so the server can extend the segment
+// online: pool_grow() frees the new pages into the buddy lists and bumps
+// `generation`, and attached clients remap when they notice the bump.
+//
+// Small objects (16 .. 2048 bytes) come from per size class slabs carved out
+// of single arena pages. Anything bigger is served by a buddy allocator whose
+// smallest block is one page. Every free list lives in SharedMemoryMetadata
+// and links through the free memory itself, using offsets from the segment
+// base so that each process can map the segment at a different address.
+// Allocator calls expect the caller to hold metadata->lock.
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include "shmsync.h"
+#include "shmstats.h"
+
+#define SHARED_MEMORY_NAME "p2p_shared_memory"
+#define SHARED_MEMORY_SIZE (1 << 20) // Default total memory size
+#define POOL_PAGE_SIZE 4096          // Smallest buddy block
+#define POOL_MIN_CLASS_SHIFT 4       // Smallest size class is 16 bytes
+#define POOL_SIZE_CLASSES 8          // Size classes 16, 32, ... 2048 bytes
+#define POOL_MAX_ORDER 32            // Buddy blocks of POOL_PAGE_SIZE << order
+#define DEFAULT_MAX_CLIENTS 4096    // Client slots, and the client id range [0, max_clients)
+#define POOL_GROWTH_FACTOR 16        // Default max_size as a multiple of the initial size
+#define POOL_HUGE_PAGE_SIZE (2 << 20)
+#define POOL_HUGEPAGES 0x1           // Segment is a memfd on huge pages
+#define POOL_NULL 0 // Offset 0 is the metadata, never a valid allocation
+
+// Page map tags
+#define PAGE_FREE 0x80 // Head page of a free buddy block, low bits hold the order
+#define PAGE_USED 0x40 // Head page of an allocated buddy block, low bits hold the order
+#define PAGE_SLAB 0x20 // Page carved into objects, low bits hold the size class
+#define PAGE_LOW_BITS 0x1f
+
+// offset and length change only inside the slot's seqlock write section
+struct ClientEntry
+{
+    std::atomic<int> client_id;   // -1 when the entry is unused
+    std::atomic<uint32_t> seq;    // Seqlock sequence, odd while a writer is active
+    std::atomic<int> writer_pid;  // Process inside the write section
+    std::atomic<uint32_t> length; // Bytes of the message stored at offset
+    std::atomic<uint64_t> offset; // Allocation holding the message, POOL_NULL if none
+};
+
+struct SharedMemoryMetadata
+{
+    ShmMutex lock; // Guards the allocator
+    std::atomic<int> clients_connected;
+    std::atomic<uint64_t> used_size;
+    std::atomic<uint64_t> remaining_size;
+
+    std::atomic<uint64_t> pool_size;  // Bytes in the segment
+    std::atomic<uint64_t> generation; // Bumped whenever the segment grows
+    uint64_t max_size;                // Largest size the page map can describe
+    uint32_t flags;                   // POOL_* backing flags
+    uint64_t page_map_offset;         // One tag byte per arena page
+    uint64_t arena_offset;            // Page aligned start of the allocatable memory
+    uint64_t arena_pages;
+
+    // Client slots are handed out lock free: a bit per slot in slot_bitmap,
+    // a bit per completely full bitmap word in slot_summary, and a direct
+    // client id -> slot + 1 index (0 when the id is not attached).
+    uint32_t max_clients;
+    uint64_t slot_bitmap_offset;
+    uint64_t slot_summary_offset;
+    uint64_t client_index_offset;
+    uint64_t clients_offset;
+    uint64_t client_stats_offset; // Kept apart from ClientEntry so counters never touch the seqlock lines
+
+    PoolStats stats;
+
+    uint64_t class_free[POOL_SIZE_CLASSES]; // Free object list per size class
+    uint64_t buddy_free[POOL_MAX_ORDER];    // Free block list per buddy order
+};
+
+// Links stored inside free memory
+struct PoolFreeObject
+{
+    uint64_t next;
+};
+
+struct PoolFreeBlock
+{
+    uint64_t next;
+    uint64_t prev;
+};
+
+inline char *pool_at(void *base, uint64_t offset)
+{
+    return static_cast<char *>(base) + offset;
+}
+
+inline uint8_t *pool_page_map(void *base, SharedMemoryMetadata *metadata)
+{
+    return reinterpret_cast<uint8_t *>(pool_at(base, metadata->page_map_offset));
+}
+
+inline uint64_t pool_page_offset(SharedMemoryMetadata *metadata, uint64_t page)
+{
+    return metadata->arena_offset + page * POOL_PAGE_SIZE;
+}
+
+inline uint64_t pool_page_index(SharedMemoryMetadata *metadata, uint64_t offset)
+{
+    return (offset - metadata->arena_offset) / POOL_PAGE_SIZE;
+}
+
+// Size class serving `size` bytes, or -1 if it needs buddy pages
+inline int pool_size_class(uint64_t size)
+{
+    for (int c = 0; c < POOL_SIZE_CLASSES; c++)
+    {
+        if (size <= (uint64_t(1) << (POOL_MIN_CLASS_SHIFT + c)))
+            return c;
+    }
+    return -1;
+}
+
+inline uint64_t pool_class_size(int size_class)
+{
+    return uint64_t(1) << (POOL_MIN_CLASS_SHIFT + size_class);
+}
+
+// Smallest buddy order whose block holds `size` bytes
+inline int pool_buddy_order(uint64_t size)
+{
+    uint64_t pages = (size + POOL_PAGE_SIZE - 1) / POOL_PAGE_SIZE;
+    int order = 0;
+    while ((uint64_t(1) << order) < pages)
+        order++;
+    return order;
+}
+
+inline void pool_buddy_push(void *base, SharedMemoryMetadata *metadata, uint64_t page, int order)
+{
+    uint64_t offset = pool_page_offset(metadata, page);
+    auto *block = reinterpret_cast<PoolFreeBlock *>(pool_at(base, offset));
+    block->prev = POOL_NULL;
+    block->next = metadata->buddy_free[order];
+    if (block->next != POOL_NULL)
+        reinterpret_cast<PoolFreeBlock *>(pool_at(base, block->next))->prev = offset;
+    metadata->buddy_free[order] = offset;
+    pool_page_map(base, metadata)[page] = PAGE_FREE | order;
+}
+
+inline void pool_buddy_unlink(void *base, SharedMemoryMetadata *metadata, uint64_t page, int order)
+{
+    uint64_t offset = pool_page_offset(metadata, page);
+    auto *block = reinterpret_cast<PoolFreeBlock *>(pool_at(base, offset));
+    if (block->prev != POOL_NULL)
+        reinterpret_cast<PoolFreeBlock *>(pool_at(base, block->prev))->next = block->next;
+    else
+        metadata->buddy_free[order] = block->next;
+    if (block->next != POOL_NULL)
+        reinterpret_cast<PoolFreeBlock *>(pool_at(base, block->next))->prev = block->prev;
+    pool_page_map(base, metadata)[page] = 0;
+}
+
+// Put a block back on the free lists, merging it with its buddy for as long
+// as the buddy is free and of the same order
+inline void pool_buddy_release(void *base, SharedMemoryMetadata *metadata, uint64_t page, int order)
+{
+    uint8_t *page_map = pool_page_map(base, metadata);
+    while (order + 1 < POOL_MAX_ORDER)
+    {
+        uint64_t buddy = page ^ (uint64_t(1) << order);
+        if (buddy + (uint64_t(1) << order) > metadata->arena_pages || page_map[buddy] != (PAGE_FREE | order))
+            break;
+        pool_buddy_unlink(base, metadata, buddy, order);
+        page = page < buddy ? page : buddy;
+        order++;
+    }
+    pool_buddy_push(base, metadata, page, order);
+}
+
+// Hand the arena pages [first, last) to the buddy allocator as the largest
+// naturally aligned blocks that fit. arena_pages must already cover `last`.
+inline void pool_add_pages(void *base, SharedMemoryMetadata *metadata, uint64_t first, uint64_t last)
+{
+    uint64_t page = first;
+    while (page < last)
+    {
+        int order = 0;
+        while (order + 1 < POOL_MAX_ORDER &&
+               page % (uint64_t(1) << (order + 1)) == 0 &&
+               page + (uint64_t(1) << (order + 1)) <= last)
+        {
+            order++;
+        }
+        metadata->remaining_size.fetch_add((uint64_t(POOL_PAGE_SIZE) << order), std::memory_order_relaxed);
+        pool_buddy_release(base, metadata, page, order);
+        page += uint64_t(1) << order;
+    }
+}
+
+inline uint64_t pool_align(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// Place the page map (sized for `max_size`), the client tables and the
+// arena. Returns arena_offset, the bytes of metadata ahead of the arena.
+inline uint64_t pool_layout(SharedMemoryMetadata &metadata, uint64_t max_size, uint32_t max_clients)
+{
+    max_clients = pool_align(max_clients ? max_clients : 1, 64);
+    uint64_t map_bytes = max_size / POOL_PAGE_SIZE;
+    uint64_t bitmap_words = max_clients / 64;
+    uint64_t summary_words = (bitmap_words + 63) / 64;
+
+    metadata.max_size = max_size;
+    metadata.max_clients = max_clients;
+    metadata.page_map_offset = sizeof(SharedMemoryMetadata);
+    metadata.slot_bitmap_offset = pool_align(metadata.page_map_offset + map_bytes, CACHE_LINE_SIZE);
+    metadata.slot_summary_offset = metadata.slot_bitmap_offset + bitmap_words * sizeof(uint64_t);
+    metadata.client_index_offset = metadata.slot_summary_offset + summary_words * sizeof(uint64_t);
+    metadata.clients_offset = pool_align(metadata.client_index_offset + max_clients * sizeof(int32_t), CACHE_LINE_SIZE);
+    metadata.client_stats_offset = pool_align(metadata.clients_offset + max_clients * sizeof(ClientEntry), CACHE_LINE_SIZE);
+    metadata.arena_offset = pool_align(metadata.client_stats_offset + max_clients * sizeof(ClientStats), POOL_PAGE_SIZE);
+    return metadata.arena_offset;
+}
+
+// Bytes of metadata a pool needs ahead of its arena; the initial segment
+// must be larger than this
+inline uint64_t pool_metadata_size(uint64_t max_size, uint32_t max_clients = DEFAULT_MAX_CLIENTS)
+{
+    auto layout = std::make_unique<SharedMemoryMetadata>();
+    return pool_layout(*layout, max_size, max_clients);
+}
+
+// Lay out an empty pool over a freshly mapped segment of `size` bytes. The
+// page map is sized for `max_size` so that the pool can later grow in place.
+// Returns false, leaving the segment untouched, if the metadata alone would
+// not fit in `size`.
+inline bool pool_init(void *base, uint64_t size, uint64_t max_size, uint32_t max_clients = DEFAULT_MAX_CLIENTS, uint32_t flags = 0)
+{
+    if (max_size < size)
+        max_size = size;
+    if (pool_metadata_size(max_size, max_clients) >= size)
+        return false;
+
+    auto *metadata = static_cast<SharedMemoryMetadata *>(base);
+    memset(static_cast<void *>(metadata), 0, sizeof(SharedMemoryMetadata));
+    metadata->lock.init();
+    metadata->flags = flags;
+    pool_layout(*metadata, max_size, max_clients);
+    max_clients = metadata->max_clients;
+    metadata->arena_pages = (size - metadata->arena_offset) / POOL_PAGE_SIZE;
+    memset(pool_at(base, metadata->page_map_offset), 0, metadata->arena_offset - metadata->page_map_offset);
+
+    ClientEntry *clients = reinterpret_cast<ClientEntry *>(pool_at(base, metadata->clients_offset));
+    for (uint32_t i = 0; i < max_clients; i++)
+        clients[i].client_id.store(-1, std::memory_order_relaxed);
+
+    pool_add_pages(base, metadata, 0, metadata->arena_pages);
+    metadata->pool_size.store(size, std::memory_order_release);
+    return true;
+}
+
+// Extend the arena after the segment itself has been grown to `new_size`
+// bytes, then bump the generation so attached clients remap. Caller holds
+// metadata->lock.
+inline bool pool_grow(void *base, SharedMemoryMetadata *metadata, uint64_t new_size)
+{
+    if (new_size <= metadata->pool_size.load(std::memory_order_relaxed) || new_size > metadata->max_size)
+        return false;
+
+    uint64_t old_pages = metadata->arena_pages;
+    metadata->arena_pages = (new_size - metadata->arena_offset) / POOL_PAGE_SIZE;
+    pool_add_pages(base, metadata, old_pages, metadata->arena_pages);
+    metadata->pool_size.store(new_size, std::memory_order_release);
+    metadata->generation.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+// Returns the page index of a free block of `order`, or -1 when out of memory
+inline int64_t pool_buddy_alloc(void *base, SharedMemoryMetadata *metadata, int order)
+{
+    int found = order;
+    while (found < POOL_MAX_ORDER && metadata->buddy_free[found] == POOL_NULL)
+        found++;
+    if (found == POOL_MAX_ORDER)
+        return -1;
+
+    uint64_t page = pool_page_index(metadata, metadata->buddy_free[found]);
+    pool_buddy_unlink(base, metadata, page, found);
+
+    // Split down, returning the upper halves to their free lists
+    while (found > order)
+    {
+        found--;
+        pool_buddy_push(base, metadata, page + (uint64_t(1) << found), found);
+    }
+    pool_page_map(base, metadata)[page] = PAGE_USED | order;
+    metadata->used_size.fetch_add((uint64_t(POOL_PAGE_SIZE) << order), std::memory_order_relaxed);
+    metadata->remaining_size.fetch_sub((uint64_t(POOL_PAGE_SIZE) << order), std::memory_order_relaxed);
+    return page;
+}
+
+inline void pool_buddy_free(void *base, SharedMemoryMetadata *metadata, uint64_t page, int order)
+{
+    metadata->used_size.fetch_sub((uint64_t(POOL_PAGE_SIZE) << order), std::memory_order_relaxed);
+    metadata->remaining_size.fetch_add((uint64_t(POOL_PAGE_SIZE) << order), std::memory_order_relaxed);
+    pool_page_map(base, metadata)[page] = 0;
+    pool_buddy_release(base, metadata, page, order);
+}
+
+// Carve a fresh page into objects of `size_class`
+inline bool pool_slab_refill(void *base, SharedMemoryMetadata *metadata, int size_class)
+{
+    int64_t page = pool_buddy_alloc(base, metadata, 0);
+    if (page < 0)
+        return false;
+
+    // Slab pages are accounted object by object, not as a whole page
+    metadata->used_size.fetch_sub(POOL_PAGE_SIZE, std::memory_order_relaxed);
+    metadata->remaining_size.fetch_add(POOL_PAGE_SIZE, std::memory_order_relaxed);
+    pool_page_map(base, metadata)[page] = PAGE_SLAB | size_class;
+
+    uint64_t object_size = pool_class_size(size_class);
+    uint64_t first = pool_page_offset(metadata, page);
+    for (uint64_t offset = first + POOL_PAGE_SIZE - object_size;; offset -= object_size)
+    {
+        reinterpret_cast<PoolFreeObject *>(pool_at(base, offset))->next = metadata->class_free[size_class];
+        metadata->class_free[size_class] = offset;
+        if (offset == first)
+            break;
+    }
+    return true;
+}
+
+// Allocate `size` bytes, returns the offset from the segment base or
+// POOL_NULL when the pool is exhausted. Callers serialise access.
+inline uint64_t pool_alloc(void *base, SharedMemoryMetadata *metadata, uint64_t size)
+{
+    if (size == 0)
+        size = 1;
+
+    int size_class = pool_size_class(size);
+    if (size_class >= 0)
+    {
+        if (metadata->class_free[size_class] == POOL_NULL && !pool_slab_refill(base, metadata, size_class))
+            return POOL_NULL;
+        uint64_t offset = metadata->class_free[size_class];
+        metadata->class_free[size_class] = reinterpret_cast<PoolFreeObject *>(pool_at(base, offset))->next;
+        metadata->used_size.fetch_add(pool_class_size(size_class), std::memory_order_relaxed);
+        metadata->remaining_size.fetch_sub(pool_class_size(size_class), std::memory_order_relaxed);
+        stats_add(metadata->stats.bytes_allocated, pool_class_size(size_class));
+        return offset;
+    }
+
+    int order = pool_buddy_order(size);
+    if (order >= POOL_MAX_ORDER)
+        return POOL_NULL;
+    int64_t page = pool_buddy_alloc(base, metadata, order);
+    if (page < 0)
+        return POOL_NULL;
+    stats_add(metadata->stats.bytes_allocated, uint64_t(POOL_PAGE_SIZE) << order);
+    return pool_page_offset(metadata, page);
+}
+
+// Bytes actually reserved for the allocation at `offset`
+inline uint64_t pool_block_size(void *base, SharedMemoryMetadata *metadata, uint64_t offset)
+{
+    uint8_t tag = pool_page_map(base, metadata)[pool_page_index(metadata, offset)];
+    if (tag & PAGE_SLAB)
+        return pool_class_size(tag & PAGE_LOW_BITS);
+    return uint64_t(POOL_PAGE_SIZE) << (tag & PAGE_LOW_BITS);
+}
+
+inline ClientEntry *pool_clients(void *base, SharedMemoryMetadata *metadata)
+{
+    return reinterpret_cast<ClientEntry *>(pool_at(base, metadata->clients_offset));
+}
+
+inline ClientStats *pool_client_stats(void *base, SharedMemoryMetadata *metadata)
+{
+    return reinterpret_cast<ClientStats *>(pool_at(base, metadata->client_stats_offset));
+}
+
+inline std::atomic<uint64_t> *pool_slot_bitmap(void *base, SharedMemoryMetadata *metadata)
+{
+    return reinterpret_cast<std::atomic<uint64_t> *>(pool_at(base, metadata->slot_bitmap_offset));
+}
+
+inline std::atomic<uint64_t> *pool_slot_summary(void *base, SharedMemoryMetadata *metadata)
+{
+    return reinterpret_cast<std::atomic<uint64_t> *>(pool_at(base, metadata->slot_summary_offset));
+}
+
+inline std::atomic<int32_t> *pool_client_index(void *base, SharedMemoryMetadata *metadata)
+{
+    return reinterpret_cast<std::atomic<int32_t> *>(pool_at(base, metadata->client_index_offset));
+}
+
+// Slot holding client_id, or -1 if it is not attached. One load, no scan.
+inline int pool_lookup_client(void *base, SharedMemoryMetadata *metadata, int client_id)
+{
+    if (client_id < 0 || (uint32_t)client_id >= metadata->max_clients)
+        return -1;
+    return pool_client_index(base, metadata)[client_id].load(std::memory_order_acquire) - 1;
+}
+
+// Set a clear bit in bitmap word `word`, returns the slot or -1 if the word is full
+inline int pool_claim_in_word(void *base, SharedMemoryMetadata *metadata, uint64_t word)
+{
+    std::atomic<uint64_t> &bits = pool_slot_bitmap(base, metadata)[word];
+    uint64_t current = bits.load(std::memory_order_relaxed);
+    while (current != ~uint64_t(0))
+    {
+        uint64_t bit = uint64_t(1) << __builtin_ctzll(~current);
+        uint64_t previous = bits.fetch_or(bit, std::memory_order_acq_rel);
+        if ((previous & bit) == 0)
+        {
+            if ((previous | bit) == ~uint64_t(0))
+                pool_slot_summary(base, metadata)[word / 64].fetch_or(uint64_t(1) << (word % 64), std::memory_order_relaxed);
+            return word * 64 + __builtin_ctzll(bit);
+        }
+        current = previous | bit;
+    }
+    return -1;
+}
+
+// Claim a free slot. The summary points straight at a bitmap word with room,
+// so this is a couple of atomic ops rather than a scan of every slot. The
+// summary is only a hint; if it claims everything is full the bitmap is
+// scanned once before giving up.
+inline int pool_claim_slot(void *base, SharedMemoryMetadata *metadata)
+{
+    uint64_t bitmap_words = metadata->max_clients / 64;
+    uint64_t summary_words = (bitmap_words + 63) / 64;
+    std::atomic<uint64_t> *summary = pool_slot_summary(base, metadata);
+    for (uint64_t s = 0; s < summary_words; s++)
+    {
+        uint64_t full = summary[s].load(std::memory_order_relaxed);
+        while (full != ~uint64_t(0))
+        {
+            uint64_t word = s * 64 + __builtin_ctzll(~full);
+            if (word >= bitmap_words)
+                break;
+            int slot = pool_claim_in_word(base, metadata, word);
+            if (slot >= 0)
+                return slot;
+            full |= uint64_t(1) << (word % 64);
+        }
+    }
+    for (uint64_t word = 0; word < bitmap_words; word++)
+    {
+        int slot = pool_claim_in_word(base, metadata, word);
+        if (slot >= 0)
+            return slot;
+    }
+    return -1;
+}
+
+inline void pool_release_slot(void *base, SharedMemoryMetadata *metadata, int slot)
+{
+    uint64_t word = slot / 64;
+    pool_slot_bitmap(base, metadata)[word].fetch_and(~(uint64_t(1) << (slot % 64)), std::memory_order_release);
+    pool_slot_summary(base, metadata)[word / 64].fetch_and(~(uint64_t(1) << (word % 64)), std::memory_order_relaxed);
+}
+
+// Attach client_id, returning its slot (existing or new) or -1 when the id
+// is out of range or every slot is taken. Lock free: concurrent attaches of
+// the same id race on one CAS of the index entry and the loser hands its
+// slot back.
+inline int pool_attach_client(void *base, SharedMemoryMetadata *metadata, int client_id)
+{
+    int slot = pool_lookup_client(base, metadata, client_id);
+    if (slot >= 0 || client_id < 0 || (uint32_t)client_id >= metadata->max_clients)
+        return slot;
+
+    slot = pool_claim_slot(base, metadata);
+    if (slot < 0)
+        return -1;
+
+    ClientStats &stats = pool_client_stats(base, metadata)[slot];
+    stats.bytes_allocated.store(0, std::memory_order_relaxed);
+    stats.writes.store(0, std::memory_order_relaxed);
+    stats.reads.store(0, std::memory_order_relaxed);
+    stats.failures.store(0, std::memory_order_relaxed);
+
+    ClientEntry &entry = pool_clients(base, metadata)[slot];
+    entry.offset.store(POOL_NULL, std::memory_order_relaxed);
+    entry.length.store(0, std::memory_order_relaxed);
+    entry.client_id.store(client_id, std::memory_order_release);
+
+    int32_t expected = 0;
+    if (pool_client_index(base, metadata)[client_id].compare_exchange_strong(expected, slot + 1, std::memory_order_acq_rel))
+    {
+        metadata->clients_connected.fetch_add(1, std::memory_order_relaxed);
+        return slot;
+    }
+    entry.client_id.store(-1, std::memory_order_relaxed);
+    pool_release_slot(base, metadata, slot);
+    return expected - 1;
+}
+
+// Unpublish client_id from `slot`. The caller holds the slot's seqlock and
+// has already freed the slot's allocation.
+inline void pool_detach_client(void *base, SharedMemoryMetadata *metadata, int client_id, int slot)
+{
+    ClientEntry &entry = pool_clients(base, metadata)[slot];
+    entry.offset.store(POOL_NULL, std::memory_order_relaxed);
+    entry.length.store(0, std::memory_order_relaxed);
+    entry.client_id.store(-1, std::memory_order_release);
+
+    int32_t expected = slot + 1;
+    pool_client_index(base, metadata)[client_id].compare_exchange_strong(expected, 0, std::memory_order_acq_rel);
+    pool_release_slot(base, metadata, slot);
+    metadata->clients_connected.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// Release an allocation. The page map tells slab objects from buddy blocks,
+// so callers do not need to remember the size they asked for.
+inline void pool_free(void *base, SharedMemoryMetadata *metadata, uint64_t offset)
+{
+    if (offset == POOL_NULL)
+        return;
+
+    uint64_t page = pool_page_index(metadata, offset);
+    uint8_t tag = pool_page_map(base, metadata)[page];
+    stats_add(metadata->stats.bytes_freed, pool_block_size(base, metadata, offset));
+    if (tag & PAGE_SLAB)
+    {
+        int size_class = tag & PAGE_LOW_BITS;
+        reinterpret_cast<PoolFreeObject *>(pool_at(base, offset))->next = metadata->class_free[size_class];
+        metadata->class_free[size_class] = offset;
+        metadata->used_size.fetch_sub(pool_class_size(size_class), std::memory_order_relaxed);
+        metadata->remaining_size.fetch_add(pool_class_size(size_class), std::memory_order_relaxed);
+    }
+    else if (tag & PAGE_USED)
+    {
+        pool_buddy_free(base, metadata, page, tag & PAGE_LOW_BITS);
+    }
+}
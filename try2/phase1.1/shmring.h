@@ -0,0 +1,354 @@
+#pragma once
+// Ring buffer channels laid out in a shared memory segment, for streaming
+// messages from writer processes to reader processes.
+//
+// Segment layout:
+//   [RingHeader][capacity slots of (RingSlot header + slot_size payload bytes)]
+//
+// SPSC rings use a plain head/tail pair, MPMC rings a per-slot sequence
+// number (bounded queue in the style of Vyukov). Indices that different
+// processes write sit on their own cache lines. Pushes and pops are lock
+// free; a consumer that finds the ring empty sleeps on a futex in the
+// header, and producers only issue FUTEX_WAKE when someone is asleep.
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+#define RING_MAGIC 0x52494e47 // "RING"
+#define RING_SPIN_LIMIT 1024  // Empty polls before a consumer sleeps
+
+enum RingKind : uint32_t
+{
+    RING_SPSC = 1,
+    RING_MPMC = 2,
+};
+
+struct RingHeader
+{
+    uint32_t magic;
+    uint32_t kind;
+    uint64_t capacity;  // Slots, a power of two
+    uint64_t slot_size; // Largest message in bytes
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head; // Next slot to consume
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail; // Next slot to produce
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> wake;    // Futex word, bumped on push when sleepers exist
+    std::atomic<uint32_t> sleepers;                          // Consumers inside futex wait
+};
+
+struct alignas(8) RingSlot
+{
+    std::atomic<uint64_t> sequence; // MPMC only: which lap may use the slot next
+    uint32_t length;
+    uint32_t reserved;
+};
+
+inline long ring_futex(std::atomic<uint32_t> *word, int op, uint32_t value)
+{
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), op, value, nullptr, nullptr, 0);
+}
+
+class ShmChannel
+{
+public:
+    ShmChannel() = default;
+    ~ShmChannel() { close_channel(); }
+
+    ShmChannel(const ShmChannel &) = delete;
+    ShmChannel &operator=(const ShmChannel &) = delete;
+
+    // Create (or recreate) channel `name` with `capacity` slots of up to `slot_size` bytes
+    bool create(const std::string &name, RingKind kind, uint64_t capacity, uint64_t slot_size)
+    {
+        uint64_t slots = 1;
+        while (slots < capacity)
+            slots <<= 1;
+        slot_size = (slot_size + 7) & ~uint64_t(7);
+
+        size_t size = sizeof(RingHeader) + slots * (sizeof(RingSlot) + slot_size);
+        if (!map(name, O_CREAT | O_RDWR, size))
+            return false;
+
+        memset(static_cast<void *>(header_), 0, sizeof(RingHeader));
+        header_->kind = kind;
+        header_->capacity = slots;
+        header_->slot_size = slot_size;
+        for (uint64_t i = 0; i < slots; i++)
+            slot(i)->sequence.store(i, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        header_->magic = RING_MAGIC;
+        cached_head_ = 0;
+        cached_tail_ = 0;
+        return true;
+    }
+
+    // Attach to a channel another process created
+    bool open(const std::string &name)
+    {
+        if (!map(name, O_RDWR, 0))
+            return false;
+        if (header_->magic != RING_MAGIC)
+        {
+            std::cerr << "[Channel] " << name << " is not initialised" << std::endl;
+            close_channel();
+            return false;
+        }
+        // The ring may have been used before we attached
+        cached_head_ = header_->head.load(std::memory_order_acquire);
+        cached_tail_ = header_->tail.load(std::memory_order_acquire);
+        return true;
+    }
+
+    void close_channel()
+    {
+        if (header_ != nullptr)
+            munmap(header_, size_);
+        header_ = nullptr;
+        size_ = 0;
+    }
+
+    static void unlink(const std::string &name)
+    {
+        shm_unlink(("p2p_channel_" + name).c_str());
+    }
+
+    uint64_t slot_size() const { return header_->slot_size; }
+
+    // Non-blocking push, false if the ring is full or the message too big
+    bool try_send(const void *data, uint32_t length)
+    {
+        if (length > header_->slot_size)
+            return false;
+        return header_->kind == RING_SPSC ? spsc_push(data, length) : mpmc_push(data, length);
+    }
+
+    // Push, yielding while the ring is full
+    bool send(const void *data, uint32_t length)
+    {
+        if (length > header_->slot_size)
+            return false;
+        while (!try_send(data, length))
+            sched_yield();
+        return true;
+    }
+
+    bool send(const std::string &message)
+    {
+        return send(message.data(), message.size());
+    }
+
+    // Non-blocking pop into `buffer`, returns the message length or -1 if empty
+    int64_t try_receive(void *buffer, uint64_t capacity)
+    {
+        return header_->kind == RING_SPSC ? spsc_pop(buffer, capacity) : mpmc_pop(buffer, capacity);
+    }
+
+    // Pop, spinning briefly and then sleeping on the futex while empty
+    int64_t receive(void *buffer, uint64_t capacity)
+    {
+        for (int spins = 0;; spins++)
+        {
+            int64_t length = try_receive(buffer, capacity);
+            if (length >= 0)
+                return length;
+            if (spins < RING_SPIN_LIMIT)
+                continue;
+
+            uint32_t wake = header_->wake.load(std::memory_order_acquire);
+            header_->sleepers.fetch_add(1, std::memory_order_seq_cst);
+            // Recheck after announcing ourselves, a push may have raced the sleep
+            length = try_receive(buffer, capacity);
+            if (length < 0)
+                ring_futex(&header_->wake, FUTEX_WAIT, wake);
+            header_->sleepers.fetch_sub(1, std::memory_order_relaxed);
+            if (length >= 0)
+                return length;
+        }
+    }
+
+    bool receive(std::string &message)
+    {
+        message.resize(header_->slot_size);
+        int64_t length = receive(&message[0], message.size());
+        message.resize(length < 0 ? 0 : length);
+        return length >= 0;
+    }
+
+private:
+    bool map(const std::string &name, int flags, size_t size)
+    {
+        close_channel();
+        std::string shm_name = "p2p_channel_" + name;
+        int shm_fd = shm_open(shm_name.c_str(), flags, 0666);
+        if (shm_fd == -1)
+        {
+            std::cerr << "[Channel] Error opening " << shm_name << std::endl;
+            return false;
+        }
+
+        struct stat st;
+        if (size != 0 && ftruncate(shm_fd, size) == -1)
+        {
+            std::cerr << "[Channel] Error sizing " << shm_name << std::endl;
+            ::close(shm_fd);
+            return false;
+        }
+        if (size == 0)
+        {
+            if (fstat(shm_fd, &st) == -1 || st.st_size < (off_t)sizeof(RingHeader))
+            {
+                ::close(shm_fd);
+                return false;
+            }
+            size = st.st_size;
+        }
+
+        void *ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+        ::close(shm_fd);
+        if (ptr == MAP_FAILED)
+        {
+            std::cerr << "[Channel] Error mapping " << shm_name << std::endl;
+            return false;
+        }
+        header_ = static_cast<RingHeader *>(ptr);
+        size_ = size;
+        return true;
+    }
+
+    RingSlot *slot(uint64_t index)
+    {
+        char *slots = reinterpret_cast<char *>(header_ + 1);
+        return reinterpret_cast<RingSlot *>(slots + (index & (header_->capacity - 1)) * (sizeof(RingSlot) + header_->slot_size));
+    }
+
+    static char *payload(RingSlot *s)
+    {
+        return reinterpret_cast<char *>(s + 1);
+    }
+
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (header_->sleepers.load(std::memory_order_relaxed) > 0)
+        {
+            header_->wake.fetch_add(1, std::memory_order_release);
+            ring_futex(&header_->wake, FUTEX_WAKE, INT_MAX);
+        }
+    }
+
+    // SPSC: the producer owns tail, the consumer owns head. Each side keeps a
+    // cached copy of the other's index and only rereads it when it seems to
+    // have run out of room/data.
+    bool spsc_push(const void *data, uint32_t length)
+    {
+        uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+        if (tail - cached_head_ >= header_->capacity)
+        {
+            cached_head_ = header_->head.load(std::memory_order_acquire);
+            if (tail - cached_head_ >= header_->capacity)
+                return false;
+        }
+        RingSlot *s = slot(tail);
+        s->length = length;
+        memcpy(payload(s), data, length);
+        header_->tail.store(tail + 1, std::memory_order_release);
+        notify();
+        return true;
+    }
+
+    int64_t spsc_pop(void *buffer, uint64_t capacity)
+    {
+        uint64_t head = header_->head.load(std::memory_order_relaxed);
+        if (head >= cached_tail_)
+        {
+            cached_tail_ = header_->tail.load(std::memory_order_acquire);
+            if (head >= cached_tail_)
+                return -1;
+        }
+        RingSlot *s = slot(head);
+        uint32_t length = s->length;
+        memcpy(buffer, payload(s), length < capacity ? length : capacity);
+        header_->head.store(head + 1, std::memory_order_release);
+        return length;
+    }
+
+    // MPMC: a slot is free for the producer of lap `pos` when its sequence
+    // equals pos, and holds data for the consumer of `pos` when it equals pos + 1.
+    bool mpmc_push(const void *data, uint32_t length)
+    {
+        uint64_t pos = header_->tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            RingSlot *s = slot(pos);
+            uint64_t sequence = s->sequence.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)sequence - (int64_t)pos;
+            if (diff == 0)
+            {
+                if (header_->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    s->length = length;
+                    memcpy(payload(s), data, length);
+                    s->sequence.store(pos + 1, std::memory_order_release);
+                    notify();
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = header_->tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    int64_t mpmc_pop(void *buffer, uint64_t capacity)
+    {
+        uint64_t pos = header_->head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            RingSlot *s = slot(pos);
+            uint64_t sequence = s->sequence.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)sequence - (int64_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (header_->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    uint32_t length = s->length;
+                    memcpy(buffer, payload(s), length < capacity ? length : capacity);
+                    s->sequence.store(pos + header_->capacity, std::memory_order_release);
+                    return length;
+                }
+            }
+            else if (diff < 0)
+            {
+                return -1;
+            }
+            else
+            {
+                pos = header_->head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    RingHeader *header_ = nullptr;
+    size_t size_ = 0;
+    uint64_t cached_head_ = 0; // Producer's view of head (SPSC)
+    uint64_t cached_tail_ = 0; // Consumer's view of tail (SPSC)
+};
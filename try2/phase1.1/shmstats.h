@@ -0,0 +1,79 @@
+#pragma once
+// Pool and per-client counters kept in the shared segment.
+//
+// Every process bumps them with relaxed atomics on the hot path and nobody
+// takes a lock to read them; the server renders them for scraping. Latency
+// is sampled (one op in POOL_LATENCY_SAMPLE per handle) into log2 buckets
+// so the clock reads stay off most operations.
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#define LATENCY_BUCKETS 20     // Bucket i counts ops faster than 2^(i + 6) ns, 64 ns .. 32 ms
+#define POOL_LATENCY_SAMPLE 16 // Time one op in this many
+
+enum PoolOp
+{
+    POOL_OP_WRITE = 0,
+    POOL_OP_READ = 1,
+    POOL_OP_DEREGISTER = 2,
+    POOL_OPS = 3,
+};
+
+enum PoolFailure
+{
+    POOL_FAIL_NO_SLOT = 0,  // Client id out of range or every slot taken
+    POOL_FAIL_NO_MEMORY = 1, // Allocator could not serve the write
+    POOL_FAIL_NOT_FOUND = 2, // Read or deregister of a client without data
+    POOL_FAILURES = 3,
+};
+
+struct LatencyHistogram
+{
+    std::atomic<uint64_t> buckets[LATENCY_BUCKETS + 1]; // Last bucket is overflow
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum_ns;
+};
+
+struct PoolStats
+{
+    std::atomic<uint64_t> ops[POOL_OPS];
+    std::atomic<uint64_t> failures[POOL_FAILURES];
+    std::atomic<uint64_t> bytes_allocated; // Running total handed out by pool_alloc
+    std::atomic<uint64_t> bytes_freed;
+    std::atomic<uint64_t> bytes_written;
+    std::atomic<uint64_t> bytes_read;
+    std::atomic<uint64_t> read_retries; // Seqlock reads that had to start over
+    LatencyHistogram latency[POOL_OPS];
+};
+
+struct ClientStats
+{
+    std::atomic<uint64_t> bytes_allocated; // Size of the block the client currently holds
+    std::atomic<uint64_t> writes;
+    std::atomic<uint64_t> reads;
+    std::atomic<uint64_t> failures;
+};
+
+inline void stats_add(std::atomic<uint64_t> &counter, uint64_t value = 1)
+{
+    counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+inline int latency_bucket(uint64_t ns)
+{
+    int bucket = ns < 64 ? 0 : 63 - __builtin_clzll(ns) - 5;
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS;
+}
+
+inline void latency_record(LatencyHistogram &histogram, uint64_t ns)
+{
+    stats_add(histogram.buckets[latency_bucket(ns)]);
+    stats_add(histogram.count);
+    stats_add(histogram.sum_ns, ns);
+}
+
+inline uint64_t stats_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,150 @@
+#pragma once
+// Process-shared synchronisation that lives inside the shared segment.
+//
+// ShmMutex guards metadata changes (allocator free lists, client table).
+// It is a glibc robust, process-shared mutex: a futex word in the segment
+// whose owner the kernel tracks through the robust list, so a process that
+// dies holding it hands the next locker EOWNERDEAD instead of a deadlock.
+// It also counts how often and how long lockers had to wait.
+//
+// Message data is published with a per-slot seqlock. Writers of one slot
+// exclude each other by moving the sequence from even to odd; readers never
+// write to the segment, they copy and retry if the sequence moved.
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+#define SEQLOCK_SPINS_BEFORE_CHECK 4096 // Spins before checking whether the slot writer is alive
+
+struct ShmMutex
+{
+    pthread_mutex_t mutex;
+    std::atomic<uint64_t> acquisitions;
+    std::atomic<uint64_t> contended; // Acquisitions that had to wait
+    std::atomic<uint64_t> wait_ns;   // Total time spent waiting
+
+    void init()
+    {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+    }
+
+    // The uncontended path is a single trylock; only a lock that has to
+    // wait reads the clock to account the wait.
+    void lock()
+    {
+        int rc = pthread_mutex_trylock(&mutex);
+        if (rc == EBUSY)
+        {
+            timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            rc = pthread_mutex_lock(&mutex);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            contended.fetch_add(1, std::memory_order_relaxed);
+            wait_ns.fetch_add((end.tv_sec - start.tv_sec) * 1000000000ull + end.tv_nsec - start.tv_nsec, std::memory_order_relaxed);
+        }
+        if (rc == EOWNERDEAD)
+        {
+            std::cerr << "[Pool] Previous lock owner died, recovering metadata lock" << std::endl;
+            pthread_mutex_consistent(&mutex);
+        }
+        acquisitions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void unlock()
+    {
+        pthread_mutex_unlock(&mutex);
+    }
+};
+
+class ShmLockGuard
+{
+public:
+    explicit ShmLockGuard(ShmMutex &mutex) : mutex_(mutex) { mutex_.lock(); }
+    ~ShmLockGuard() { mutex_.unlock(); }
+
+    ShmLockGuard(const ShmLockGuard &) = delete;
+    ShmLockGuard &operator=(const ShmLockGuard &) = delete;
+
+private:
+    ShmMutex &mutex_;
+};
+
+inline bool process_alive(int pid)
+{
+    return pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+// Take the write side of a seqlock, leaving the sequence odd.
+// writer_pid records the owner (`self`, the caller's pid) so that a slot
+// whose writer died mid-update can be taken over instead of spinning forever.
+inline void seqlock_write_lock(std::atomic<uint32_t> &seq, std::atomic<int> &writer_pid, int self)
+{
+    for (uint32_t spins = 0;; spins++)
+    {
+        uint32_t current = seq.load(std::memory_order_relaxed);
+        if ((current & 1) == 0)
+        {
+            if (seq.compare_exchange_weak(current, current + 1, std::memory_order_acquire))
+            {
+                writer_pid.store(self, std::memory_order_relaxed);
+                return;
+            }
+            continue;
+        }
+
+        if (spins % SEQLOCK_SPINS_BEFORE_CHECK == SEQLOCK_SPINS_BEFORE_CHECK - 1)
+        {
+            int owner = writer_pid.load(std::memory_order_relaxed);
+            if (!process_alive(owner) && writer_pid.compare_exchange_strong(owner, self))
+            {
+                std::cerr << "[Pool] Slot writer " << owner << " died, taking over its slot" << std::endl;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return;
+            }
+        }
+        sched_yield();
+    }
+}
+
+inline void seqlock_write_unlock(std::atomic<uint32_t> &seq, std::atomic<int> &writer_pid)
+{
+    writer_pid.store(0, std::memory_order_relaxed);
+    seq.fetch_add(1, std::memory_order_release);
+}
+
+// Sequence to validate a read against, waiting out any writer in progress.
+// Returns false if the slot's writer died halfway through an update.
+inline bool seqlock_read_begin(const std::atomic<uint32_t> &seq, const std::atomic<int> &writer_pid, uint32_t &start)
+{
+    for (uint32_t spins = 0;; spins++)
+    {
+        start = seq.load(std::memory_order_acquire);
+        if ((start & 1) == 0)
+            return true;
+        if (spins % SEQLOCK_SPINS_BEFORE_CHECK == SEQLOCK_SPINS_BEFORE_CHECK - 1 &&
+            !process_alive(writer_pid.load(std::memory_order_relaxed)))
+            return false;
+        sched_yield();
+    }
+}
+
+// True if a writer touched the slot since seqlock_read_begin returned `start`
+inline bool seqlock_read_retry(const std::atomic<uint32_t> &seq, uint32_t start)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return seq.load(std::memory_order_relaxed) != start;
+}
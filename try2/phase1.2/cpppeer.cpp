@@ -3,81 +3,167 @@
 #include <cstring>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
 #include <jsoncpp/json/json.h>
+#include "../common/wire.h"
 
 #define SERVER_IP "127.0.0.1"
 #define SERVER_PORT 8080
 
-int client_id = -1;
+std::atomic<int> client_id{-1};
 int client_socket = -1;  // Keep socket open for multiple requests
-
-void sendToServer(const std::string &message)
+uint32_t next_request_id = 1;
+std::mutex send_lock;    // Heartbeats and requests share the socket
+std::string pending;     // Bytes received past the last reply
+std::set<int32_t> peers; // Registry membership as of peer_version
+uint64_t peer_version = 0; // 0 until the first full listing
+
+// Send one request frame and wait for its reply
+bool request(const std::string &frame, WireHeader &header, std::string &body)
 {
-    if (send(client_socket, message.c_str(), message.size(), 0) == -1)
+    std::unique_lock<std::mutex> lock(send_lock);
+    bool sent = wire_send(client_socket, frame);
+    lock.unlock();
+    if (!sent)
     {
         std::cerr << "[Client] Failed to send data!" << std::endl;
+        return false;
+    }
+    if (!wire_receive(client_socket, pending, header, body))
+    {
+        std::cerr << "[Client] Server closed the connection!" << std::endl;
+        return false;
     }
+    return true;
 }
 
-void receiveFromServer()
+// Keep our registration alive; heartbeats get no reply so they never
+// interleave with the responses request() is waiting for
+void heartbeat()
 {
-    char buffer[1024] = {0};
-    int bytes_received = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-    if (bytes_received > 0)
-    {
-        buffer[bytes_received] = '\0';
-        std::cout << "[Server] " << buffer << std::endl;
-    }
-    else
+    while (true)
     {
-        std::cerr << "[Client] Server closed the connection!" << std::endl;
+        std::this_thread::sleep_for(std::chrono::milliseconds(WIRE_HEARTBEAT_INTERVAL_MS));
+        if (client_id == -1)
+            continue;
+        std::lock_guard<std::mutex> lock(send_lock);
+        wire_send(client_socket, WireWriter(OP_HEARTBEAT, 0).i32(client_id).finish());
     }
 }
 
 void registerClient()
 {
-    if (client_id != -1)
+    WireHeader header;
+    std::string body;
+    if (!request(WireWriter(OP_REGISTER, next_request_id++).i32(client_id).finish(), header, body))
+        return;
+
+    if (header.status == WIRE_INVALID_ID)
     {
-        sendToServer("register " + std::to_string(client_id));
+        std::cerr << "[Client] Invalid ID, requesting new one..." << std::endl;
+        client_id = -1;
+        if (!request(WireWriter(OP_REGISTER, next_request_id++).i32(-1).finish(), header, body))
+            return;
     }
-    else
+    if (header.status != WIRE_OK)
     {
-        sendToServer("register");
+        std::cerr << "[Client] " << wire_status_text(header.status) << std::endl;
+        return;
     }
 
-    char buffer[256] = {0};
-    int bytes_received = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-    if (bytes_received > 0)
+    WireReader reader(body.data(), body.size());
+    int assigned_id = reader.i32();
+    if (assigned_id == client_id)
     {
-        buffer[bytes_received] = '\0';  // Null-terminate
+        std::cout << "[Client] Welcome Back From Server: Your ID: " << client_id << std::endl;
+    }
+    else
+    {
+        client_id = assigned_id;
+        std::cout << "[Client] Registered with ID: " << client_id << std::endl;
+    }
+    std::cout << "[Client] Let's Go!" << std::endl;
+}
 
-        std::string response(buffer);
 
-        if (response.find("Invalid") != std::string::npos) // FIXED CONDITION
-        {
-            std::cerr << "[Client] Invalid ID, requesting new one..." << std::endl;
-            sendToServer("register");
-            recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-            buffer[bytes_received] = '\0';  // Null-terminate again
-            client_id = std::stoi(buffer);
-            std::cout << "[Client] Registered with ID: " << client_id << std::endl;
-            return;
-        }
 
-        if (response.find("Welcome") != std::string::npos) // FIXED CONDITION
-        {
-            std::cout << "[Client] Welcome Back From Server: " << buffer << std::endl;
-        }
-        else{
+// One OP_PEERLIST round trip; applies a delta or a page to `peers`. The
+// first page of a listing replaces what we had. Returns the reply kind, or
+// 0 on failure.
+uint8_t fetchPeers(uint64_t known_version, int32_t after, uint64_t &version, uint32_t &remaining)
+{
+    WireHeader header;
+    std::string body;
+    WireWriter frame(OP_PEERLIST, next_request_id++);
+    if (!request(frame.i32(client_id).u64(known_version).i32(after).finish(), header, body))
+        return 0;
+    if (header.status != WIRE_OK)
+    {
+        std::cout << "[Server] " << wire_status_text(header.status) << std::endl;
+        return 0;
+    }
 
-            client_id = std::stoi(buffer);
-            std::cout << "[Client] Registered with ID: " << client_id << std::endl;
-        }
-        std::cout << "[Client] Let's Go!" << std::endl;
+    WireReader reader(body.data(), body.size());
+    uint8_t kind = reader.u8();
+    version = reader.u64();
+    remaining = 0;
+    if (kind == PEERLIST_DELTA)
+    {
+        uint32_t added = reader.u32();
+        for (uint32_t i = 0; i < added && reader.ok(); i++)
+            peers.insert(reader.i32());
+        uint32_t removed = reader.u32();
+        for (uint32_t i = 0; i < removed && reader.ok(); i++)
+            peers.erase(reader.i32());
+    }
+    else
+    {
+        if (after == 0)
+            peers.clear();
+        reader.u32(); // total
+        remaining = reader.u32();
+        uint32_t count = reader.u32();
+        for (uint32_t i = 0; i < count && reader.ok(); i++)
+            peers.insert(reader.i32());
     }
+    return reader.ok() ? kind : 0;
 }
 
+// Bring `peers` up to date: a delta when the registry still has our
+// version, otherwise a fresh listing page by page
+bool syncPeers()
+{
+    uint64_t version;
+    uint32_t remaining;
+    uint8_t kind = fetchPeers(peer_version, 0, version, remaining);
+    if (kind == PEERLIST_DELTA)
+    {
+        peer_version = version;
+        return true;
+    }
+    if (kind != PEERLIST_PAGE)
+        return false;
 
+    // Our version was too old: that was the first page of a full listing
+    uint64_t oldest = version, newest = version;
+    while (remaining > 0)
+    {
+        if (fetchPeers(0, *peers.rbegin(), version, remaining) != PEERLIST_PAGE)
+            return false;
+        oldest = std::min(oldest, version);
+        newest = std::max(newest, version);
+    }
+
+    // Pages from different versions: replay the changes since the oldest one
+    peer_version = oldest;
+    if (oldest != newest && fetchPeers(oldest, 0, version, remaining) == PEERLIST_DELTA)
+        peer_version = version;
+    return true;
+}
 
 void requestPeerList()
 {
@@ -86,15 +172,25 @@ void requestPeerList()
         std::cerr << "[Client] You must register first!" << std::endl;
         return;
     }
-    sendToServer("peerlist " + std::to_string(client_id));
-    receiveFromServer();
+    if (!syncPeers())
+        return;
+
+    std::string peer_list = "[";
+    for (int32_t id : peers)
+    {
+        if (id != client_id)
+            peer_list += (peer_list.size() > 1 ? "," : "") + std::to_string(id);
+    }
+    std::cout << "[Server] " << peer_list << "]" << std::endl;
 }
 
 void disconnectClient()
 {
     if (client_id != -1)
     {
-        sendToServer("disconnect " + std::to_string(client_id));
+        WireHeader header;
+        std::string body;
+        request(WireWriter(OP_DISCONNECT, next_request_id++).i32(client_id).finish(), header, body);
         std::cout << "[Client] Disconnected from server." << std::endl;
     }
     close(client_socket);
@@ -131,6 +227,7 @@ int main(int argc, char *argv[])
     }
 
     std::cout << "[Client] Connected to server.\n";
+    std::thread(heartbeat).detach();
 
     while (true)
     {
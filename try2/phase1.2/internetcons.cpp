@@ -7,22 +7,29 @@
 #include <cstring>
 #include <map>
 #include <mutex>
-#include <shared_mutex>
 #include <arpa/inet.h>
 #include <thread>
 #include <jsoncpp/json/json.h>
-#include <algorithm>  // Required for std::all_of
-#include <cctype>  
+#include <algorithm>
+#include "../common/reactor.h"
+#include "../common/wire.h"
+#include "../common/journal.h"
+#include "../common/timingwheel.h"
+#include "../common/registry.h"
+#include "../common/peerlist.h"
 
 #define SHARED_MEMORY_NAME "p2p_shared_memory"
 #define SHARED_MEMORY_SIZE 4096
 #define PARTITION_SIZE 512
 #define SERVER_PORT 8080
+#define REGISTRY_WORKERS 4 // Threads running commands behind the event loops
+#define HEARTBEAT_TIMEOUT_MS (3 * WIRE_HEARTBEAT_INTERVAL_MS) // Missed heartbeats before a client is dropped
 
-std::mutex mem_lock;
-std::shared_mutex client_map_lock;
-std::map<int, std::string> client_data; // Stores ID -> IP mapping
-std::map<int, int> client_partitions;   // Stores ID -> Partition
+ShardedRegistry<std::string> client_data; // Stores ID -> IP mapping
+ShardedRegistry<int> client_partitions;   // Stores ID -> Partition
+RegistryJournal journal;                // Persists client_data
+TimingWheel liveness;                   // Heartbeat deadline per registered client
+PeerListCache peer_list;                // Versioned ids of client_data, served as deltas or pages
 
 void logMessage(const std::string &message)
 {
@@ -33,237 +40,271 @@ void logMessage(const std::string &message)
     }
 }
 
-// Load existing clients from a file
+void resetPeerList(const std::map<int, std::string> &clients)
+{
+    std::vector<int32_t> ids;
+    ids.reserve(clients.size());
+    for (const auto &entry : clients)
+        ids.push_back(entry.first);
+    peer_list.reset(std::move(ids));
+}
+
+// Rebuild client_data from the snapshot and journal. On first start an
+// existing clients.json is imported and snapshotted once.
 void loadClientData()
 {
+    std::map<int, std::string> recovered_data;
+    bool recovered = journal.open(".", [&](const JournalRecord &record) {
+        if (record.op == JOURNAL_PUT)
+            recovered_data[record.id] = record.value;
+        else
+            recovered_data.erase(record.id);
+    });
+    if (recovered)
+    {
+        client_data.assign(recovered_data);
+        resetPeerList(recovered_data);
+        return;
+    }
+
     std::ifstream file("clients.json");
     if (!file.is_open()) return;
 
     Json::Value root;
     file >> root;
-    
+
+    std::vector<JournalRecord> records;
     for (const auto &id : root.getMemberNames())
     {
         int client_id = std::stoi(id);
-        client_data[client_id] = root[id].asString();
-
-        // Recalculate partition assignment
-        // int partition_index = client_id % (SHARED_MEMORY_SIZE / PARTITION_SIZE);
-        // client_partitions[client_id] = partition_index;
+        recovered_data[client_id] = root[id].asString();
+        records.push_back({JOURNAL_PUT, client_id, recovered_data[client_id]});
     }
+    client_data.assign(recovered_data);
+    resetPeerList(recovered_data);
+    journal.write_snapshot(journal.rotate(), records);
+    logMessage("[Server] Imported " + std::to_string(records.size()) + " clients from clients.json");
 }
 
-
-// Save clients to a file
-void saveClientData()
+// Snapshot the registry in the background once the journal has grown enough
+void compactClientData()
 {
-    Json::Value root;
-    for (const auto &[id, ip] : client_data)
+    while (true)
     {
-        root[std::to_string(id)] = ip;
-    }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        if (journal.bytes_since_snapshot() < JOURNAL_COMPACT_BYTES)
+            continue;
 
-    std::ofstream file("clients.json");
-    file << root;
+        std::vector<JournalRecord> records;
+        uint64_t generation;
+        // Stopping writes gives a cut that matches the journal rotation; readers carry on
+        client_data.with_writes_stopped([&] {
+            records.reserve(client_data.size());
+            client_data.for_each([&](int id, const std::string &ip) { records.push_back({JOURNAL_PUT, id, ip}); });
+            generation = journal.rotate();
+        });
+        if (journal.write_snapshot(generation, records))
+            logMessage("[Server] Snapshot of " + std::to_string(records.size()) + " clients written");
+    }
 }
 
-// Remove inactive clients by pinging them
-void cleanInactiveClients()
+// Drop clients whose heartbeats stopped. The wheel hands back the expired
+// ids; each erase holds one registry shard only for the update itself.
+void expireInactiveClients()
 {
+    std::vector<int> expired;
     while (true)
     {
-        std::this_thread::sleep_for(std::chrono::seconds(30));
+        std::this_thread::sleep_for(std::chrono::milliseconds(WHEEL_TICK_MS));
+        expired.clear();
+        liveness.advance(expired);
+        if (expired.empty())
+            continue;
 
-        std::lock_guard<std::shared_mutex> lock(client_map_lock);
-        for (auto it = client_data.begin(); it != client_data.end();)
+        std::vector<int> removed;
+        uint64_t sequence = 0;
+        for (int id : expired)
         {
-            std::string command = "ping -c 1 " + it->second + " > /dev/null 2>&1";
-            if (system(command.c_str()) != 0) // If unreachable, remove
-            {
-                logMessage("[Server] Removing inactive client: " + std::to_string(it->first));
-                client_partitions.erase(it->first);
-                it = client_data.erase(it);
-            }
-            else
-            {
-                ++it;
-            }
+            if (!client_data.erase(id, [&] {
+                    sequence = journal.append(JOURNAL_ERASE, id);
+                    peer_list.remove(id);
+                }))
+                continue;
+            client_partitions.erase(id);
+            removed.push_back(id);
         }
-        saveClientData();
+        journal.wait(sequence);
+        for (int id : removed)
+            logMessage("[Server] Removing inactive client: " + std::to_string(id));
     }
 }
 
-void handle_client(int client_sock)
+// Run one request frame from `session`, leaving the response frame in `reply`
+void handle_command(Session &session, const std::string &frame, std::string &reply)
 {
-    struct sockaddr_in client_addr;
-    socklen_t addr_size = sizeof(client_addr);
-    getpeername(client_sock, (struct sockaddr *)&client_addr, &addr_size);
-    std::string client_ip = inet_ntoa(client_addr.sin_addr);
-
-    char buffer[256] = {0};
-    int client_id = -1;
+    const std::string &client_ip = session.ip;
+    WireHeader request;
+    wire_decode_header(frame.data(), request);
+    WireReader body(frame.data() + WIRE_HEADER_SIZE, request.length);
+    int32_t client_id = body.i32();
 
-    while (true)
+    if (!body.ok())
     {
-        memset(buffer, 0, sizeof(buffer));
-        int bytes_received = recv(client_sock, buffer, sizeof(buffer) - 1, 0);
-
-        if (bytes_received <= 0)
-        {
-            logMessage("[Server] Client unexpectedly disconnected.");
-            close(client_sock);
-            return;
-        }
-
-        buffer[bytes_received] = '\0';
-        std::string command(buffer);
+        reply = WireWriter(request.opcode, request.request_id, WIRE_BAD_REQUEST).finish();
+        return;
+    }
 
-        if (command.find("register") == 0)
+    switch (request.opcode)
+    {
+    case OP_REGISTER:
+        if (client_id != -1)
         {
-            if (command.size() > 9)  // Ensure the string is long enough
+            std::string registered_ip;
+            if (client_data.find(client_id, registered_ip) && registered_ip == client_ip)
             {
-                std::string requested_id = command.substr(9);
-                if (!requested_id.empty() && std::all_of(requested_id.begin(), requested_id.end(), ::isdigit))
-                    {
-                    int client_id = std::stoi(requested_id);
-                    if (client_data.count(client_id) && client_data[client_id] == client_ip)
-                    {
-                        logMessage("[Server] Welcome back Client " + std::to_string(client_id));
-                        int partition_index = client_id % (SHARED_MEMORY_SIZE / PARTITION_SIZE);
-                        client_partitions[client_id] = partition_index;
-                        
-                        for (const auto &[id, partition] : client_partitions) {
-                            std::cerr << "[" << id << " -> " << partition << "] ";
-                        }
-                        std::cerr << std::endl;
-                        send(client_sock, ("Welcome back! Your ID: " + std::to_string(client_id)).c_str(), 50, 0);
-                    }
-                    else
-                    {
-                        logMessage("[Server] Invalid ID request.");
-                        send(client_sock, "Invalid ID!", 11, 0);
-                        continue;
-                    }
-                }
-               
+                int partition_index = client_id % (SHARED_MEMORY_SIZE / PARTITION_SIZE);
+                client_partitions.put(client_id, partition_index);
+                logMessage("[Server] Welcome back Client " + std::to_string(client_id) + " -> partition " +
+                           std::to_string(partition_index));
+                session.client_id = client_id;
+                liveness.touch(client_id, HEARTBEAT_TIMEOUT_MS);
+                reply = WireWriter(OP_REGISTER, request.request_id).i32(client_id).finish();
             }
-            
             else
             {
-                std::lock_guard<std::mutex> lock(mem_lock);
-                client_id = client_data.size() + 1;
-                int partition_index = client_id % (SHARED_MEMORY_SIZE / PARTITION_SIZE);
-                client_partitions[client_id] = partition_index;
-                client_data[client_id] = client_ip;
-                saveClientData();
-
-                logMessage("[Server] Assigned Client ID: " + std::to_string(client_id));
-                send(client_sock, std::to_string(client_id).c_str(), 50, 0);
+                logMessage("[Server] Invalid ID request.");
+                reply = WireWriter(OP_REGISTER, request.request_id, WIRE_INVALID_ID).finish();
             }
         }
-        else if (command.find("peerlist") == 0)
+        else
         {
-            if (command.size() > 9)  // Ensure the string is long enough
-            {
-                std::string requested_id = command.substr(9);
-                int client_id = std::stoi(requested_id);
-                if (client_id == -1)
-                {
-                    logMessage("[Server] Unregistered client requested peer list.");
-                    std::string mess = "Seems like you are unregistered";
-                    send(client_sock,mess.c_str() , mess.size(), 0);
-                    continue;
-                }
-
-                std::string peer_list = "[";
-                std::shared_lock<std::shared_mutex> lock(client_map_lock);
-                for (const auto &[id, _] : client_data)
-                {
-                    if (id != client_id)
-                        peer_list += std::to_string(id) + ",";
-                }
-                if (peer_list.back() == ',')
-                    peer_list.pop_back();
-                peer_list += "]";
-
-                send(client_sock, peer_list.c_str(), peer_list.size(), 0);
-            }
-            else {
-                logMessage("[Server] Invalid ID request.");
-                send(client_sock, "Invalid ID!", 11, 0);
-                continue;
-            }
+            uint64_t sequence;
+            client_id = client_data.next_id();
+            client_partitions.put(client_id, client_id % (SHARED_MEMORY_SIZE / PARTITION_SIZE));
+            client_data.put(client_id, client_ip, [&] {
+                sequence = journal.append(JOURNAL_PUT, client_id, client_ip);
+                peer_list.add(client_id);
+            });
+            // Reply only once the registration is on disk
+            journal.wait(sequence);
+            liveness.touch(client_id, HEARTBEAT_TIMEOUT_MS);
+
+            logMessage("[Server] Assigned Client ID: " + std::to_string(client_id));
+            session.client_id = client_id;
+            reply = WireWriter(OP_REGISTER, request.request_id).i32(client_id).finish();
         }
-        else if (command.find("connect") == 0)
+        break;
+
+    case OP_PEERLIST:
+    {
+        if (client_id == -1)
         {
-            std::string target_id_str = command.substr(8);
-            if (!target_id_str.empty() && std::all_of(target_id_str.begin(), target_id_str.end(), ::isdigit))
-            {
-                int target_id = std::stoi(target_id_str);
-                std::shared_lock<std::shared_mutex> lock(client_map_lock);
-                if (client_data.count(target_id))
-                {
-                    std::string target_ip = client_data[target_id];
-                    std::string response = "Connect to: " + target_ip + ":" + std::to_string(SERVER_PORT);
-                    send(client_sock, response.c_str(), response.size(), 0);
-                }
-                else
-                {
-                    std::string error_msg = "Client ID not found.";
-                    send(client_sock, error_msg.c_str(), error_msg.size(), 0);
-                }
-            }
-            else
-            {
-                std::string error_msg = "Invalid client ID format.";
-                send(client_sock, error_msg.c_str(), error_msg.size(), 0);
-            }
+            logMessage("[Server] Unregistered client requested peer list.");
+            reply = WireWriter(OP_PEERLIST, request.request_id, WIRE_UNREGISTERED).finish();
+            break;
+        }
+
+        // Older clients send the id alone and get the first page
+        uint64_t known_version = body.u64();
+        int32_t after = body.i32();
+        if (!body.ok())
+        {
+            known_version = 0;
+            after = 0;
         }
-        else if (command.find("disconnect") == 0)
+
+        // A client that is up to date pays only for the changes since its version
+        std::vector<int32_t> added, removed;
+        uint64_t version;
+        if (known_version != 0 && after == 0 &&
+            peer_list.delta(known_version, WIRE_PEERLIST_PAGE, added, removed, version))
         {
-            std::string requested_id = command.substr(11);
-            int client_id = std::stoi(requested_id);
-            logMessage("[Server] Client " + std::to_string(client_id) + " disconnected.");
-            std::lock_guard<std::shared_mutex> lock(client_map_lock);
-            client_partitions.erase(client_id);
-            saveClientData();
-            close(client_sock);
-            return;
+            WireWriter delta(OP_PEERLIST, request.request_id);
+            delta.u8(PEERLIST_DELTA).u64(version).u32(added.size());
+            for (int32_t id : added)
+                delta.i32(id);
+            delta.u32(removed.size());
+            for (int32_t id : removed)
+                delta.i32(id);
+            reply = delta.finish();
+            break;
         }
+
+        // Everyone else pages through the pre-serialised snapshot
+        std::shared_ptr<const PeerListSnapshot> snapshot = peer_list.snapshot();
+        uint32_t total = snapshot->ids.size();
+        uint32_t start = std::upper_bound(snapshot->ids.begin(), snapshot->ids.end(), after) - snapshot->ids.begin();
+        uint32_t count = std::min<uint32_t>(total - start, WIRE_PEERLIST_PAGE);
+        reply = WireWriter(OP_PEERLIST, request.request_id)
+                    .u8(PEERLIST_PAGE)
+                    .u64(snapshot->version)
+                    .u32(total)
+                    .u32(total - start - count)
+                    .u32(count)
+                    .raw(snapshot->encoded.data() + start * 4, count * 4)
+                    .finish();
+        break;
     }
-}
 
-void server()
-{
-    loadClientData();
-    std::thread(cleanInactiveClients).detach();
+    case OP_CONNECT:
+    {
+        std::string target_ip;
+        if (client_data.find(client_id, target_ip))
+            reply = WireWriter(OP_CONNECT, request.request_id).address(target_ip, SERVER_PORT).finish();
+        else
+            reply = WireWriter(OP_CONNECT, request.request_id, WIRE_NOT_FOUND).finish();
+        break;
+    }
+
+    case OP_DISCONNECT:
+    {
+        logMessage("[Server] Client " + std::to_string(client_id) + " disconnected.");
+        client_partitions.erase(client_id);
+        session.close_after_reply = true;
+        reply = WireWriter(OP_DISCONNECT, request.request_id).finish();
+        break;
+    }
 
-    int server_fd, client_sock;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t addr_size = sizeof(client_addr);
+    case OP_HEARTBEAT:
+        // Only the connection that registered an id keeps it alive; no reply
+        if (client_id == session.client_id)
+            liveness.touch(client_id, HEARTBEAT_TIMEOUT_MS);
+        break;
+
+    default:
+        reply = WireWriter(request.opcode, request.request_id, WIRE_BAD_REQUEST).finish();
+        break;
+    }
+}
 
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+void handle_close(Session &session)
+{
+    if (!session.close_after_reply)
+        logMessage("[Server] Client unexpectedly disconnected.");
+}
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(SERVER_PORT);
+// `threaded` keeps the old thread-per-client model around for comparison
+void server(bool threaded)
+{
+    loadClientData();
+    // Recovered clients get one timeout to come back and heartbeat
+    client_data.for_each([](int id, const std::string &) { liveness.touch(id, HEARTBEAT_TIMEOUT_MS); });
+    std::thread(expireInactiveClients).detach();
+    std::thread(compactClientData).detach();
 
-    bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
-    listen(server_fd, 5);
+    ReactorHandlers handlers{frame_wire, handle_command, handle_close};
+    int cores = std::max(1u, std::thread::hardware_concurrency());
 
-    logMessage("[Server] Initialized, listening on port " + std::to_string(SERVER_PORT));
+    logMessage("[Server] Initialized, listening on port " + std::to_string(SERVER_PORT) +
+               (threaded ? " (thread per client)" : " (" + std::to_string(cores) + " event loops)"));
 
-    while (true)
+    if (threaded)
     {
-        client_sock = accept(server_fd, (struct sockaddr *)&client_addr, &addr_size);
-        if (client_sock >= 0)
-        {
-            std::thread(handle_client, client_sock).detach();
-        }
+        serve_thread_per_client(SERVER_PORT, handlers);
+        return;
     }
+    Reactor reactor(handlers);
+    reactor.run(SERVER_PORT, cores, REGISTRY_WORKERS);
 }
 
 
@@ -271,14 +312,14 @@ int main(int argc, char *argv[])
 {
     if (argc < 2)
     {
-        std::cerr << "Usage: " << argv[0] << " <server>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " server [threaded]" << std::endl;
         return 1;
     }
 
     std::string mode = argv[1];
     if (mode == "server")
     {
-        server();
+        server(argc > 2 && std::string(argv[2]) == "threaded");
     }
     else
     {
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+#include "../common/peerlist.h"
+
+// Checks PeerListCache against a plain std::set of ids: snapshots after
+// churn, deltas applied on top of an older snapshot, and the change log
+// staying bounded for clients that only ever ask for deltas. Prints each
+// check and exits non-zero if any fails. Run:
+//
+//   ./peerlistcheck
+
+int failures = 0;
+
+void check(bool ok, const std::string &what)
+{
+    std::cout << (ok ? "[Check] ok   " : "[Check] FAIL ") << what << std::endl;
+    failures += !ok;
+}
+
+bool matches(PeerListCache &cache, const std::set<int32_t> &expected)
+{
+    auto snapshot = cache.snapshot();
+    return std::vector<int32_t>(expected.begin(), expected.end()) == snapshot->ids &&
+           snapshot->encoded.size() == snapshot->ids.size() * 4;
+}
+
+int main()
+{
+    {
+        PeerListCache cache;
+        std::set<int32_t> expected = {1, 2, 3};
+        for (int32_t id : expected)
+            cache.add(id);
+        check(matches(cache, expected), "snapshot after adds");
+
+        // A client that expires and registers again before the next rebuild
+        cache.remove(2);
+        cache.add(2);
+        check(matches(cache, expected), "remove then re-add keeps the id");
+
+        cache.add(4);
+        cache.remove(4);
+        check(matches(cache, expected), "add then remove leaves no trace");
+
+        cache.remove(1);
+        cache.add(1);
+        cache.remove(1);
+        expected.erase(1);
+        check(matches(cache, expected), "remove, re-add, remove drops the id");
+    }
+
+    {
+        // Deltas since an old snapshot bring its ids up to date
+        PeerListCache cache;
+        std::set<int32_t> expected;
+        for (int32_t id = 0; id < 100; id++)
+        {
+            cache.add(id);
+            expected.insert(id);
+        }
+        auto old = cache.snapshot();
+        for (int32_t id = 0; id < 100; id += 3)
+        {
+            cache.remove(id);
+            if (id % 2)
+                cache.add(id);
+            else
+                expected.erase(id);
+        }
+        std::vector<int32_t> added, removed;
+        uint64_t version;
+        bool ok = cache.delta(old->version, PEERLIST_LOG_SIZE, added, removed, version);
+        std::set<int32_t> applied(old->ids.begin(), old->ids.end());
+        for (int32_t id : removed)
+            applied.erase(id);
+        applied.insert(added.begin(), added.end());
+        check(ok && applied == expected, "delta on top of an older snapshot");
+        check(matches(cache, expected), "snapshot agrees with the delta");
+    }
+
+    {
+        // Delta-only churn: the log must be trimmed without anyone asking
+        // for a snapshot, so a delta from the start is no longer served
+        PeerListCache cache;
+        uint64_t start = cache.snapshot()->version;
+        for (int i = 0; i < 3 * PEERLIST_LOG_SIZE; i++)
+            i % 2 ? cache.remove(i / 2) : cache.add(i / 2);
+        std::vector<int32_t> added, removed;
+        uint64_t version;
+        check(!cache.delta(start, SIZE_MAX, added, removed, version), "change log stays bounded");
+        check(version == start + 3 * PEERLIST_LOG_SIZE, "every change counted");
+        check(matches(cache, {}), "snapshot after the log was trimmed");
+    }
+
+    std::cout << (failures ? "[Check] " + std::to_string(failures) + " failed" : "[Check] All passed") << std::endl;
+    return failures ? 1 : 0;
+}
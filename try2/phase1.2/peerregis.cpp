@@ -1,4 +1,12 @@
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
@@ -10,40 +18,281 @@ namespace http = boost::beast::http;
 
 #define DISCOVERY_SERVER "localhost"
 #define DISCOVERY_PORT "8080"
+#define DISCOVERY_POOL_SIZE 4      // Keep-alive connections kept open to the discovery server
+#define DISCOVERY_PIPELINE_DEPTH 8 // Requests queued on one connection before another is opened
+#define DISCOVERY_TIMEOUT std::chrono::seconds(5)
 
-// Function to send an HTTP POST request
-bool registerPeer(io_context &ioc, const std::string &id, const std::string &ip, const std::string &port)
+using DiscoveryRequest = http::request<http::string_body>;
+using DiscoveryResponse = http::response<http::string_body>;
+
+// Asynchronous HTTP/1.1 client for the discovery server. The address is
+// resolved once and cached. Connections are kept alive in a small pool, and
+// requests are pipelined on them: each request is written as soon as the
+// previous write finishes, and responses are matched up in order. Only
+// idempotent calls (GET and friends) are pipelined; a POST goes out alone
+// on an idle connection, so a broken connection never leaves it unclear
+// whether the server saw it. A call that fails on a connection the server
+// has quietly dropped is retried on a fresh one if it never went out, or
+// once if it is idempotent; a POST that went out reports the error.
+// Everything runs on one strand of the shared io_context.
+class DiscoveryClient
 {
-    try
+public:
+    using Callback = std::function<void(error_code, DiscoveryResponse)>;
+
+    DiscoveryClient(io_context &ioc, std::string host, std::string port)
+        : strand_(make_strand(ioc)), resolver_(strand_), host_(std::move(host)), port_(std::move(port))
+    {
+    }
+
+    // Safe to call from any thread; `done` runs on the io_context
+    void async_request(DiscoveryRequest request, Callback done)
+    {
+        request.set(http::field::host, host_);
+        request.keep_alive(true);
+        request.prepare_payload();
+        auto call = std::make_shared<Call>(Call{std::move(request), std::move(done)});
+        post(strand_, [this, call] { dispatch(call); });
+    }
+
+    std::future<DiscoveryResponse> request(DiscoveryRequest request)
+    {
+        auto promise = std::make_shared<std::promise<DiscoveryResponse>>();
+        async_request(std::move(request), [promise](error_code ec, DiscoveryResponse response) {
+            if (ec)
+                promise->set_exception(std::make_exception_ptr(system_error(ec)));
+            else
+                promise->set_value(std::move(response));
+        });
+        return promise->get_future();
+    }
+
+private:
+    struct Call
+    {
+        DiscoveryRequest request;
+        Callback done;
+        bool sent = false; // Written, at least in part, so the server may have acted on it
+        bool retried = false;
+
+        bool idempotent() const
+        {
+            http::verb method = request.method();
+            return method == http::verb::get || method == http::verb::head || method == http::verb::put ||
+                   method == http::verb::delete_ || method == http::verb::options;
+        }
+    };
+
+    struct Connection
     {
-        ip::tcp::resolver resolver(ioc);
-        ip::tcp::socket socket(ioc);
+        explicit Connection(strand<io_context::executor_type> &executor) : stream(executor) {}
 
-        auto endpoints = resolver.resolve(DISCOVERY_SERVER, DISCOVERY_PORT);
-        connect(socket, endpoints);
+        tcp_stream stream;
+        flat_buffer buffer;
+        std::deque<std::shared_ptr<Call>> to_write; // Not yet on the wire
+        std::deque<std::shared_ptr<Call>> awaiting; // Written, response pending, in order
+        DiscoveryResponse response;
+        bool open = false, writing = false, reading = false;
+
+        size_t load() const { return to_write.size() + awaiting.size(); }
+    };
+    using ConnectionPtr = std::shared_ptr<Connection>;
+
+    void dispatch(std::shared_ptr<Call> call)
+    {
+        if (endpoints_.empty())
+        {
+            unresolved_.push_back(call);
+            resolve();
+            return;
+        }
+        ConnectionPtr connection = pick(call->idempotent());
+        connection->to_write.push_back(call);
+        write_next(connection);
+    }
+
+    // Least loaded connection, opening another while that one is already
+    // DISCOVERY_PIPELINE_DEPTH deep, or busy at all for a call that must
+    // not be pipelined, and the pool has room
+    ConnectionPtr pick(bool pipeline)
+    {
+        ConnectionPtr best;
+        for (const ConnectionPtr &connection : pool_)
+        {
+            if (!best || connection->load() < best->load())
+                best = connection;
+        }
+        size_t depth = pipeline ? DISCOVERY_PIPELINE_DEPTH : 1;
+        if (best && (best->load() < depth || pool_.size() >= DISCOVERY_POOL_SIZE))
+            return best;
 
+        auto connection = std::make_shared<Connection>(strand_);
+        pool_.push_back(connection);
+        connection->stream.expires_after(DISCOVERY_TIMEOUT);
+        connection->stream.async_connect(endpoints_, [this, connection](error_code ec, const ip::tcp::endpoint &) {
+            if (ec)
+            {
+                endpoints_ = {}; // The cached address may be stale; resolve again next time
+                fail(connection, ec);
+                return;
+            }
+            connection->open = true;
+            connection->stream.socket().set_option(ip::tcp::no_delay(true)); // Small pipelined requests go out at once
+            write_next(connection);
+        });
+        return connection;
+    }
+
+    void resolve()
+    {
+        if (resolving_)
+            return;
+        resolving_ = true;
+        resolver_.async_resolve(host_, port_, [this](error_code ec, ip::tcp::resolver::results_type results) {
+            resolving_ = false;
+            std::deque<std::shared_ptr<Call>> calls;
+            calls.swap(unresolved_);
+            if (ec)
+            {
+                for (auto &call : calls)
+                    call->done(ec, {});
+                return;
+            }
+            endpoints_ = results;
+            for (auto &call : calls)
+                dispatch(call);
+        });
+    }
+
+    // Writes go out back to back, except that a non-idempotent call has the
+    // connection to itself: it waits for every earlier response, and later
+    // calls wait for its own. Each write also makes sure a read is pending.
+    void write_next(const ConnectionPtr &connection)
+    {
+        if (!connection->open || connection->writing || connection->to_write.empty())
+            return;
+        std::shared_ptr<Call> call = connection->to_write.front();
+        if (!connection->awaiting.empty() && (!call->idempotent() || !connection->awaiting.back()->idempotent()))
+            return;
+        connection->to_write.pop_front();
+        connection->awaiting.push_back(call);
+        call->sent = true;
+        connection->writing = true;
+        connection->stream.expires_after(DISCOVERY_TIMEOUT);
+        http::async_write(connection->stream, call->request, [this, connection, call](error_code ec, size_t) {
+            connection->writing = false;
+            if (ec)
+            {
+                fail(connection, ec);
+                return;
+            }
+            read_next(connection);
+            write_next(connection);
+        });
+    }
+
+    void read_next(const ConnectionPtr &connection)
+    {
+        if (connection->reading || connection->awaiting.empty())
+            return;
+        connection->reading = true;
+        connection->response = {};
+        connection->stream.expires_after(DISCOVERY_TIMEOUT);
+        http::async_read(connection->stream, connection->buffer, connection->response,
+                         [this, connection](error_code ec, size_t) {
+                             connection->reading = false;
+                             if (ec)
+                             {
+                                 fail(connection, ec);
+                                 return;
+                             }
+                             std::shared_ptr<Call> call = connection->awaiting.front();
+                             connection->awaiting.pop_front();
+                             bool keep_alive = connection->response.keep_alive();
+                             call->done({}, std::move(connection->response));
+                             if (!keep_alive)
+                             {
+                                 retire(connection);
+                                 return;
+                             }
+                             read_next(connection);
+                             write_next(connection); // A POST may have been waiting for this
+                         });
+    }
+
+    // The server closed, or the connection broke. Calls still queued on a
+    // connection that was up simply move; the failure is charged to those
+    // that went out. Idempotent calls, and any call whose connection never
+    // opened, get one more try; a POST that went out may have taken effect,
+    // so the caller hears of it.
+    void fail(const ConnectionPtr &connection, error_code ec)
+    {
+        std::deque<std::shared_ptr<Call>> calls = take_calls(connection);
+        for (auto &call : calls)
+        {
+            if (!call->sent && connection->open)
+            {
+                dispatch(call);
+                continue;
+            }
+            if (call->retried || (call->sent && !call->idempotent()))
+            {
+                call->done(ec, {});
+                continue;
+            }
+            call->retried = true;
+            call->sent = false;
+            dispatch(call);
+        }
+    }
+
+    // Server asked to close: queued calls move elsewhere without using up their retry
+    void retire(const ConnectionPtr &connection)
+    {
+        for (auto &call : take_calls(connection))
+            dispatch(call);
+    }
+
+    std::deque<std::shared_ptr<Call>> take_calls(const ConnectionPtr &connection)
+    {
+        pool_.erase(std::remove(pool_.begin(), pool_.end(), connection), pool_.end());
+        error_code ignored;
+        connection->stream.socket().shutdown(ip::tcp::socket::shutdown_both, ignored);
+        connection->stream.close();
+        std::deque<std::shared_ptr<Call>> calls;
+        calls.swap(connection->awaiting);
+        calls.insert(calls.end(), connection->to_write.begin(), connection->to_write.end());
+        connection->to_write.clear();
+        return calls;
+    }
+
+    strand<io_context::executor_type> strand_;
+    ip::tcp::resolver resolver_;
+    std::string host_, port_;
+    ip::tcp::resolver::results_type endpoints_; // Cached resolve, empty until the first one
+    std::deque<std::shared_ptr<Call>> unresolved_;
+    bool resolving_ = false;
+    std::vector<ConnectionPtr> pool_;
+};
+
+// Function to send an HTTP POST request
+bool registerPeer(DiscoveryClient &client, const std::string &id, const std::string &ip, const std::string &port)
+{
+    try
+    {
         // Correctly format JSON using JSONCPP
         Json::Value body;
         body["id"] = id;
         body["ip"] = ip;
         body["port"] = port;
         Json::FastWriter writer;
-        std::string body_str = writer.write(body);
 
-        http::request<http::string_body> req(http::verb::post, "/register", 11);
-        req.set(http::field::host, DISCOVERY_SERVER);
+        DiscoveryRequest req(http::verb::post, "/register", 11);
         req.set(http::field::content_type, "application/json");
-        req.set(http::field::content_length, std::to_string(body_str.size()));
-        req.body() = body_str;
-        req.prepare_payload();
-
-        http::write(socket, req);
-
-        flat_buffer buffer;
-        http::response<http::dynamic_body> res;
-        http::read(socket, buffer, res);
+        req.body() = writer.write(body);
 
-        std::string response_body = boost::beast::buffers_to_string(res.body().data());
+        DiscoveryResponse res = client.request(std::move(req)).get();
+        const std::string &response_body = res.body();
         std::cout << "[Client] Server Response: " << response_body << std::endl;
 
         // Check if response contains a valid client ID
@@ -66,28 +315,14 @@ bool registerPeer(io_context &ioc, const std::string &id, const std::string &ip,
 }
 
 // Function to send an HTTP GET request
-std::string fetchPeers(io_context &ioc)
+std::string fetchPeers(DiscoveryClient &client)
 {
     try
     {
-        ip::tcp::resolver resolver(ioc);
-        ip::tcp::socket socket(ioc);
-
-        auto endpoints = resolver.resolve(DISCOVERY_SERVER, DISCOVERY_PORT);
-        connect(socket, endpoints);
-
-        http::request<http::empty_body> req(http::verb::get, "/peers", 11);
-        req.set(http::field::host, DISCOVERY_SERVER);
-
-        http::write(socket, req);
-
-        flat_buffer buffer;
-        http::response<http::dynamic_body> res;
-        http::read(socket, buffer, res);
-
-        std::string peer_list = boost::beast::buffers_to_string(res.body().data());
+        DiscoveryResponse res = client.request(DiscoveryRequest(http::verb::get, "/peers", 11)).get();
+        std::string peer_list = res.body();
         std::cout << "[Client] Fetched Peers: " << peer_list << std::endl;
-        
+
         return peer_list;
     }
     catch (std::exception &e)
@@ -100,29 +335,39 @@ std::string fetchPeers(io_context &ioc)
 int main()
 {
     io_context ioc;
+    auto work = make_work_guard(ioc);
+    std::thread io_thread([&] { ioc.run(); });
+    DiscoveryClient client(ioc, DISCOVERY_SERVER, DISCOVERY_PORT);
 
     std::string peerId = "peer1";
     std::string peerIp = "192.168.1.100";
     std::string peerPort = "5000";
 
+    int status = 0;
     std::cout << "[Client] Registering peer..." << std::endl;
-    if (registerPeer(ioc, peerId, peerIp, peerPort))
+    if (registerPeer(client, peerId, peerIp, peerPort))
     {
         std::cout << "[Client] Successfully registered with discovery server!" << std::endl;
+
+        // Reuses the connection the registration opened: no resolve, no handshake
+        std::cout << "[Client] Fetching peer list..." << std::endl;
+        auto start = std::chrono::steady_clock::now();
+        std::string peerList = fetchPeers(client);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        if (!peerList.empty())
+            std::cout << "[Client] Peers: " << peerList << " (" << ms << " ms)" << std::endl;
+        else
+            std::cerr << "[Client] No peers found or request failed!" << std::endl;
     }
     else
     {
         std::cerr << "[Client] Registration failed!" << std::endl;
-        return 1;
+        status = 1;
     }
 
-    std::cout << "[Client] Fetching peer list..." << std::endl;
-    std::string peerList = fetchPeers(ioc);
-    
-    if (!peerList.empty())
-        std::cout << "[Client] Peers: " << peerList << std::endl;
-    else
-        std::cerr << "[Client] No peers found or request failed!" << std::endl;
-
-    return 0;
+    work.reset();
+    ioc.stop();
+    io_thread.join();
+    return status;
 }
@@ -0,0 +1,132 @@
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "../common/wire.h"
+
+// Connection storm against the registry: `clients` threads each connect,
+// register, disconnect and start over, while `idle` more connections sit
+// open the whole time like registered peers that are not talking. Start the
+// server in either mode and compare:
+//
+//   ./inter2 server            (epoll reactor)
+//   ./inter2 server threaded   (thread per client)
+//   ./stormbench [clients] [seconds] [idle] [host] [port]
+
+#define SERVER_IP "127.0.0.1"
+#define SERVER_PORT 8080
+
+int connect_to(const std::string &host, int port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &server_addr.sin_addr);
+    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// One connect/register/disconnect cycle, false if any step failed
+bool register_once(const std::string &host, int port)
+{
+    int sock = connect_to(host, port);
+    if (sock < 0)
+        return false;
+
+    std::string pending, body;
+    WireHeader header;
+    bool ok = wire_send(sock, WireWriter(OP_REGISTER, 1).i32(-1).finish()) &&
+              wire_receive(sock, pending, header, body) && header.status == WIRE_OK;
+    if (ok)
+    {
+        WireReader reader(body.data(), body.size());
+        ok = wire_send(sock, WireWriter(OP_DISCONNECT, 2).i32(reader.i32()).finish()) &&
+             wire_receive(sock, pending, header, body);
+    }
+    close(sock);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    int clients = (argc > 1) ? std::stoi(argv[1]) : 64;
+    double seconds = (argc > 2) ? std::stod(argv[2]) : 5;
+    int idle = (argc > 3) ? std::stoi(argv[3]) : 2000;
+    std::string host = (argc > 4) ? argv[4] : SERVER_IP;
+    int port = (argc > 5) ? std::stoi(argv[5]) : SERVER_PORT;
+
+    // Idle peers plus storm sockets need more than the default 1024 descriptors
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    std::vector<int> idle_socks;
+    for (int i = 0; i < idle; i++)
+    {
+        int sock = connect_to(host, port);
+        if (sock < 0)
+        {
+            std::cerr << "[Bench] Only " << i << " idle connections accepted" << std::endl;
+            break;
+        }
+        idle_socks.push_back(sock);
+    }
+
+    std::atomic<bool> running{true};
+    std::atomic<uint64_t> registrations{0}, failures{0};
+    std::mutex latency_lock;
+    std::vector<double> latencies;
+
+    std::vector<std::thread> threads;
+    for (int c = 0; c < clients; c++)
+    {
+        threads.emplace_back([&] {
+            std::vector<double> local;
+            while (running)
+            {
+                auto start = std::chrono::steady_clock::now();
+                if (register_once(host, port))
+                {
+                    registrations++;
+                    local.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+                }
+                else
+                {
+                    failures++;
+                }
+            }
+            std::lock_guard<std::mutex> lock(latency_lock);
+            latencies.insert(latencies.end(), local.begin(), local.end());
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    running = false;
+    for (auto &thread : threads)
+        thread.join();
+    for (int sock : idle_socks)
+        close(sock);
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies.empty() ? 0.0 : latencies[size_t(p * (latencies.size() - 1))]; };
+
+    std::cout << "[Bench] " << clients << " storm clients, " << idle_socks.size() << " idle connections, " << seconds << " s\n";
+    std::cout << "  registrations/s: " << registrations / seconds << "   failed: " << failures << "\n";
+    std::cout << "  connect+register latency p50: " << percentile(0.5) << " us   p99: " << percentile(0.99) << " us\n";
+    return 0;
+}
@@ -2,135 +2,394 @@
 #include <csignal>
 #include <cstring>
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <thread>
 #include <map>
+#include <memory>
+#include <vector>
+#include "../common/wire.h"
+#include "../common/erasurememory.h"
+#include "../common/pagecodec.h"
+#include "../common/pagestore.h"
+#include "../common/replicatedmemory.h"
+#include "../common/stripedmemory.h"
 
 #define SERVER_IP "127.0.0.1"
 #define SERVER_PORT 8080
 #define PROVIDER_PORT 9090  // Default provider port
+#define PROVIDER_CAPACITY (64 << 20) // Bytes of memory offered to gainers
+#define PROVIDER_SENDFILE_MIN 16384  // Smaller reads are copied into the queued replies instead
+#define PROVIDER_REPLY_BATCH 65536   // Queued reply bytes that force a send mid-burst
+#define PROVIDER_LEASE_PAGE 4096     // Granularity of the read leases the provider tracks
 
-int client_id = -1;
+std::atomic<int> client_id{-1};
 int client_socket = -1;
-std::map<int, std::string> peer_memory; // Simulated shared memory for each gainer
+uint32_t next_request_id = 1;
+std::mutex send_lock;    // Heartbeats and requests share the socket
+std::string pending; // Bytes received past the last reply
+PageStore page_store; // Whole pages that arrived packed, shared between regions
 
-void sendToServer(const std::string &message)
+// Provider memory handed out to gainers, addressed by region id. Each
+// region is its own memfd mapping, so pages are only charged once a gainer
+// writes them, freeing hands them straight back, and reads go from the
+// memfd to the socket with sendfile. Whole pages that arrive packed are
+// kept out of the mapping instead: zero pages become holes, and the rest
+// become references into page_store, so identical pages from any gainer
+// sit in memory once. Raw writes expand them back into the mapping.
+struct Region
 {
-    if (send(client_socket, message.c_str(), message.size(), 0) == -1)
+    int fd = -1;
+    char *data = nullptr;
+    uint64_t size = 0;   // As requested
+    uint64_t mapped = 0; // Rounded up to whole pages, what counts against capacity
+    std::mutex pages_lock;
+    std::map<uint64_t, StoredPage *> stored; // Page index -> its shared copy, a hole in the memfd
+
+    ~Region()
     {
-        std::cerr << "[Client] Failed to send data!" << std::endl;
+        for (auto &[page, shared] : stored)
+            page_store.release(shared);
+        if (data)
+            munmap(data, mapped);
+        if (fd != -1)
+            close(fd);
     }
-}
 
-void receiveFromServer()
-{
-    char buffer[1024] = {0};
-    int bytes_received = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-    if (bytes_received > 0)
+    bool has_packed(uint64_t offset, uint64_t length)
     {
-        buffer[bytes_received] = '\0';
-        std::cout << "[Server] " << buffer << std::endl;
+        std::lock_guard<std::mutex> lock(pages_lock);
+        auto it = stored.lower_bound(offset / PACK_PAGE);
+        return length && it != stored.end() && it->first <= (offset + length - 1) / PACK_PAGE;
     }
-    else
+
+    // Copy shared pages in range into the mapping, ahead of raw writes
+    void unpack(uint64_t offset, uint64_t length)
     {
-        std::cerr << "[Client] Server closed the connection!" << std::endl;
+        std::lock_guard<std::mutex> lock(pages_lock);
+        auto it = stored.lower_bound(offset / PACK_PAGE);
+        while (length && it != stored.end() && it->first <= (offset + length - 1) / PACK_PAGE)
+        {
+            it->second->expand(data + it->first * PACK_PAGE);
+            page_store.release(it->second);
+            it = stored.erase(it);
+        }
     }
-}
 
-// Register as a client with the server
-void registerClient()
-{
-    if (client_id != -1)
+    // Bytes of [offset, offset + length) whichever way they are stored
+    void copy_out(uint64_t offset, uint64_t length, char *dest)
     {
-        sendToServer("register " + std::to_string(client_id));
+        std::lock_guard<std::mutex> lock(pages_lock);
+        memcpy(dest, data + offset, length);
+        for (auto it = stored.lower_bound(offset / PACK_PAGE);
+             length && it != stored.end() && it->first <= (offset + length - 1) / PACK_PAGE; ++it)
+        {
+            char page[PACK_PAGE];
+            it->second->expand(page);
+            uint64_t start = std::max(offset, it->first * PACK_PAGE);
+            uint64_t end = std::min(offset + length, (it->first + 1) * PACK_PAGE);
+            memcpy(dest + (start - offset), page + (start - it->first * PACK_PAGE), end - start);
+        }
     }
-    else
+
+    // True if packing [offset, offset + length) could beat the raw bytes
+    bool sparse(uint64_t offset, uint64_t length)
     {
-        sendToServer("register");
+        if (has_packed(offset, length))
+            return true;
+        for (uint64_t done = 0; done < length;)
+        {
+            size_t piece = pack_piece(offset + done, length - done);
+            if (is_zero(data + offset + done, piece))
+                return true;
+            done += piece;
+        }
+        return false;
     }
 
-    char buffer[256] = {0};
-    int bytes_received = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-    if (bytes_received > 0)
+    // Keep one whole page the way it arrived, handing its memory in the
+    // memfd back to the kernel. `expanded` is the page itself, unless zero.
+    void store(uint64_t page, uint8_t kind, const char *bytes, size_t size, const char *expanded)
     {
-        buffer[bytes_received] = '\0';
-        std::string response(buffer);
-
-        if (response.find("Invalid") != std::string::npos)
+        StoredPage *shared = kind == PAGE_ZERO ? nullptr : page_store.intern(expanded, kind, bytes, size);
+        std::lock_guard<std::mutex> lock(pages_lock);
+        auto it = stored.find(page);
+        if (it != stored.end())
         {
-            std::cerr << "[Client] Invalid ID, requesting new one..." << std::endl;
-            sendToServer("register");
-            recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-            buffer[bytes_received] = '\0';
-            client_id = std::stoi(buffer);
-            std::cout << "[Client] Registered with ID: " << client_id << std::endl;
-            return;
+            page_store.release(it->second);
+            stored.erase(it);
         }
+        if (shared)
+            stored[page] = shared;
+        fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, page * PACK_PAGE, PACK_PAGE);
+    }
 
-        if (response.find("Welcome") != std::string::npos)
+    // [offset, offset + length) as pagecodec.h pieces: shared pages in the
+    // form they are kept in, holes and other zero pieces as zero, the rest raw
+    std::string pack(uint64_t offset, uint64_t length)
+    {
+        std::string out;
+        std::lock_guard<std::mutex> lock(pages_lock);
+        for (uint64_t done = 0; done < length;)
         {
-            std::cout << "[Client] Welcome Back From Server: " << buffer << std::endl;
+            uint64_t at = offset + done;
+            size_t piece = pack_piece(at, length - done);
+            auto it = stored.find(at / PACK_PAGE);
+            if (it != stored.end() && piece == PACK_PAGE)
+            {
+                const StoredPage &shared = *it->second;
+                out += char(shared.kind);
+                if (shared.kind == PAGE_LZ)
+                {
+                    out += char(shared.bytes.size() >> 8);
+                    out += char(shared.bytes.size() & 0xff);
+                }
+                out += shared.bytes;
+            }
+            else if (it != stored.end())
+            {
+                char page[PACK_PAGE];
+                it->second->expand(page);
+                out += char(PAGE_RAW);
+                out.append(page + at % PACK_PAGE, piece);
+            }
+            else if (is_zero(data + at, piece))
+            {
+                out += char(PAGE_ZERO);
+            }
+            else
+            {
+                out += char(PAGE_RAW);
+                out.append(data + at, piece);
+            }
+            done += piece;
         }
+        return out;
+    }
+};
+std::map<uint32_t, std::shared_ptr<Region>> regions;
+uint32_t next_region = 1;
+uint64_t allocated_bytes = 0;
+std::mutex memory_lock;  // Guards the three above between gainer threads and load reports
+uint64_t bytes_wanted = 0; // Memory a gainer asks for, 0 for any provider
+int replicas = 1;          // Providers a gainer keeps a copy of each region on
+int parity_shards = 0;     // Erasure coded instead when set: `replicas` data shards plus these
+int stripe_width = 0;      // Striped over this many providers instead when set
+int provider_port = PROVIDER_PORT;
+std::atomic<bool> providing{false};
+std::atomic<uint32_t> active_gainers{0};
+std::atomic<uint32_t> latency_us{0}; // Moving average of command service time
+
+// Send one request frame and wait for its reply
+bool request(const std::string &frame, WireHeader &header, std::string &body)
+{
+    std::unique_lock<std::mutex> lock(send_lock);
+    bool sent = wire_send(client_socket, frame);
+    lock.unlock();
+    if (!sent)
+    {
+        std::cerr << "[Client] Failed to send data!" << std::endl;
+        return false;
+    }
+    if (!wire_receive(client_socket, pending, header, body))
+    {
+        std::cerr << "[Client] Server closed the connection!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+uint64_t freeMemory()
+{
+    std::lock_guard<std::mutex> lock(memory_lock);
+    return PROVIDER_CAPACITY - allocated_bytes;
+}
+
+// How well page_store is sharing pages, printed when it has changed
+void reportDedup(uint64_t &last_references)
+{
+    uint64_t references, pages, held;
+    page_store.stats(references, pages, held);
+    if (references == last_references)
+        return;
+    last_references = references;
+    std::cout << "[Provider] Page store: " << references << " pages held as " << pages << " ("
+              << (pages ? double(references) / pages : 1.0) << "x dedup, " << held / 1024 << " KiB)" << std::endl;
+}
+
+// Keep our registration alive; heartbeats get no reply so they never
+// interleave with the responses request() is waiting for. Providers send
+// their load instead, which the registry uses to place gainers.
+void heartbeat()
+{
+    uint64_t last_references = 0;
+    while (true)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(WIRE_HEARTBEAT_INTERVAL_MS));
+        if (providing)
+            reportDedup(last_references);
+        if (client_id == -1)
+            continue;
+        std::string frame;
+        if (providing)
+            frame = WireWriter(OP_PROVIDER_LOAD, 0)
+                        .i32(client_id)
+                        .u64(freeMemory())
+                        .u32(active_gainers)
+                        .u32(latency_us)
+                        .finish();
         else
-        {
-            client_id = std::stoi(buffer);
-            std::cout << "[Client] Registered with ID: " << client_id << std::endl;
-        }
-        std::cout << "[Client] Ready to connect with peers!" << std::endl;
+            frame = WireWriter(OP_HEARTBEAT, 0).i32(client_id).finish();
+        std::lock_guard<std::mutex> lock(send_lock);
+        wire_send(client_socket, frame);
     }
 }
 
-// Connect to a peer provider and read/write data
-void connectToProvider(const std::string &ip, int port)
+// Register as a client with the server
+void registerClient()
 {
-    int peer_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (peer_socket < 0)
+    WireHeader header;
+    std::string body;
+    if (!request(WireWriter(OP_REGISTER, next_request_id++).i32(client_id).finish(), header, body))
+        return;
+
+    if (header.status == WIRE_INVALID_ID)
+    {
+        std::cerr << "[Client] Invalid ID, requesting new one..." << std::endl;
+        client_id = -1;
+        if (!request(WireWriter(OP_REGISTER, next_request_id++).i32(-1).finish(), header, body))
+            return;
+    }
+    if (header.status != WIRE_OK)
     {
-        std::cerr << "[Gainer] Failed to create socket!" << std::endl;
+        std::cerr << "[Client] " << wire_status_text(header.status) << std::endl;
         return;
     }
 
-    struct sockaddr_in peer_addr;
-    peer_addr.sin_family = AF_INET;
-    peer_addr.sin_port = htons(port);
-    inet_pton(AF_INET, ip.c_str(), &peer_addr.sin_addr);
+    WireReader reader(body.data(), body.size());
+    int assigned_id = reader.i32();
+    if (assigned_id == client_id)
+    {
+        std::cout << "[Client] Welcome Back From Server: Your ID: " << client_id << std::endl;
+    }
+    else
+    {
+        client_id = assigned_id;
+        std::cout << "[Client] Registered with ID: " << client_id << std::endl;
+    }
+    std::cout << "[Client] Ready to connect with peers!" << std::endl;
+}
 
-    if (connect(peer_socket, (struct sockaddr *)&peer_addr, sizeof(peer_addr)) < 0)
+// Use the memory of connected providers through a ReplicatedMemory,
+// ErasureMemory or StripedMemory
+template <typename Memory>
+void gainFrom(Memory &provider, const std::vector<ReplicatedMemory::Address> &addresses)
+{
+    size_t connected = provider.connect(addresses);
+    if (connected < provider.quorum())
     {
-        std::cerr << "[Gainer] Failed to connect to provider!" << std::endl;
+        std::cerr << "[Gainer] Failed to connect to enough providers!" << std::endl;
         return;
     }
 
-    std::cout << "[Gainer] Connected to provider at " << ip << ":" << port << std::endl;
+    for (const auto &address : addresses)
+        std::cout << "[Gainer] Connected to provider at " << address.first << ":" << address.second << std::endl;
+    if (provider.replicas() > 1)
+        std::cout << "[Gainer] " << connected << " of " << provider.replicas() << " providers up, "
+                  << provider.quorum() << " needed" << std::endl;
 
     while (true)
     {
-        std::cout << "\n[1] Read from Provider\n[2] Write to Provider\n[3] Disconnect\nChoice: ";
+        std::cout << "\n[1] Allocate Region\n[2] Write to Region\n[3] Read from Region\n[4] Free Region\n"
+                     "[5] Disconnect\nChoice: ";
         int choice;
-        std::cin >> choice;
-        std::cin.ignore();
+        if (!(std::cin >> choice))
+            choice = 5;
 
+        uint32_t region;
+        uint64_t offset;
+        uint16_t status = WIRE_OK;
         if (choice == 1)
         {
-            send(peer_socket, "READ", 4, 0);
-            char buffer[256] = {0};
-            recv(peer_socket, buffer, sizeof(buffer) - 1, 0);
-            std::cout << "[Provider] Data: " << buffer << std::endl;
+            uint64_t size;
+            std::cout << "Region size in bytes: ";
+            std::cin >> size;
+            if ((status = provider.alloc(size, region)) == WIRE_OK)
+                std::cout << "[Provider] Allocated region " << region << std::endl;
         }
         else if (choice == 2)
         {
             std::string data;
+            std::cout << "Region and offset: ";
+            std::cin >> region >> offset;
+            std::cin.ignore();
             std::cout << "Enter data to write: ";
             std::getline(std::cin, data);
-            send(peer_socket, ("WRITE " + data).c_str(), data.size() + 6, 0);
+            if ((status = provider.write(region, offset, data.data(), data.size())) == WIRE_OK)
+                std::cout << "[Provider] Wrote " << data.size() << " bytes" << std::endl;
+        }
+        else if (choice == 3)
+        {
+            uint32_t length;
+            std::cout << "Region, offset and length: ";
+            std::cin >> region >> offset >> length;
+            std::string data(length, '\0');
+            // Repeat reads of unchanged data are answered from the local cache
+            if ((status = provider.read(region, offset, &data[0], length)) == WIRE_OK)
+                std::cout << "[Provider] Data: " << data << std::endl;
+        }
+        else if (choice == 4)
+        {
+            std::cout << "Region: ";
+            std::cin >> region;
+            if ((status = provider.free(region)) == WIRE_OK)
+                std::cout << "[Provider] Freed region " << region << std::endl;
         }
         else
         {
-            send(peer_socket, "EXIT", 4, 0);
-            close(peer_socket);
+            // The provider frees whatever this connection still holds
+            provider.disconnect();
             std::cout << "[Gainer] Disconnected from provider.\n";
             break;
         }
+
+        if (status == REMOTE_CONNECTION_LOST || provider.live() == 0)
+        {
+            std::cerr << "[Gainer] Lost the connection to the provider!" << std::endl;
+            break;
+        }
+        if (status == REPLICA_NO_QUORUM)
+            std::cerr << "[Gainer] Too few providers left for that" << std::endl;
+        else if (status != WIRE_OK)
+            std::cerr << "[Gainer] " << wire_status_text(status) << std::endl;
+    }
+}
+
+// Connect to peer providers and use their memory: every region copied to
+// each of them, erasure coded across them, or striped across them
+void connectToProvider(const std::vector<ReplicatedMemory::Address> &addresses)
+{
+    if (stripe_width)
+    {
+        StripedMemory provider;
+        gainFrom(provider, addresses);
+    }
+    else if (parity_shards)
+    {
+        ErasureMemory provider(replicas, parity_shards);
+        gainFrom(provider, addresses);
+    }
+    else
+    {
+        ReplicatedMemory provider;
+        gainFrom(provider, addresses);
     }
 }
 
@@ -142,55 +401,767 @@ void requestPeerList()
         std::cerr << "[Client] You must register first!" << std::endl;
         return;
     }
-    sendToServer("peerlist " + std::to_string(client_id));
 
-    char buffer[256] = {0};
-    int bytes_received = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-    if (bytes_received > 0)
+    WireHeader header;
+    std::string body;
+    WireWriter frame(OP_PEERLIST, next_request_id++);
+    int providers_wanted = stripe_width ? stripe_width : replicas + parity_shards;
+    // A striped region needs only its share of the bytes from each provider
+    uint64_t bytes_each = stripe_width ? (bytes_wanted + stripe_width - 1) / stripe_width : bytes_wanted;
+    if (!request(frame.i32(client_id).u64(bytes_each).u8(providers_wanted).finish(), header, body))
+        return;
+    if (header.status == WIRE_NO_PROVIDERS)
+    {
+        std::cout << "[Server] No providers available at the moment.\n";
+        return;
+    }
+    if (header.status != WIRE_OK)
+    {
+        std::cout << "[Server] " << wire_status_text(header.status) << std::endl;
+        return;
+    }
+
+    WireReader reader(body.data(), body.size());
+    std::vector<ReplicatedMemory::Address> addresses;
+    for (size_t i = 0; i < body.size() / 6; i++)
+    {
+        uint16_t port;
+        std::string ip = reader.address(port);
+        addresses.push_back({ip, port});
+    }
+    if (addresses.size() < size_t(providers_wanted))
+        std::cout << "[Server] Only " << addresses.size() << " of " << providers_wanted << " providers available.\n";
+    connectToProvider(addresses);
+}
+
+std::shared_ptr<Region> mapRegion(uint64_t size)
+{
+    static const uint64_t page = sysconf(_SC_PAGESIZE);
+    auto region = std::make_shared<Region>();
+    region->size = size;
+    region->mapped = (size + page - 1) & ~(page - 1);
+    region->fd = memfd_create("provider_region", MFD_CLOEXEC);
+    if (region->fd == -1 || ftruncate(region->fd, region->mapped) == -1)
+        return nullptr;
+    void *data = mmap(0, region->mapped, PROT_READ | PROT_WRITE, MAP_SHARED, region->fd, 0);
+    if (data == MAP_FAILED)
+        return nullptr;
+    region->data = static_cast<char *>(data);
+    return region;
+}
+
+std::shared_ptr<Region> findRegion(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(memory_lock);
+    auto it = regions.find(id);
+    return it == regions.end() ? nullptr : it->second;
+}
+
+// One (region, offset, length) of a batch, with the region looked up
+struct BatchEntry
+{
+    uint32_t region;
+    uint64_t offset;
+    uint32_t length;
+    std::shared_ptr<Region> target; // Null when the access is out of range
+};
+
+// The socket of one gainer connection. Its own replies and invalidations
+// sent by other gainers' threads take turns on it. `open` is cleared under
+// the lock before the socket is closed, so a late invalidation never goes
+// to a reused descriptor.
+struct GainerLink
+{
+    explicit GainerLink(int fd) : fd(fd) {}
+
+    int fd;
+    std::mutex send_lock;
+    bool open = true;
+};
+
+// Gainers holding a leased copy of each (region, page). A write tells every
+// other holder whose lease is still running, and is only acknowledged once
+// they have all dropped their copies (see WriteFence).
+struct Lease
+{
+    std::shared_ptr<GainerLink> holder;
+    std::chrono::steady_clock::time_point expires;
+};
+std::map<std::pair<uint32_t, uint64_t>, std::vector<Lease>> leases;
+std::mutex lease_lock;
+
+// The reply to a write, held back until every gainer told to drop its
+// copies has echoed the OP_INVALIDATE, left, or seen its lease run out.
+// Acks come in on the holders' own connections, so nothing waits: the last
+// of them, or leaseKeeper() at the deadline, sends the reply.
+struct WriteFence
+{
+    uint32_t id = 0; // Request id of the OP_INVALIDATE frames
+    std::shared_ptr<GainerLink> writer;
+    std::vector<std::shared_ptr<GainerLink>> waiting; // Holders yet to acknowledge
+    std::chrono::steady_clock::time_point deadline;   // Latest lease among them
+    std::string reply;
+    bool armed = false; // `reply` is set and goes out once `waiting` is empty
+};
+std::map<uint32_t, std::shared_ptr<WriteFence>> fences;
+uint32_t next_fence = 1;
+std::mutex fence_lock;
+std::condition_variable fence_changed; // A deadline was added, for leaseKeeper()
+
+// Record a lease on the pages of [offset, offset + length). Called before
+// the bytes are copied out, so a write landing in between still sees it.
+void grantLease(const std::shared_ptr<GainerLink> &holder, uint32_t region, uint64_t offset, uint64_t length)
+{
+    if (length == 0)
+        return;
+    auto now = std::chrono::steady_clock::now();
+    Lease lease{holder, now + std::chrono::milliseconds(WIRE_LEASE_MS)};
+    std::lock_guard<std::mutex> lock(lease_lock);
+    for (uint64_t page = offset / PROVIDER_LEASE_PAGE; page <= (offset + length - 1) / PROVIDER_LEASE_PAGE; page++)
     {
-        buffer[bytes_received] = '\0';
-        std::string response(buffer);
+        std::vector<Lease> &holders = leases[{region, page}];
+        holders.erase(std::remove_if(holders.begin(), holders.end(),
+                                     [&](const Lease &old) { return old.holder == holder || old.expires <= now; }),
+                      holders.end());
+        holders.push_back(lease);
+    }
+}
 
-        if (response == "No providers available")
+// [offset, offset + length) of `region` changed: drop its leases and send
+// OP_INVALIDATE to every holder but the writer, whose cache already knows.
+// With a `fence` the holders are added to it (creating it on first need)
+// and asked to acknowledge; without one nobody waits for them.
+void invalidateLeases(const std::shared_ptr<GainerLink> &writer, uint32_t region, uint64_t offset, uint64_t length,
+                      std::shared_ptr<WriteFence> *fence = nullptr)
+{
+    if (length == 0)
+        return;
+    auto now = std::chrono::steady_clock::now();
+    uint64_t last = length > UINT64_MAX - offset ? UINT64_MAX : (offset + length - 1) / PROVIDER_LEASE_PAGE;
+    std::vector<Lease> stale;
+    {
+        std::lock_guard<std::mutex> lock(lease_lock);
+        auto it = leases.lower_bound({region, offset / PROVIDER_LEASE_PAGE});
+        while (it != leases.end() && it->first.first == region && it->first.second <= last)
         {
-            std::cout << "[Server] No providers available at the moment.\n";
-            return;
+            for (const Lease &lease : it->second)
+            {
+                if (lease.holder == writer || lease.expires <= now)
+                    continue;
+                auto seen = std::find_if(stale.begin(), stale.end(),
+                                         [&](const Lease &other) { return other.holder == lease.holder; });
+                if (seen == stale.end())
+                    stale.push_back(lease);
+                else
+                    seen->expires = std::max(seen->expires, lease.expires);
+            }
+            it = leases.erase(it);
         }
+    }
+    if (stale.empty())
+        return;
 
-        std::string ip = response.substr(0, response.find(':'));
-        int port = std::stoi(response.substr(response.find(':') + 1));
+    uint32_t id = 0;
+    if (fence)
+    {
+        std::lock_guard<std::mutex> lock(fence_lock);
+        if (!*fence)
+        {
+            *fence = std::make_shared<WriteFence>();
+            if (next_fence == 0)
+                next_fence = 1; // 0 means no ack wanted
+            (*fence)->id = next_fence++;
+            (*fence)->writer = writer;
+            (*fence)->deadline = now;
+            fences[(*fence)->id] = *fence;
+        }
+        for (const Lease &lease : stale)
+        {
+            auto &waiting = (*fence)->waiting;
+            if (std::find(waiting.begin(), waiting.end(), lease.holder) == waiting.end())
+                waiting.push_back(lease.holder);
+            (*fence)->deadline = std::max((*fence)->deadline, lease.expires);
+        }
+        id = (*fence)->id;
+        fence_changed.notify_one();
+    }
 
-        connectToProvider(ip, port);
+    std::string frame = WireWriter(OP_INVALIDATE, id).u32(region).u64(offset).u64(length).finish();
+    for (const Lease &lease : stale)
+    {
+        std::lock_guard<std::mutex> lock(lease.holder->send_lock);
+        if (lease.holder->open)
+            wire_send(lease.holder->fd, frame);
     }
 }
 
-// Provider function to handle a single gainer
-void handleGainer(int gainer_socket)
+// Send a released fence's reply on its writer's connection
+void sendFenced(const WriteFence &fence)
 {
-    char buffer[256] = {0};
-    int bytes_received;
+    std::lock_guard<std::mutex> lock(fence.writer->send_lock);
+    if (fence.writer->open)
+        wire_send(fence.writer->fd, fence.reply);
+}
 
-    while ((bytes_received = recv(gainer_socket, buffer, sizeof(buffer) - 1, 0)) > 0)
+// `holder` is done with the copies fence `id` asked about: it acknowledged,
+// or, with id 0, went away and takes its copies out of every fence
+void fenceAcked(uint32_t id, const std::shared_ptr<GainerLink> &holder)
+{
+    std::vector<std::shared_ptr<WriteFence>> released;
     {
-        buffer[bytes_received] = '\0';
-        std::string command(buffer);
+        std::lock_guard<std::mutex> lock(fence_lock);
+        for (auto it = id ? fences.find(id) : fences.begin(); it != fences.end();)
+        {
+            WriteFence &fence = *it->second;
+            fence.waiting.erase(std::remove(fence.waiting.begin(), fence.waiting.end(), holder), fence.waiting.end());
+            if (fence.waiting.empty() && fence.armed)
+            {
+                released.push_back(it->second);
+                it = fences.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+            if (id)
+                break;
+        }
+    }
+    for (const auto &fence : released)
+        sendFenced(*fence);
+}
 
-        if (command == "READ")
+// Release fences whose holders' leases have all run out, and once per lease
+// period forget expired leases on pages nobody wrote, which would otherwise
+// keep departed gainers' links alive
+void leaseKeeper()
+{
+    auto next_sweep = std::chrono::steady_clock::now() + std::chrono::milliseconds(WIRE_LEASE_MS);
+    while (true)
+    {
+        std::vector<std::shared_ptr<WriteFence>> released;
+        auto now = std::chrono::steady_clock::now();
         {
-            send(gainer_socket, peer_memory[client_id].c_str(), peer_memory[client_id].size(), 0);
+            std::unique_lock<std::mutex> lock(fence_lock);
+            auto wake = next_sweep;
+            for (const auto &[id, fence] : fences)
+            {
+                if (!fence->waiting.empty())
+                    wake = std::min(wake, fence->deadline);
+            }
+            fence_changed.wait_until(lock, wake);
+            now = std::chrono::steady_clock::now();
+            for (auto it = fences.begin(); it != fences.end();)
+            {
+                WriteFence &fence = *it->second;
+                if (fence.deadline <= now)
+                    fence.waiting.clear(); // Those copies have expired at their holders too
+                if (fence.waiting.empty() && fence.armed)
+                {
+                    released.push_back(it->second);
+                    it = fences.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
         }
-        else if (command.find("WRITE ") == 0)
+        for (const auto &fence : released)
+            sendFenced(*fence);
+
+        if (now < next_sweep)
+            continue;
+        next_sweep = now + std::chrono::milliseconds(WIRE_LEASE_MS);
+        std::lock_guard<std::mutex> lock(lease_lock);
+        for (auto it = leases.begin(); it != leases.end();)
         {
-            peer_memory[client_id] = command.substr(6);
-            std::cout << "[Provider] Data updated: " << peer_memory[client_id] << std::endl;
+            std::vector<Lease> &holders = it->second;
+            holders.erase(std::remove_if(holders.begin(), holders.end(),
+                                         [&](const Lease &lease) { return lease.expires <= now; }),
+                          holders.end());
+            it = holders.empty() ? leases.erase(it) : std::next(it);
         }
-        else if (command == "EXIT")
+    }
+}
+
+// Drop a region; gainers still reading or writing it keep it alive until
+// they finish, and other gainers' cached copies are invalidated
+bool freeRegion(uint32_t id, const std::shared_ptr<GainerLink> &owner, std::shared_ptr<WriteFence> *fence = nullptr)
+{
+    {
+        std::lock_guard<std::mutex> lock(memory_lock);
+        auto it = regions.find(id);
+        if (it == regions.end())
+            return false;
+        allocated_bytes -= it->second->mapped;
+        regions.erase(it);
+    }
+    invalidateLeases(owner, id, 0, UINT64_MAX, fence);
+    return true;
+}
+
+// Buffered view of one gainer connection. Pipelined requests that arrive
+// together are parsed out of a single recv, and their replies are queued and
+// leave together once the buffered requests run out, so a burst costs a
+// couple of syscalls instead of three per request.
+struct GainerStream
+{
+    explicit GainerStream(int socket) : fd(socket), link(std::make_shared<GainerLink>(socket)) {}
+
+    int fd;
+    std::shared_ptr<GainerLink> link;
+    std::string in;  // Received, unparsed bytes from `pos` on
+    size_t pos = 0;
+    std::string out; // Queued replies
+
+    size_t buffered() const { return in.size() - pos; }
+
+    bool fill()
+    {
+        in.erase(0, pos);
+        pos = 0;
+        char buffer[65536];
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+            return false;
+        in.append(buffer, n);
+        return true;
+    }
+
+    // Exactly `length` bytes into `dest`: what is buffered first, the rest
+    // straight from the socket, so large payloads skip the buffer
+    bool take(void *dest, size_t length)
+    {
+        size_t from_buffer = std::min(length, buffered());
+        memcpy(dest, in.data() + pos, from_buffer);
+        pos += from_buffer;
+        return wire_read_full(fd, static_cast<char *>(dest) + from_buffer, length - from_buffer);
+    }
+
+    bool reply(const std::string &frame, const char *payload = nullptr, size_t length = 0)
+    {
+        out += frame;
+        out.append(payload, length);
+        return out.size() < PROVIDER_REPLY_BATCH || flush();
+    }
+
+    bool flush()
+    {
+        if (out.empty())
+            return true;
+        std::lock_guard<std::mutex> lock(link->send_lock);
+        bool ok = wire_send(fd, out);
+        out.clear();
+        return ok;
+    }
+
+    // Hold while writing to the socket directly
+    std::unique_lock<std::mutex> sending() { return std::unique_lock<std::mutex>(link->send_lock); }
+};
+
+// Queue the reply to a write now, or hand it to its fence if other gainers
+// have yet to drop their copies of what it changed
+bool replyAfter(GainerStream &stream, const std::shared_ptr<WriteFence> &fence, const std::string &reply)
+{
+    if (fence)
+    {
+        std::lock_guard<std::mutex> lock(fence_lock);
+        if (!fence->waiting.empty())
         {
-            std::cout << "[Provider] Gainer disconnected.\n";
-            close(gainer_socket);
-            return;
+            fence->reply = reply;
+            fence->armed = true;
+            return true;
+        }
+        fences.erase(fence->id);
+    }
+    return stream.reply(reply);
+}
+
+// Read a batch's descriptors and resolve every region under a single
+// acquisition of memory_lock. Returns false on a malformed batch.
+bool readBatch(GainerStream &stream, const WireHeader &request, std::vector<BatchEntry> &entries, uint64_t &payload)
+{
+    uint32_t count_be;
+    if (request.length < 4 || !stream.take(&count_be, 4))
+        return false;
+    uint32_t count = ntohl(count_be);
+    if (count > WIRE_BATCH_MAX || request.length < 4 + uint64_t(count) * WIRE_BATCH_ENTRY)
+        return false;
+
+    std::vector<char> descriptors(count * WIRE_BATCH_ENTRY);
+    if (!stream.take(descriptors.data(), descriptors.size()))
+        return false;
+    WireReader reader(descriptors.data(), descriptors.size());
+    entries.resize(count);
+    payload = 0;
+    for (BatchEntry &entry : entries)
+    {
+        entry.region = reader.u32();
+        entry.offset = reader.u64();
+        entry.length = reader.u32();
+        payload += entry.length;
+    }
+
+    std::lock_guard<std::mutex> lock(memory_lock);
+    for (BatchEntry &entry : entries)
+    {
+        auto it = regions.find(entry.region);
+        if (it != regions.end() && entry.offset <= it->second->size &&
+            entry.length <= it->second->size - entry.offset)
+            entry.target = it->second;
+    }
+    return true;
+}
+
+// Many small reads answered with one gather write: the status table, then
+// each payload straight from its region
+bool serveReadBatch(GainerStream &stream, const WireHeader &request)
+{
+    std::vector<BatchEntry> entries;
+    uint64_t requested;
+    if (!readBatch(stream, request, entries, requested) || request.length != 4 + entries.size() * WIRE_BATCH_ENTRY)
+        return false;
+    if (wire_batch_body(entries.size(), requested) > WIRE_MAX_BODY)
+        return stream.reply(WireWriter(OP_READ_BATCH, request.request_id, WIRE_BAD_REQUEST).finish());
+
+    WireWriter reply(OP_READ_BATCH, request.request_id);
+    reply.u32(entries.size());
+    uint64_t payload = 0;
+    std::vector<struct iovec> parts(1);
+    std::deque<std::vector<char>> expanded; // Entries covering packed pages
+    for (const BatchEntry &entry : entries)
+    {
+        reply.u16(entry.target ? WIRE_OK : WIRE_OUT_OF_RANGE);
+        if (entry.target && entry.length)
+        {
+            char *from = entry.target->data + entry.offset;
+            if (entry.target->has_packed(entry.offset, entry.length))
+            {
+                expanded.emplace_back(entry.length);
+                from = expanded.back().data();
+                entry.target->copy_out(entry.offset, entry.length, from);
+            }
+            parts.push_back({from, entry.length});
+            payload += entry.length;
+        }
+    }
+    std::string head = reply.finish(payload);
+    parts[0] = {&head[0], head.size()};
+    if (!stream.flush())
+        return false;
+    auto turn = stream.sending();
+    return wire_send_iov(stream.fd, parts.data(), parts.size());
+}
+
+// Many small writes in one frame: descriptors first, then the payloads in
+// the same order, each landing directly in its region
+bool serveWriteBatch(GainerStream &stream, const WireHeader &request)
+{
+    std::vector<BatchEntry> entries;
+    uint64_t payload;
+    if (!readBatch(stream, request, entries, payload) ||
+        request.length != 4 + entries.size() * WIRE_BATCH_ENTRY + payload)
+        return false;
+
+    WireWriter reply(OP_WRITE_BATCH, request.request_id);
+    reply.u32(entries.size());
+    std::vector<char> discard;
+    std::shared_ptr<WriteFence> fence;
+    for (const BatchEntry &entry : entries)
+    {
+        char *into = entry.target ? entry.target->data + entry.offset : nullptr;
+        if (into)
+        {
+            entry.target->unpack(entry.offset, entry.length);
+        }
+        else
+        {
+            discard.resize(entry.length);
+            into = discard.data();
+        }
+        if (!stream.take(into, entry.length))
+            return false;
+        reply.u16(entry.target ? WIRE_OK : WIRE_OUT_OF_RANGE);
+    }
+    for (const BatchEntry &entry : entries)
+    {
+        if (entry.target)
+            invalidateLeases(stream.link, entry.region, entry.offset, entry.length, &fence);
+    }
+    return replyAfter(stream, fence, reply.finish());
+}
+
+// A read reply: small ones join the queued replies; large ones leave from
+// the memfd without a user-space copy, after whatever is queued. Ranges
+// with packed pages are expanded into a buffer first.
+bool sendRegion(GainerStream &stream, const std::string &header, Region &region, uint64_t offset, uint32_t length)
+{
+    if (region.has_packed(offset, length))
+    {
+        std::vector<char> bytes(length);
+        region.copy_out(offset, length, bytes.data());
+        return stream.reply(header, bytes.data(), length);
+    }
+    if (length < PROVIDER_SENDFILE_MIN)
+        return stream.reply(header, region.data + offset, length);
+    if (!stream.flush())
+        return false;
+    auto turn = stream.sending();
+    return wire_sendfile(stream.fd, header, region.fd, offset, length);
+}
+
+// A read reply as a packed payload. `reply` has the fixed fields; the bytes
+// go raw unless the range holds zero or packed pages and packing is smaller.
+bool sendPacked(GainerStream &stream, WireWriter &reply, Region &region, uint64_t offset, uint32_t length)
+{
+    if (region.sparse(offset, length))
+    {
+        std::string pieces = region.pack(offset, length);
+        if (pieces.size() < length)
+        {
+            std::string header = reply.u8(PAYLOAD_PIECES).finish(pieces.size());
+            return stream.reply(header, pieces.data(), pieces.size());
+        }
+    }
+    return sendRegion(stream, reply.u8(PAYLOAD_RAW).finish(length), region, offset, length);
+}
+
+// A write of pieces (pagecodec.h). Whole pages are kept as they arrive,
+// shared through page_store; partial ones are expanded into the region. The pieces are checked before
+// anything is written, so a malformed frame changes nothing.
+bool serveWritePacked(GainerStream &stream, const WireHeader &request)
+{
+    char fields[16];
+    if (request.length < sizeof(fields) || !stream.take(fields, sizeof(fields)))
+        return false;
+    WireReader reader(fields, sizeof(fields));
+    uint32_t id = reader.u32();
+    uint64_t offset = reader.u64();
+    uint32_t length = reader.u32();
+    std::vector<char> pieces(request.length - sizeof(fields));
+    if (!stream.take(pieces.data(), pieces.size()))
+        return false;
+
+    std::shared_ptr<Region> region = findRegion(id);
+    if (length > WIRE_MAX_PAYLOAD)
+        return stream.reply(WireWriter(OP_WRITE_PACKED, request.request_id, WIRE_BAD_REQUEST).finish());
+    if (!region || offset > region->size || length > region->size - offset)
+        return stream.reply(WireWriter(OP_WRITE_PACKED, request.request_id, WIRE_OUT_OF_RANGE).finish());
+
+    char scratch[PACK_PAGE];
+    bool valid = unpack_pieces(pieces.data(), pieces.size(), offset, length,
+                               [&](uint64_t, size_t piece, uint8_t kind, const char *bytes, size_t size) {
+                                   return kind != PAGE_LZ || unpack_piece(kind, bytes, size, scratch, piece);
+                               });
+    if (!valid)
+        return stream.reply(WireWriter(OP_WRITE_PACKED, request.request_id, WIRE_BAD_REQUEST).finish());
+
+    unpack_pieces(pieces.data(), pieces.size(), offset, length,
+                  [&](uint64_t pos, size_t piece, uint8_t kind, const char *bytes, size_t size) {
+                      if (piece == PACK_PAGE)
+                      {
+                          if (kind == PAGE_LZ)
+                              unpack_piece(kind, bytes, size, scratch, piece);
+                          region->store(pos / PACK_PAGE, kind, bytes, size, kind == PAGE_LZ ? scratch : bytes);
+                          return true;
+                      }
+                      region->unpack(pos, piece);
+                      return unpack_piece(kind, bytes, size, region->data + pos, piece);
+                  });
+    std::shared_ptr<WriteFence> fence;
+    invalidateLeases(stream.link, id, offset, length, &fence);
+    return replyAfter(stream, fence, WireWriter(OP_WRITE_PACKED, request.request_id).finish());
+}
+
+// Serve one request whose header has been read. Returns false when the
+// connection should be dropped.
+bool serveGainerRequest(GainerStream &stream, const WireHeader &request, std::vector<uint32_t> &owned)
+{
+    if (request.opcode == OP_WRITE)
+    {
+        // Fixed fields first, then the payload straight into the region
+        char fields[12];
+        if (request.length < sizeof(fields) || !stream.take(fields, sizeof(fields)))
+            return false;
+        WireReader reader(fields, sizeof(fields));
+        uint32_t id = reader.u32();
+        uint64_t offset = reader.u64();
+        size_t length = request.length - sizeof(fields);
+
+        std::shared_ptr<Region> region = findRegion(id);
+        uint16_t status = WIRE_OK;
+        std::shared_ptr<WriteFence> fence;
+        if (region && offset <= region->size && length <= region->size - offset)
+        {
+            region->unpack(offset, length);
+            if (!stream.take(region->data + offset, length))
+                return false;
+            invalidateLeases(stream.link, id, offset, length, &fence);
+        }
+        else
+        {
+            std::vector<char> discard(length);
+            if (!stream.take(discard.data(), length))
+                return false;
+            status = WIRE_OUT_OF_RANGE;
+        }
+        return replyAfter(stream, fence, WireWriter(OP_WRITE, request.request_id, status).finish());
+    }
+
+    if (request.opcode == OP_READ_BATCH)
+        return serveReadBatch(stream, request);
+    if (request.opcode == OP_WRITE_BATCH)
+        return serveWriteBatch(stream, request);
+    if (request.opcode == OP_WRITE_PACKED)
+        return serveWritePacked(stream, request);
+
+    char body[64];
+    if (request.length > sizeof(body) || !stream.take(body, request.length))
+        return false;
+    WireReader reader(body, request.length);
+
+    switch (request.opcode)
+    {
+    case OP_ALLOC:
+    {
+        uint64_t size = reader.u64();
+        if (!reader.ok() || size == 0)
+            return stream.reply(WireWriter(OP_ALLOC, request.request_id, WIRE_BAD_REQUEST).finish());
+
+        std::shared_ptr<Region> region = size <= PROVIDER_CAPACITY ? mapRegion(size) : nullptr;
+        uint32_t id = 0;
+        {
+            std::lock_guard<std::mutex> lock(memory_lock);
+            if (region && region->mapped <= PROVIDER_CAPACITY - allocated_bytes)
+            {
+                id = next_region++;
+                regions[id] = region;
+                allocated_bytes += region->mapped;
+            }
+        }
+        if (id == 0)
+            return stream.reply(WireWriter(OP_ALLOC, request.request_id, WIRE_NO_MEMORY).finish());
+        owned.push_back(id);
+        std::cout << "[Provider] Allocated region " << id << " of " << size << " bytes\n";
+        return stream.reply(WireWriter(OP_ALLOC, request.request_id).u32(id).finish());
+    }
+
+    case OP_FREE:
+    {
+        // Only the connection that allocated a region may free it; others
+        // can still read and write it if they know the id
+        uint32_t id = reader.u32();
+        auto mine = std::find(owned.begin(), owned.end(), id);
+        std::shared_ptr<WriteFence> fence;
+        bool freed = reader.ok() && mine != owned.end() && freeRegion(id, stream.link, &fence);
+        if (mine != owned.end())
+            owned.erase(mine);
+        return replyAfter(stream, fence,
+                          WireWriter(OP_FREE, request.request_id, freed ? WIRE_OK : WIRE_OUT_OF_RANGE).finish());
+    }
+
+    case OP_READ:
+    {
+        uint32_t id = reader.u32();
+        uint64_t offset = reader.u64();
+        uint32_t length = reader.u32();
+        std::shared_ptr<Region> region = findRegion(id);
+        if (!reader.ok() || length > WIRE_MAX_PAYLOAD)
+            return stream.reply(WireWriter(OP_READ, request.request_id, WIRE_BAD_REQUEST).finish());
+        if (!region || offset > region->size || length > region->size - offset)
+            return stream.reply(WireWriter(OP_READ, request.request_id, WIRE_OUT_OF_RANGE).finish());
+
+        std::string header = WireWriter(OP_READ, request.request_id).finish(length);
+        return sendRegion(stream, header, *region, offset, length);
+    }
+
+    case OP_READ_LEASE:
+    {
+        // Like OP_READ, but the gainer may cache the bytes until the lease
+        // runs out or an OP_INVALIDATE arrives. Whole pages are asked for,
+        // so the last one is cut short at the region's end.
+        uint32_t id = reader.u32();
+        uint64_t offset = reader.u64();
+        uint32_t length = reader.u32();
+        std::shared_ptr<Region> region = findRegion(id);
+        if (!reader.ok() || length > WIRE_MAX_PAYLOAD)
+            return stream.reply(WireWriter(OP_READ_LEASE, request.request_id, WIRE_BAD_REQUEST).finish());
+        if (!region || offset > region->size)
+            return stream.reply(WireWriter(OP_READ_LEASE, request.request_id, WIRE_OUT_OF_RANGE).finish());
+        length = std::min<uint64_t>(length, region->size - offset);
+
+        grantLease(stream.link, id, offset, length);
+        WireWriter reply(OP_READ_LEASE, request.request_id);
+        return sendPacked(stream, reply.u32(WIRE_LEASE_MS).u32(length), *region, offset, length);
+    }
+
+    case OP_READ_PACKED:
+    {
+        uint32_t id = reader.u32();
+        uint64_t offset = reader.u64();
+        uint32_t length = reader.u32();
+        std::shared_ptr<Region> region = findRegion(id);
+        if (!reader.ok() || length > WIRE_MAX_PAYLOAD)
+            return stream.reply(WireWriter(OP_READ_PACKED, request.request_id, WIRE_BAD_REQUEST).finish());
+        if (!region || offset > region->size || length > region->size - offset)
+            return stream.reply(WireWriter(OP_READ_PACKED, request.request_id, WIRE_OUT_OF_RANGE).finish());
+
+        WireWriter reply(OP_READ_PACKED, request.request_id);
+        return sendPacked(stream, reply, *region, offset, length);
+    }
+
+    case OP_INVALIDATE:
+        // The gainer dropped the copies an invalidation asked about; no reply
+        fenceAcked(request.request_id, stream.link);
+        return request.request_id != 0;
+
+    default:
+        return stream.reply(WireWriter(request.opcode, request.request_id, WIRE_BAD_REQUEST).finish());
+    }
+}
+
+// Provider function to handle a single gainer. Regions it allocated are
+// freed when it goes away.
+void handleGainer(int gainer_socket)
+{
+    std::vector<uint32_t> owned;
+    GainerStream stream(gainer_socket);
+    active_gainers++;
+
+    while (true)
+    {
+        // Out of whole requests: answer the ones served so far, then wait
+        if (stream.buffered() < WIRE_HEADER_SIZE)
+        {
+            if (!stream.flush() || !stream.fill())
+                break;
+            continue;
         }
+
+        auto started = std::chrono::steady_clock::now();
+        char head[WIRE_HEADER_SIZE];
+        WireHeader request;
+        stream.take(head, WIRE_HEADER_SIZE);
+        wire_decode_header(head, request);
+        if (request.length > WIRE_MAX_BODY || !serveGainerRequest(stream, request, owned))
+            break;
+
+        // 1/8 weight per sample, enough to follow load without jitter
+        uint32_t sample = std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::steady_clock::now() - started)
+                              .count();
+        latency_us = (latency_us * 7 + sample) / 8;
     }
+
+    for (uint32_t id : owned)
+        freeRegion(id, stream.link);
+    std::cout << "[Provider] Gainer disconnected.\n";
+    fenceAcked(0, stream.link); // Its cached copies are gone with the connection
+    std::lock_guard<std::mutex> lock(stream.link->send_lock);
+    stream.link->open = false;
+    close(gainer_socket);
+    active_gainers--;
 }
 
 // Provider function to accept gainer connections
@@ -202,34 +1173,71 @@ void startProvider()
         return;
     }
 
-    sendToServer("register provider " + std::to_string(PROVIDER_PORT));
+    WireHeader header;
+    std::string body;
+    WireWriter frame(OP_REGISTER_PROVIDER, next_request_id++);
+    if (!request(frame.u16(provider_port).u64(freeMemory()).finish(), header, body))
+        return;
+    if (header.status != WIRE_OK)
+    {
+        std::cerr << "[Client] Provider registration failed: " << wire_status_text(header.status) << std::endl;
+        return;
+    }
 
     int provider_socket = socket(AF_INET, SOCK_STREAM, 0);
     struct sockaddr_in provider_addr;
     provider_addr.sin_family = AF_INET;
-    provider_addr.sin_port = htons(PROVIDER_PORT);
+    provider_addr.sin_port = htons(provider_port);
     provider_addr.sin_addr.s_addr = INADDR_ANY;
 
     bind(provider_socket, (struct sockaddr *)&provider_addr, sizeof(provider_addr));
     listen(provider_socket, 5);
 
-    std::cout << "[Provider] Waiting for gainers on port " << PROVIDER_PORT << "...\n";
+    std::cout << "[Provider] Waiting for gainers on port " << provider_port << "...\n";
+    providing = true;
+    std::thread(leaseKeeper).detach();
 
     while (true)
     {
         int gainer_socket = accept(provider_socket, nullptr, nullptr);
+        if (gainer_socket < 0)
+            continue;
+        int opt = 1;
+        setsockopt(gainer_socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)); // Replies to small ops go out at once
         std::thread(handleGainer, gainer_socket).detach();
     }
 }
 
 void disconnectClient()
 {
-    sendToServer("disconnect " + std::to_string(client_id));
+    WireHeader header;
+    std::string body;
+    request(WireWriter(OP_DISCONNECT, next_request_id++).i32(client_id).finish(), header, body);
     close(client_socket);
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+    // Optional: bytes of provider memory to ask for when gaining, the port
+    // to provide on, and how many providers to copy each gained region to,
+    // "k+m" to erasure code it over k data and m parity providers, or "sN"
+    // to stripe it over N providers for bandwidth
+    bytes_wanted = (argc > 1) ? std::stoull(argv[1]) : 0;
+    provider_port = (argc > 2) ? std::stoi(argv[2]) : PROVIDER_PORT;
+    if (argc > 3)
+    {
+        std::string layout = argv[3];
+        if (layout[0] == 's')
+        {
+            stripe_width = std::stoi(layout.substr(1));
+        }
+        else
+        {
+            size_t plus = layout.find('+');
+            replicas = std::stoi(layout);
+            parity_shards = plus == std::string::npos ? 0 : std::stoi(layout.substr(plus + 1));
+        }
+    }
     signal(SIGINT, [](int) { disconnectClient(); exit(0); });
 
     client_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -238,6 +1246,7 @@ int main()
     server_addr.sin_port = htons(SERVER_PORT);
     inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr);
     connect(client_socket, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    std::thread(heartbeat).detach();
 
     while (true)
     {
@@ -7,23 +7,189 @@
 #include <cstring>
 #include <map>
 #include <mutex>
-#include <shared_mutex>
 #include <arpa/inet.h>
 #include <thread>
 #include <jsoncpp/json/json.h>
-#include <algorithm>  // Required for std::all_of
-#include <cctype>  
+#include <algorithm>
+#include <random>
+#include <set>
+#include <unordered_map>
+#include "../common/reactor.h"
+#include "../common/wire.h"
+#include "../common/journal.h"
+#include "../common/timingwheel.h"
+#include "../common/registry.h"
 
 #define SHARED_MEMORY_NAME "p2p_shared_memory"
 #define SHARED_MEMORY_SIZE 4096
 #define PARTITION_SIZE 512
 #define SERVER_PORT 8080
+#define REGISTRY_WORKERS 4 // Threads running commands behind the event loops
+#define HEARTBEAT_TIMEOUT_MS (3 * WIRE_HEARTBEAT_INTERVAL_MS) // Missed heartbeats before a client is dropped
+#define PROVIDER_LATENCY_FLOOR_US 100 // Keeps idle, unmeasured providers from all scoring zero
 
-std::mutex mem_lock;
-std::shared_mutex client_map_lock;
-std::map<int, std::string> client_data; // Stores ID -> IP mapping
-std::map<int, std::string> provider_data; // Stores ID -> {IP,port} mapping
-std::map<int, int> client_partitions;   // Stores ID -> Partition
+// What a provider last told us about itself, adjusted for the gainers we
+// sent its way since
+struct ProviderLoad
+{
+    std::string ip;
+    uint16_t port = 0;
+    uint64_t free_bytes = 0;
+    uint32_t gainers = 0;
+    uint32_t latency_us = 0;
+};
+
+// Providers with their reported load. Gainers asking for a size get the
+// best fit from a free-memory ordered index; the rest go to the less loaded
+// of two random providers, which spreads load without a global scan or a
+// herd on the single emptiest provider.
+class ProviderTable
+{
+public:
+    void put(int id, const std::string &ip, uint16_t port, uint64_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        auto [it, added] = providers_.try_emplace(id);
+        if (added)
+        {
+            it->second.slot = ids_.size();
+            ids_.push_back(id);
+        }
+        else
+        {
+            by_free_.erase({it->second.load.free_bytes, id});
+        }
+        it->second.load = ProviderLoad{ip, port, capacity, 0, 0};
+        by_free_.insert({capacity, id});
+    }
+
+    void report(int id, uint64_t free_bytes, uint32_t gainers, uint32_t latency_us)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        auto it = providers_.find(id);
+        if (it == providers_.end())
+            return;
+        ProviderLoad &load = it->second.load;
+        by_free_.erase({load.free_bytes, id});
+        load.free_bytes = free_bytes;
+        load.gainers = gainers;
+        load.latency_us = latency_us;
+        by_free_.insert({free_bytes, id});
+    }
+
+    void erase(int id)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        auto it = providers_.find(id);
+        if (it == providers_.end())
+            return;
+        by_free_.erase({it->second.load.free_bytes, id});
+        // Swap-remove keeps ids_ dense for random sampling
+        size_t slot = it->second.slot;
+        ids_[slot] = ids_.back();
+        providers_[ids_[slot]].slot = slot;
+        ids_.pop_back();
+        providers_.erase(it);
+    }
+
+    // Choose a provider for `gainer` other than itself and those in `taken`
+    // (replicas already placed), and count the gainer against it until the
+    // provider's next report corrects the numbers
+    bool pick(int gainer, uint64_t wanted, const std::vector<int> &taken, int &id, ProviderLoad &chosen)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        id = wanted ? best_fit(gainer, wanted, taken) : two_choices(gainer, taken);
+        if (id == -1)
+            return false;
+
+        ProviderLoad &load = providers_[id].load;
+        load.gainers++;
+        if (wanted)
+        {
+            by_free_.erase({load.free_bytes, id});
+            load.free_bytes -= std::min(wanted, load.free_bytes);
+            by_free_.insert({load.free_bytes, id});
+        }
+        chosen = load;
+        return true;
+    }
+
+private:
+    struct Entry
+    {
+        ProviderLoad load;
+        size_t slot; // Index in ids_
+    };
+
+    // Tightest provider that still has `wanted` bytes free
+    int best_fit(int gainer, uint64_t wanted, const std::vector<int> &taken)
+    {
+        for (auto it = by_free_.lower_bound({wanted, INT32_MIN}); it != by_free_.end(); ++it)
+        {
+            if (it->second != gainer && !excluded(it->second, taken))
+                return it->second;
+        }
+        return -1;
+    }
+
+    int two_choices(int gainer, const std::vector<int> &taken)
+    {
+        thread_local std::mt19937 rng{std::random_device{}()};
+        int first = -1;
+        for (int attempt = 0; attempt < 2; attempt++)
+        {
+            int id = sample(gainer, taken, rng);
+            if (id == -1)
+                break;
+            if (first == -1 || cost(id) < cost(first))
+                first = id;
+        }
+        return first;
+    }
+
+    int sample(int gainer, const std::vector<int> &taken, std::mt19937 &rng)
+    {
+        // Ids in `taken` may have expired since they were placed, so only
+        // the ones still registered are off the table
+        size_t count = ids_.size();
+        size_t candidates = count - providers_.count(gainer);
+        for (int id : taken)
+        {
+            if (id != gainer && providers_.count(id))
+                candidates--;
+        }
+        if (candidates == 0)
+            return -1;
+        int id;
+        do
+            id = ids_[std::uniform_int_distribution<size_t>(0, count - 1)(rng)];
+        while (id == gainer || excluded(id, taken));
+        return id;
+    }
+
+    static bool excluded(int id, const std::vector<int> &taken)
+    {
+        return std::find(taken.begin(), taken.end(), id) != taken.end();
+    }
+
+    // Expected wait for one more gainer: queue length times service time
+    uint64_t cost(int id)
+    {
+        const ProviderLoad &load = providers_[id].load;
+        return uint64_t(load.gainers + 1) * std::max<uint32_t>(load.latency_us, PROVIDER_LATENCY_FLOOR_US);
+    }
+
+    std::mutex lock_;
+    std::unordered_map<int, Entry> providers_;
+    std::vector<int> ids_;                          // Dense list for sampling
+    std::set<std::pair<uint64_t, int>> by_free_;    // (free bytes, id), the capacity index
+};
+
+ShardedRegistry<std::string> client_data;   // Stores ID -> IP mapping
+ShardedRegistry<int> client_partitions;     // Stores ID -> Partition
+RegistryJournal journal;                // Persists client_data
+TimingWheel liveness;                   // Heartbeat deadline per registered client
+ProviderTable providers;                // Provider addresses and load, keyed by client id
 
 void logMessage(const std::string &message)
 {
@@ -34,267 +200,280 @@ void logMessage(const std::string &message)
     }
 }
 
-// Load existing clients from a file
+// Rebuild client_data from the snapshot and journal. On first start an
+// existing clients.json is imported and snapshotted once.
 void loadClientData()
 {
+    std::map<int, std::string> recovered_data;
+    bool recovered = journal.open(".", [&](const JournalRecord &record) {
+        if (record.op == JOURNAL_PUT)
+            recovered_data[record.id] = record.value;
+        else
+            recovered_data.erase(record.id);
+    });
+    if (recovered)
+    {
+        client_data.assign(recovered_data);
+        return;
+    }
+
     std::ifstream file("clients.json");
     if (!file.is_open()) return;
 
     Json::Value root;
     file >> root;
-    
+
+    std::vector<JournalRecord> records;
     for (const auto &id : root.getMemberNames())
     {
         int client_id = std::stoi(id);
-        client_data[client_id] = root[id].asString();
-
-        // Recalculate partition assignment
-        // int partition_index = client_id % (SHARED_MEMORY_SIZE / PARTITION_SIZE);
-        // client_partitions[client_id] = partition_index;
+        recovered_data[client_id] = root[id].asString();
+        records.push_back({JOURNAL_PUT, client_id, recovered_data[client_id]});
     }
+    client_data.assign(recovered_data);
+    journal.write_snapshot(journal.rotate(), records);
+    logMessage("[Server] Imported " + std::to_string(records.size()) + " clients from clients.json");
 }
 
-
-// Save clients to a file
-void saveClientData()
+// Snapshot the registry in the background once the journal has grown enough
+void compactClientData()
 {
-    Json::Value root;
-    for (const auto &[id, ip] : client_data)
+    while (true)
     {
-        root[std::to_string(id)] = ip;
-    }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        if (journal.bytes_since_snapshot() < JOURNAL_COMPACT_BYTES)
+            continue;
 
-    std::ofstream file("clients.json");
-    file << root;
+        std::vector<JournalRecord> records;
+        uint64_t generation;
+        // Stopping writes gives a cut that matches the journal rotation; readers carry on
+        client_data.with_writes_stopped([&] {
+            records.reserve(client_data.size());
+            client_data.for_each([&](int id, const std::string &ip) { records.push_back({JOURNAL_PUT, id, ip}); });
+            generation = journal.rotate();
+        });
+        if (journal.write_snapshot(generation, records))
+            logMessage("[Server] Snapshot of " + std::to_string(records.size()) + " clients written");
+    }
 }
 
-// Remove inactive clients by pinging them
-void cleanInactiveClients()
+// Drop clients whose heartbeats stopped. The wheel hands back the expired
+// ids; each erase holds one registry shard only for the update itself.
+void expireInactiveClients()
 {
+    std::vector<int> expired;
     while (true)
     {
-        std::this_thread::sleep_for(std::chrono::seconds(30));
+        std::this_thread::sleep_for(std::chrono::milliseconds(WHEEL_TICK_MS));
+        expired.clear();
+        liveness.advance(expired);
+        if (expired.empty())
+            continue;
 
-        std::lock_guard<std::shared_mutex> lock(client_map_lock);
-        for (auto it = client_data.begin(); it != client_data.end();)
+        std::vector<int> removed;
+        uint64_t sequence = 0;
+        for (int id : expired)
         {
-            std::string command = "ping -c 1 " + it->second + " > /dev/null 2>&1";
-            if (system(command.c_str()) != 0) // If unreachable, remove
-            {
-                logMessage("[Server] Removing inactive client: " + std::to_string(it->first));
-                client_partitions.erase(it->first);
-                it = client_data.erase(it);
-            }
-            else
-            {
-                ++it;
-            }
+            if (!client_data.erase(id, [&] { sequence = journal.append(JOURNAL_ERASE, id); }))
+                continue;
+            client_partitions.erase(id);
+            providers.erase(id);
+            removed.push_back(id);
         }
-        saveClientData();
+        journal.wait(sequence);
+        for (int id : removed)
+            logMessage("[Server] Removing inactive client: " + std::to_string(id));
     }
 }
 
-void handle_client(int client_sock)
+// Run one request frame from `session`, leaving the response frame in `reply`
+void handle_command(Session &session, const std::string &frame, std::string &reply)
 {
-    struct sockaddr_in client_addr;
-    socklen_t addr_size = sizeof(client_addr);
-    getpeername(client_sock, (struct sockaddr *)&client_addr, &addr_size);
-    std::string client_ip = inet_ntoa(client_addr.sin_addr);
-
-    char buffer[256] = {0};
-    int client_id = -1;
+    const std::string &client_ip = session.ip;
+    WireHeader request;
+    wire_decode_header(frame.data(), request);
+    WireReader body(frame.data() + WIRE_HEADER_SIZE, request.length);
 
-    while (true)
+    if (request.opcode == OP_REGISTER_PROVIDER)
     {
-        memset(buffer, 0, sizeof(buffer));
-        int bytes_received = recv(client_sock, buffer, sizeof(buffer) - 1, 0);
-
-        if (bytes_received <= 0)
+        uint16_t provider_port = body.u16();
+        uint64_t capacity = body.u64();
+        if (!body.ok())
+            capacity = 0; // Older providers don't say; they only get size-less gainers
+        if (provider_port == 0)
         {
-            logMessage("[Server] Client unexpectedly disconnected.");
-            close(client_sock);
+            reply = WireWriter(OP_REGISTER_PROVIDER, request.request_id, WIRE_BAD_REQUEST).finish();
             return;
         }
-
-        buffer[bytes_received] = '\0';
-        std::string command(buffer);
-        if (command.find("register provider") == 0)
+        if (session.client_id == -1)
         {
-            std::string provider_port_str = command.substr(18); // Extract the port number
-            if (!provider_port_str.empty() && std::all_of(provider_port_str.begin(), provider_port_str.end(), ::isdigit))
-            {
-                int provider_port = std::stoi(provider_port_str);
-                logMessage("[Server] Registered provider at " + client_ip + ":" + std::to_string(provider_port));
-                
-                // Store provider info in client_data using a negative ID to distinguish from normal clients
-                int provider_id = (provider_data.size() + 1);
-                provider_data[client_id] = client_ip +":"+ std::to_string(provider_port);
-                // saveClientData();
-
-                send(client_sock, "Provider registered successfully", 32, 0);
-            }
-            else
-            {
-                send(client_sock, "Invalid provider registration", 29, 0);
-            }
+            // Nothing to key the provider by until the connection registers
+            reply = WireWriter(OP_REGISTER_PROVIDER, request.request_id, WIRE_UNREGISTERED).finish();
+            return;
         }
-        else if (command.find("register") == 0)
+        logMessage("[Server] Registered provider at " + client_ip + ":" + std::to_string(provider_port));
+
+        // Providers are keyed by the client id the connection registered with
+        providers.put(session.client_id, client_ip, provider_port, capacity);
+        reply = WireWriter(OP_REGISTER_PROVIDER, request.request_id).finish();
+        return;
+    }
+
+    int32_t client_id = body.i32();
+    if (!body.ok())
+    {
+        reply = WireWriter(request.opcode, request.request_id, WIRE_BAD_REQUEST).finish();
+        return;
+    }
+
+    switch (request.opcode)
+    {
+    case OP_REGISTER:
+        if (client_id != -1)
         {
-            if (command.size() > 9)  // Ensure the string is long enough
+            std::string registered_ip;
+            if (client_data.find(client_id, registered_ip) && registered_ip == client_ip)
             {
-                std::string requested_id = command.substr(9);
-                if (!requested_id.empty() && std::all_of(requested_id.begin(), requested_id.end(), ::isdigit))
-                    {
-                    int client_id = std::stoi(requested_id);
-                    if (client_data.count(client_id) && client_data[client_id] == client_ip)
-                    {
-                        logMessage("[Server] Welcome back Client " + std::to_string(client_id));
-                        int partition_index = client_id % (SHARED_MEMORY_SIZE / PARTITION_SIZE);
-                        client_partitions[client_id] = partition_index;
-                        
-                        for (const auto &[id, partition] : client_partitions) {
-                            std::cerr << "[" << id << " -> " << partition << "] ";
-                        }
-                        std::cerr << std::endl;
-                        send(client_sock, ("Welcome back! Your ID: " + std::to_string(client_id)).c_str(), 50, 0);
-                    }
-                    else
-                    {
-                        logMessage("[Server] Invalid ID request.");
-                        send(client_sock, "Invalid ID!", 11, 0);
-                        continue;
-                    }
-                }
-               
+                int partition_index = client_id % (SHARED_MEMORY_SIZE / PARTITION_SIZE);
+                client_partitions.put(client_id, partition_index);
+                logMessage("[Server] Welcome back Client " + std::to_string(client_id) + " -> partition " +
+                           std::to_string(partition_index));
+                session.client_id = client_id;
+                liveness.touch(client_id, HEARTBEAT_TIMEOUT_MS);
+                reply = WireWriter(OP_REGISTER, request.request_id).i32(client_id).finish();
             }
-            
             else
             {
-                std::lock_guard<std::mutex> lock(mem_lock);
-                client_id = client_data.size() + 1;
-                int partition_index = client_id % (SHARED_MEMORY_SIZE / PARTITION_SIZE);
-                client_partitions[client_id] = partition_index;
-                client_data[client_id] = client_ip;
-                saveClientData();
-
-                logMessage("[Server] Assigned Client ID: " + std::to_string(client_id));
-                send(client_sock, std::to_string(client_id).c_str(), 50, 0);
+                logMessage("[Server] Invalid ID request.");
+                reply = WireWriter(OP_REGISTER, request.request_id, WIRE_INVALID_ID).finish();
             }
         }
-        else if (command.find("peerlist") == 0)
+        else
         {
-            if (command.size() > 9)  // Ensure the string is long enough
-            {
-                std::string requested_id = command.substr(9);
-                int client_id = std::stoi(requested_id);
-                if (client_id == -1)
-                {
-                    logMessage("[Server] Unregistered client requested peer list.");
-                    std::string mess = "Seems like you are unregistered";
-                    send(client_sock,mess.c_str() , mess.size(), 0);
-                    continue;
-                }
-                else
-                {
-                    if (provider_data.empty())
-                    {
-                        send(client_sock, "No providers available", 23, 0);
-                    }
-                    else
-                    {
-                        auto first_provider = provider_data.begin();
-                        int first_id = first_provider->first;
-                        std::string first_value = first_provider->second;
-                        
-                        std::cout << "First Provider ID: " << first_id << "\n";
-                        std::cout << "First Provider Data: " << first_value << "\n";
-                        std::string response =  provider_data[first_id];
-                        send(client_sock, response.c_str(), response.size(), 0);
-                    }
-
-                }
-            }
-            else {
-                logMessage("[Server] Invalid ID request.");
-                send(client_sock, "Invalid ID!", 11, 0);
-                continue;
-            }
+            uint64_t sequence;
+            client_id = client_data.next_id();
+            client_partitions.put(client_id, client_id % (SHARED_MEMORY_SIZE / PARTITION_SIZE));
+            client_data.put(client_id, client_ip, [&] { sequence = journal.append(JOURNAL_PUT, client_id, client_ip); });
+            // Reply only once the registration is on disk
+            journal.wait(sequence);
+            liveness.touch(client_id, HEARTBEAT_TIMEOUT_MS);
+
+            logMessage("[Server] Assigned Client ID: " + std::to_string(client_id));
+            session.client_id = client_id;
+            reply = WireWriter(OP_REGISTER, request.request_id).i32(client_id).finish();
         }
-        else if (command.find("connect") == 0)
+        break;
+
+    case OP_PEERLIST:
+    {
+        if (client_id == -1)
         {
-            std::string target_id_str = command.substr(8);
-            if (!target_id_str.empty() && std::all_of(target_id_str.begin(), target_id_str.end(), ::isdigit))
-            {
-                int target_id = std::stoi(target_id_str);
-                std::shared_lock<std::shared_mutex> lock(client_map_lock);
-                if (client_data.count(target_id))
-                {
-                    std::string target_ip = client_data[target_id];
-                    std::string response = "Connect to: " + target_ip + ":" + std::to_string(SERVER_PORT);
-                    send(client_sock, response.c_str(), response.size(), 0);
-                }
-                else
-                {
-                    std::string error_msg = "Client ID not found.";
-                    send(client_sock, error_msg.c_str(), error_msg.size(), 0);
-                }
-            }
-            else
-            {
-                std::string error_msg = "Invalid client ID format.";
-                send(client_sock, error_msg.c_str(), error_msg.size(), 0);
-            }
+            logMessage("[Server] Unregistered client requested peer list.");
+            reply = WireWriter(OP_PEERLIST, request.request_id, WIRE_UNREGISTERED).finish();
+            break;
         }
-        else if (command.find("disconnect") == 0)
+
+        uint64_t wanted = body.u64();
+        if (!body.ok())
+            wanted = 0;
+        uint8_t replicas = body.u8();
+        if (!body.ok() || replicas == 0)
+            replicas = 1;
+
+        // One distinct provider per replica, as many as there are
+        std::vector<int> placed;
+        WireWriter frame(OP_PEERLIST, request.request_id);
+        int provider_id;
+        ProviderLoad provider;
+        while (placed.size() < replicas && providers.pick(client_id, wanted, placed, provider_id, provider))
         {
-            std::string requested_id = command.substr(11);
-            int client_id = std::stoi(requested_id);
-            logMessage("[Server] Client " + std::to_string(client_id) + " disconnected.");
-            std::lock_guard<std::shared_mutex> lock(client_map_lock);
-            client_partitions.erase(client_id);
-            saveClientData();
-            close(client_sock);
-            return;
+            placed.push_back(provider_id);
+            frame.address(provider.ip, provider.port);
+            logMessage("[Server] Client " + std::to_string(client_id) + " -> provider " +
+                       std::to_string(provider_id) + " (" + std::to_string(provider.gainers) + " gainers, " +
+                       std::to_string(provider.free_bytes) + " bytes free)");
         }
+        reply = placed.empty() ? WireWriter(OP_PEERLIST, request.request_id, WIRE_NO_PROVIDERS).finish()
+                               : frame.finish();
+        break;
     }
-}
 
-void server()
-{
-    loadClientData();
-    std::thread(cleanInactiveClients).detach();
+    case OP_CONNECT:
+    {
+        std::string target_ip;
+        if (client_data.find(client_id, target_ip))
+            reply = WireWriter(OP_CONNECT, request.request_id).address(target_ip, SERVER_PORT).finish();
+        else
+            reply = WireWriter(OP_CONNECT, request.request_id, WIRE_NOT_FOUND).finish();
+        break;
+    }
+
+    case OP_DISCONNECT:
+    {
+        logMessage("[Server] Client " + std::to_string(client_id) + " disconnected.");
+        client_partitions.erase(client_id);
+        session.close_after_reply = true;
+        reply = WireWriter(OP_DISCONNECT, request.request_id).finish();
+        break;
+    }
 
-    int server_fd, client_sock;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t addr_size = sizeof(client_addr);
+    case OP_HEARTBEAT:
+        // Only the connection that registered an id keeps it alive; no reply
+        if (client_id == session.client_id)
+            liveness.touch(client_id, HEARTBEAT_TIMEOUT_MS);
+        break;
 
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    case OP_PROVIDER_LOAD:
+    {
+        uint64_t free_bytes = body.u64();
+        uint32_t gainers = body.u32();
+        uint32_t latency_us = body.u32();
+        if (!body.ok() || client_id != session.client_id)
+            break;
+        providers.report(client_id, free_bytes, gainers, latency_us);
+        liveness.touch(client_id, HEARTBEAT_TIMEOUT_MS);
+        break;
+    }
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(SERVER_PORT);
+    default:
+        reply = WireWriter(request.opcode, request.request_id, WIRE_BAD_REQUEST).finish();
+        break;
+    }
+}
 
-    bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
-    listen(server_fd, 5);
+void handle_close(Session &session)
+{
+    if (!session.close_after_reply)
+        logMessage("[Server] Client unexpectedly disconnected.");
+}
 
-    logMessage("[Server] Initialized, listening on port " + std::to_string(SERVER_PORT));
+// `threaded` keeps the old thread-per-client model around for comparison
+void server(bool threaded)
+{
+    loadClientData();
+    // Recovered clients get one timeout to come back and heartbeat
+    client_data.for_each([](int id, const std::string &) { liveness.touch(id, HEARTBEAT_TIMEOUT_MS); });
+    std::thread(expireInactiveClients).detach();
+    std::thread(compactClientData).detach();
 
-    while (true)
+    ReactorHandlers handlers{frame_wire, handle_command, handle_close};
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+
+    logMessage("[Server] Initialized, listening on port " + std::to_string(SERVER_PORT) +
+               (threaded ? " (thread per client)" : " (" + std::to_string(cores) + " event loops)"));
+
+    if (threaded)
     {
-        client_sock = accept(server_fd, (struct sockaddr *)&client_addr, &addr_size);
-        if (client_sock >= 0)
-        {
-            std::thread(handle_client, client_sock).detach();
-        }
+        serve_thread_per_client(SERVER_PORT, handlers);
+        return;
     }
+    Reactor reactor(handlers);
+    reactor.run(SERVER_PORT, cores, REGISTRY_WORKERS);
 }
 
 
-int main()
+int main(int argc, char *argv[])
 {
-    server();
+    server(argc > 1 && std::string(argv[1]) == "threaded");
     return 0;
 }
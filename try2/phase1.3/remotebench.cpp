@@ -0,0 +1,128 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "../common/remotememory.h"
+
+// Small-op throughput against a provider: one request at a time, `depth`
+// requests in flight, `batch` reads per OP_READ_BATCH request sent one at a
+// time, and reads through the gainer's page cache, where only the first
+// pass over the 1024 blocks goes to the provider. Start a provider (peer,
+// then [3]) and run:
+//
+//   ./remotebench [ops] [size] [depth] [batch] [host] [port]
+
+#define PROVIDER_IP "127.0.0.1"
+#define PROVIDER_PORT 9090
+
+// Reads `ops` blocks of `size` bytes, keeping `depth` of them outstanding
+double run(RemoteMemory &provider, uint32_t region, int ops, uint32_t size, int depth)
+{
+    std::vector<char> buffer(size * depth);
+    std::mutex lock;
+    std::condition_variable slot_free;
+    int inflight = 0, failures = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ops; i++)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            slot_free.wait(guard, [&] { return inflight < depth; });
+            inflight++;
+        }
+        // The provider answers in order, so slot i % depth is free again
+        // once fewer than `depth` reads are outstanding
+        provider.read(region, uint64_t(i % 1024) * size, buffer.data() + (i % depth) * size, size,
+                      [&](uint16_t status) {
+                          std::lock_guard<std::mutex> guard(lock);
+                          if (status != WIRE_OK)
+                              failures++;
+                          inflight--;
+                          slot_free.notify_one();
+                      });
+    }
+    provider.drain();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (failures)
+        std::cerr << "[Bench] " << failures << " reads failed" << std::endl;
+    return ops / seconds;
+}
+
+// Reads `ops` blocks of `size` bytes as batches of `batch`, one batch per round trip
+double run_batched(RemoteMemory &provider, uint32_t region, int ops, uint32_t size, int batch)
+{
+    std::vector<char> buffer(size * batch);
+    std::vector<RemoteIo> ios(batch);
+    int failures = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ops; i += batch)
+    {
+        int count = std::min(batch, ops - i);
+        for (int j = 0; j < count; j++)
+            ios[j] = RemoteIo{region, uint64_t((i + j) % 1024) * size, size, buffer.data() + j * size};
+        if (provider.read_batch(ios.data(), count).get() != WIRE_OK)
+            failures += count;
+        for (int j = 0; j < count; j++)
+            failures += ios[j].status != WIRE_OK;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (failures)
+        std::cerr << "[Bench] " << failures << " batched reads failed" << std::endl;
+    return ops / seconds;
+}
+
+// Reads `ops` blocks of `size` bytes one at a time with read_cached()
+double run_cached(RemoteMemory &provider, uint32_t region, int ops, uint32_t size)
+{
+    std::vector<char> buffer(size);
+    int failures = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ops; i++)
+        failures += provider.read_cached(region, uint64_t(i % 1024) * size, buffer.data(), size) != WIRE_OK;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (failures)
+        std::cerr << "[Bench] " << failures << " cached reads failed" << std::endl;
+    return ops / seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    int ops = (argc > 1) ? std::stoi(argv[1]) : 100000;
+    uint32_t size = (argc > 2) ? std::stoul(argv[2]) : 64;
+    int depth = (argc > 3) ? std::stoi(argv[3]) : 64;
+    int batch = (argc > 4) ? std::stoi(argv[4]) : 256;
+    std::string host = (argc > 5) ? argv[5] : PROVIDER_IP;
+    int port = (argc > 6) ? std::stoi(argv[6]) : PROVIDER_PORT;
+
+    RemoteMemory provider;
+    if (!provider.connect(host, port))
+    {
+        std::cerr << "[Bench] Cannot reach provider at " << host << ":" << port << std::endl;
+        return 1;
+    }
+    uint32_t region;
+    uint16_t status = provider.alloc(uint64_t(size) * 1024, region);
+    if (status != WIRE_OK)
+    {
+        std::cerr << "[Bench] Allocation failed: " << wire_status_text(status) << std::endl;
+        return 1;
+    }
+
+    double serial = run(provider, region, ops, size, 1);
+    double pipelined = run(provider, region, ops, size, depth);
+    double batched = run_batched(provider, region, ops, size, batch);
+    double cached = run_cached(provider, region, ops, size);
+    std::cout << "[Bench] " << ops << " reads of " << size << " bytes\n"
+              << "  depth 1:  " << serial << " ops/s\n"
+              << "  depth " << depth << ": " << pipelined << " ops/s (" << pipelined / serial << "x)\n"
+              << "  batch " << batch << ": " << batched << " ops/s (" << batched / serial << "x)\n"
+              << "  cached:   " << cached << " ops/s (" << cached / serial << "x, " << provider.cache().hits()
+              << " hits, " << provider.cache().misses() << " misses)" << std::endl;
+
+    provider.free(region);
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "../common/reedsolomon.h"
+
+// Reed-Solomon encode throughput on one core, for every kernel this CPU
+// runs. Throughput counts data bytes in, the way erasure-coded storage is
+// usually quoted. Run:
+//
+//   ./rsbench [k] [m] [shard bytes] [seconds per kernel]
+
+// Data GB/s of rs_encode with `kernel`
+double run(int k, int m, std::vector<std::vector<uint8_t>> &shards, size_t length, double seconds, RsKernel kernel)
+{
+    std::vector<const uint8_t *> data;
+    std::vector<uint8_t *> parity;
+    for (int i = 0; i < k; i++)
+        data.push_back(shards[i].data());
+    for (int j = 0; j < m; j++)
+        parity.push_back(shards[k + j].data());
+
+    uint64_t rounds = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < seconds)
+    {
+        rs_encode(k, m, data.data(), parity.data(), length, kernel);
+        rounds++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return rounds * k * length / elapsed / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int k = (argc > 1) ? std::stoi(argv[1]) : 4;
+    int m = (argc > 2) ? std::stoi(argv[2]) : 2;
+    size_t length = (argc > 3) ? std::stoul(argv[3]) : (1 << 20);
+    double seconds = (argc > 4) ? std::stod(argv[4]) : 1.0;
+    if (k < 1 || m < 1 || k + m > RS_MAX_SHARDS)
+    {
+        std::cerr << "[Bench] Need k, m >= 1 and k + m <= " << RS_MAX_SHARDS << std::endl;
+        return 1;
+    }
+
+    std::mt19937 rng(1);
+    std::vector<std::vector<uint8_t>> shards(k + m, std::vector<uint8_t>(length));
+    for (int i = 0; i < k; i++)
+    {
+        for (uint8_t &byte : shards[i])
+            byte = rng();
+    }
+
+    struct Kernel
+    {
+        const char *name;
+        RsKernel run;
+        bool supported;
+    };
+    std::vector<Kernel> kernels = {{"scalar", rs_mul_xor_scalar, true}};
+#ifdef RS_X86
+    kernels.push_back({"ssse3", rs_mul_xor_ssse3, bool(__builtin_cpu_supports("ssse3"))});
+    kernels.push_back({"avx2", rs_mul_xor_avx2, bool(__builtin_cpu_supports("avx2"))});
+#endif
+    const char *best;
+    rs_best_kernel(&best);
+
+    std::cout << "[Bench] Encode k=" << k << " m=" << m << ", " << length << " bytes per shard, one core ("
+              << best << " in use)\n";
+    double scalar = 0;
+    for (const Kernel &kernel : kernels)
+    {
+        if (!kernel.supported)
+        {
+            std::cout << "  " << kernel.name << ": not supported\n";
+            continue;
+        }
+        double rate = run(k, m, shards, length, seconds, kernel.run);
+        if (scalar == 0)
+            scalar = rate;
+        std::cout << "  " << kernel.name << ": " << rate << " GB/s (" << rate / scalar << "x)\n";
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "../common/stripedmemory.h"
+
+// Large-transfer bandwidth of a region striped over the first 1, 2, ... n
+// of the given providers, to see how it scales with the stripe width. The
+// data is random so packing does not flatter it. Start the providers
+// (peer, then [3], on their own ports) and run:
+//
+//   ./stripebench [MiB] [seconds per width] [host:port]...
+
+#define PROVIDER_IP "127.0.0.1"
+
+// Write then read GB/s over `width` providers, each pass moving the whole region
+std::pair<double, double> run(const std::vector<StripedMemory::Address> &addresses, size_t width,
+                              std::string &data, double seconds)
+{
+    StripedMemory memory;
+    std::vector<StripedMemory::Address> members(addresses.begin(), addresses.begin() + width);
+    uint32_t region;
+    if (memory.connect(members) != width || memory.alloc(data.size(), region) != WIRE_OK)
+    {
+        std::cerr << "[Bench] Cannot set up a region over " << width << " providers" << std::endl;
+        return {0, 0};
+    }
+
+    double rates[2];
+    for (int pass = 0; pass < 2; pass++)
+    {
+        uint64_t moved = 0;
+        int failures = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0;
+        while (elapsed < seconds)
+        {
+            uint16_t status = pass == 0 ? memory.write(region, 0, data.data(), data.size())
+                                        : memory.read(region, 0, &data[0], data.size());
+            failures += status != WIRE_OK;
+            moved += data.size();
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        if (failures)
+            std::cerr << "[Bench] " << failures << " transfers failed" << std::endl;
+        rates[pass] = moved / elapsed / 1e9;
+    }
+    memory.free(region);
+    return {rates[0], rates[1]};
+}
+
+int main(int argc, char *argv[])
+{
+    size_t mib = (argc > 1) ? std::stoul(argv[1]) : 16;
+    double seconds = (argc > 2) ? std::stod(argv[2]) : 2;
+    std::vector<StripedMemory::Address> addresses;
+    for (int i = 3; i < argc; i++)
+    {
+        std::string address = argv[i];
+        size_t colon = address.find(':');
+        if (colon == std::string::npos)
+            addresses.push_back({PROVIDER_IP, std::stoi(address)});
+        else
+            addresses.push_back({address.substr(0, colon), std::stoi(address.substr(colon + 1))});
+    }
+    if (addresses.empty())
+    {
+        std::cerr << "[Bench] Usage: ./stripebench [MiB] [seconds per width] [host:port]..." << std::endl;
+        return 1;
+    }
+
+    std::string data(mib << 20, '\0');
+    std::mt19937_64 random(1);
+    for (size_t i = 0; i + 8 <= data.size(); i += 8)
+    {
+        uint64_t word = random();
+        memcpy(&data[i], &word, 8);
+    }
+
+    std::cout << "[Bench] " << mib << " MiB region, " << STRIPE_SIZE / 1024 << " KiB stripes\n";
+    double base = 0;
+    for (size_t width = 1; width <= addresses.size(); width++)
+    {
+        auto [write, read] = run(addresses, width, data, seconds);
+        if (width == 1)
+            base = read;
+        std::cout << "  " << width << " providers: write " << write << " GB/s, read " << read << " GB/s ("
+                  << (base ? read / base : 0) << "x)" << std::endl;
+    }
+    return 0;
+}